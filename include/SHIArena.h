@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace SHI {
+
+/// A monotonic allocator. Allocations are taken from a list of blocks by
+/// bumping a pointer, deallocation does nothing and reset() releases
+/// everything at once. Blocks are kept across resets, so once the arena has
+/// grown to its working size it does not touch the heap anymore.
+class Arena {
+ public:
+  explicit Arena(size_t blockSize = 1024) : blockSize(blockSize) {}
+  /// Use buffer as the first block, it is not freed by the arena
+  Arena(void *buffer, size_t size);
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+  ~Arena();
+
+  void *allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+  void reset();
+
+  size_t getUsed() const { return used; }
+  size_t getCapacity() const { return capacity; }
+  size_t getHighWaterMark() const { return highWaterMark; }
+  /// The number of times a block had to be allocated from the heap
+  size_t getBlockAllocations() const { return blockAllocations; }
+  std::vector<std::pair<std::string, std::string>> getStatistics() const;
+
+ private:
+  struct Block {
+    uint8_t *data;
+    size_t size;
+    bool owned;
+  };
+  std::vector<Block> blocks;
+  size_t currentBlock = 0;
+  size_t offset = 0;
+  size_t blockSize;
+  size_t used = 0;
+  size_t capacity = 0;
+  size_t highWaterMark = 0;
+  size_t blockAllocations = 0;
+};
+
+template <typename T>
+class ArenaAllocator {
+ public:
+  typedef T value_type;
+  typedef T *pointer;
+  typedef const T *const_pointer;
+  typedef T &reference;
+  typedef const T &const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+  template <typename U>
+  struct rebind {
+    typedef ArenaAllocator<U> other;
+  };
+
+  explicit ArenaAllocator(Arena *arena) : arena(arena) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &other)  // NOLINT implicit rebind
+      : arena(other.arena) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *, size_t) {}
+
+  Arena *arena;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+  return a.arena == b.arena;
+}
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+  return a.arena != b.arena;
+}
+
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>
+    ArenaString;
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+}  // namespace SHI
@@ -7,11 +7,16 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "SHIBusArbiter.h"
 #include "SHIFactory.h"
+#include "SHIFormat.h"
 #include "SHIObject.h"
 
 namespace SHI {
@@ -23,7 +28,7 @@ namespace SHI {
 
 class Print {
  private:
-  int writeError;
+  int writeError = 0;
   size_t printUnsigned(uint64_t value, int base);
   size_t printSigned(int64_t value, int base);
   template <typename T>
@@ -80,16 +85,108 @@ class Print {
   size_t println(void);
   size_t println(struct tm* timeinfo, const char* format);
   virtual void flush() {}
+
+ protected:
+  void setWriteError(int error = 1) { writeError = error; }
+};
+
+/// Collects the output of the many small writes that print() and println()
+/// issue and forwards it in one write to the target. The buffer memory is
+/// provided by the caller, see StaticBufferedPrint for an inline buffer.
+class BufferedPrint : public Print {
+ public:
+  enum FlushPolicy : uint8_t {
+    /// Only flush when the buffer is full or flush() is called
+    FLUSH_ON_FULL = 0,
+    /// Flush whenever a newline has been written
+    FLUSH_ON_NEWLINE = 1,
+    /// Flush when the oldest pending byte is older than the timeout
+    FLUSH_ON_TIMEOUT = 2
+  };
+  BufferedPrint(Print* target, uint8_t* buffer, size_t capacity,
+                uint8_t policy = FLUSH_ON_NEWLINE, uint32_t timeoutMs = 0)
+      : target(target),
+        buffer(buffer),
+        capacity(capacity),
+        policy(policy),
+        timeoutMs(timeoutMs) {}
+  ~BufferedPrint() { flushBuffer(); }
+
+  using Print::write;
+  size_t write(uint8_t data) override;
+  size_t write(const uint8_t* data, size_t size) override;
+  /// Writes the pending data to the target and flushes the target as well
+  void flush() override;
+  /// Writes the pending data to the target. Returns false if the target did
+  /// not accept all of it, the remaining data stays pending.
+  bool flushBuffer();
+  /// Flushes if the FLUSH_ON_TIMEOUT policy is due. Nothing calls it unless
+  /// the print is passed to Hardware::addBufferedPrint() or the owner polls
+  /// it from its own loop.
+  bool poll();
+
+  /// The data that has not been written to the target yet. It can be
+  /// consumed in place, i.e. to hand it to a DMA transfer.
+  const uint8_t* pending() const { return buffer; }
+  size_t pendingSize() const { return used; }
+  void consume(size_t count);
+  /// Returns space for count bytes in the buffer to be filled directly and
+  /// confirmed with commit(), or nullptr if it does not fit
+  uint8_t* reserve(size_t count);
+  void commit(size_t count);
+
+  size_t getCapacity() const { return capacity; }
+  void setPolicy(uint8_t newPolicy, uint32_t newTimeoutMs = 0) {
+    policy = newPolicy;
+    timeoutMs = newTimeoutMs;
+  }
+
+ private:
+  void appended(const uint8_t* data, size_t size);
+
+  Print* target;
+  uint8_t* buffer;
+  size_t capacity;
+  size_t used = 0;
+  uint8_t policy;
+  uint32_t timeoutMs;
+  int64_t firstPendingMs = 0;
+};
+
+template <size_t N>
+class StaticBufferedPrint : public BufferedPrint {
+ public:
+  explicit StaticBufferedPrint(Print* target,
+                               uint8_t policy = FLUSH_ON_NEWLINE,
+                               uint32_t timeoutMs = 0)
+      : BufferedPrint(target, storage, N, policy, timeoutMs) {}
+
+ private:
+  uint8_t storage[N];
 };
 
 class Bus : public SHIObject {
+ public:
   virtual void begin(Configuration* config) = 0;
   virtual void stop() = 0;
   virtual void loop() = 0;
   virtual std::vector<std::pair<int, std::string>> getUsedPins() = 0;
+  /// Drivers that share this bus with others should hold a BusTransaction
+  /// while talking to their device
+  BusArbiter* getArbiter() { return &arbiter; }
+  std::vector<std::pair<std::string, std::string>> getStatistics() override {
+    return arbiter.getStatistics();
+  }
+
+ protected:
+  explicit Bus(const std::string& name) : SHIObject(name) {}
+
+ private:
+  BusArbiter arbiter;
 };
 
-class SerialBus : public Bus, Print {
+class SerialBus : public Bus, public Print {
+ public:
   virtual int available(void) = 0;
   virtual int availableForWrite(void) = 0;
   virtual int peek(void) = 0;
@@ -99,9 +196,50 @@ class SerialBus : public Bus, Print {
   virtual void flush(bool txOnly) = 0;
   virtual size_t write(uint8_t) = 0;
   virtual size_t write(const uint8_t* buffer, size_t size) = 0;
+
+ protected:
+  explicit SerialBus(const std::string& name) : Bus(name) {}
+};
+
+struct SPITransfer {
+  /// nullptr sends zeros
+  const uint8_t* tx;
+  /// nullptr discards the received data
+  uint8_t* rx;
+  uint32_t size;
+  /// Passed to beginTransaction() when not nullptr
+  Configuration* settings;
+};
+
+/// Refers to a transfer started with SPIBus::submitTransfer()
+class SPITransferHandle {
+ public:
+  SPITransferHandle() {}
+  explicit SPITransferHandle(std::shared_future<bool> future)
+      : future(future) {}
+  bool isDone() const;
+  void wait() const;
+  /// Returns true when the transfer finished within timeoutMs
+  bool waitFor(int timeoutMs) const;
+  /// Waits for the transfer and returns whether it succeeded
+  bool succeeded() const;
+
+ private:
+  std::shared_future<bool> future;
 };
 
 class SPIBus : public Bus {
+ public:
+  /// Starts a transfer and returns without waiting for it, done is called
+  /// once it finished. The buffers need to stay valid until then. The
+  /// default implementation performs the transfer right away, implementations
+  /// with DMA or a worker thread override it. Two-phase sensors can submit
+  /// in triggerSensor() and wait in collectSensor(), so that the transfer
+  /// runs while the loop reads other sensors.
+  virtual SPITransferHandle submitTransfer(const SPITransfer& transfer,
+                                           std::function<void()> done =
+                                               nullptr);
+
   virtual void beginTransaction(Configuration* settings) = 0;
   virtual void endTransaction(void) = 0;
   virtual void transfer(uint8_t* data, uint32_t size) = 0;
@@ -119,8 +257,36 @@ class SPIBus : public Bus {
   virtual void writeBytes(const uint8_t* data, uint32_t size) = 0;
   virtual void writePattern(const uint8_t* data, uint8_t size,
                             uint32_t repeat) = 0;
+
+ protected:
+  explicit SPIBus(const std::string& name) : Bus(name) {}
 };
 
+/// Two sets of transfer buffers, so that the next transfer can be prepared
+/// while the previous one is in flight
+class SPIDoubleBuffer {
+ public:
+  explicit SPIDoubleBuffer(size_t size);
+  /// The buffer of the next transfer
+  uint8_t* getTxBuffer() { return tx[current].data(); }
+  /// The data received by the last submitted transfer, call wait() first
+  const uint8_t* getRxBuffer() const { return rx[1 - current].data(); }
+  size_t getSize() const { return tx[0].size(); }
+  /// Waits for the previous transfer, then submits size bytes of the tx
+  /// buffer and switches to the other set of buffers
+  SPITransferHandle submit(SPIBus* bus, uint32_t size,
+                           Configuration* settings = nullptr);
+  void wait() const { inFlight.wait(); }
+
+ private:
+  std::vector<uint8_t> tx[2];
+  std::vector<uint8_t> rx[2];
+  int current = 0;
+  SPITransferHandle inFlight;
+};
+
+class I2CTransactionQueue;
+
 enum class I2CError {
   I2C_ERROR_OK = 0,
   I2C_ERROR_DEV,
@@ -133,7 +299,8 @@ enum class I2CError {
   I2C_ERROR_NO_BEGIN
 };
 
-class I2CBus : public Bus, Print {
+class I2CBus : public Bus, public Print {
+ public:
   virtual uint8_t lastError() = 0;
   virtual char* getErrorText(uint8_t err) = 0;
 
@@ -160,6 +327,61 @@ class I2CBus : public Bus, Print {
   virtual void onRequest(void (*)(void)) = 0;
 
   virtual bool busy() = 0;
+
+  /// Hands a queue over for asynchronous execution by processSubmitted(),
+  /// which implementations call from loop() or a thread of their own. The
+  /// queue must not be touched until done has been called.
+  void submit(I2CTransactionQueue* queue, const SHIObject* device = nullptr,
+              std::function<void(I2CError)> done = nullptr);
+  /// Executes all submitted queues while holding the bus once, returns how
+  /// many were executed
+  size_t processSubmitted();
+
+ protected:
+  explicit I2CBus(const std::string& name) : Bus(name) {}
+
+ private:
+  struct Submission {
+    I2CTransactionQueue* queue;
+    const SHIObject* device;
+    std::function<void(I2CError)> done;
+  };
+  std::mutex submittedMutex;
+  std::vector<Submission> submitted;
+  std::vector<Submission> processing;
+};
+
+/// Implements the Wire style byte API of I2CBus on top of
+/// writeTransmission() and readTransmission(), for buses that only provide
+/// complete transfers
+class BufferedI2CBus : public I2CBus {
+ public:
+  void beginTransmission(uint16_t address) override;
+  uint8_t endTransmission(bool sendStop = true) override;
+  uint8_t requestFrom(uint16_t address, uint8_t size, bool sendStop) override;
+
+  using Print::write;
+  size_t write(uint8_t data) override;
+  size_t write(const uint8_t* data, size_t size) override;
+  int available(void) override;
+  int read(void) override;
+  int peek(void) override;
+  void flush(void) override;
+
+  /// Slave mode is not supported
+  void onReceive(void (*)(int)) override {}
+  void onRequest(void (*)(void)) override {}
+
+ protected:
+  explicit BufferedI2CBus(const std::string& name) : I2CBus(name) {}
+  /// The names of the I2CError values, for getErrorText()
+  static char* getDefaultErrorText(uint8_t err);
+
+ private:
+  uint16_t txAddress = 0;
+  std::vector<uint8_t> txBuffer;
+  std::vector<uint8_t> rxBuffer;
+  size_t rxPos = 0;
 };
 
 }  // namespace SHI
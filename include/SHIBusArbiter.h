@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "SHIObject.h"
+
+namespace SHI {
+
+class Bus;
+
+/// Grants exclusive access to a bus. Waiting devices are served by
+/// priority (higher first) and in the order they arrived. The thread owning
+/// the bus can acquire it again, i.e. from a helper function.
+class BusArbiter {
+ public:
+  void acquire(const SHIObject *device, int priority = 0);
+  void release();
+  /// Charges the time held so far to the current owner and counts the rest
+  /// of the transaction for device. Only the thread owning the bus can hand
+  /// it over, for others this does nothing.
+  void handOver(const SHIObject *device);
+  bool isBusy();
+  /// Forgets the statistics of a device that is about to be destroyed, so
+  /// that a new device at the same address starts from scratch
+  void unregisterDevice(const SHIObject *device);
+  std::vector<std::pair<std::string, std::string>> getStatistics();
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+  struct Waiter {
+    int priority;
+    uint64_t ticket;
+  };
+  struct DeviceStatistics {
+    // Captured when the entry is created, the device may be gone by the
+    // time the statistics are read
+    std::string name;
+    uint32_t transactions;
+    uint32_t contended;
+    uint64_t totalWaitUs;
+    uint64_t maxWaitUs;
+    uint64_t totalHoldUs;
+    uint64_t maxHoldUs;
+  };
+  bool isNext(uint64_t ticket) const;
+  void countTransaction(const SHIObject *device, uint64_t waitUs,
+                        bool contended);
+  void chargeHold(Clock::time_point now);
+
+  std::mutex mutex;
+  std::condition_variable released;
+  std::vector<Waiter> waiting;
+  uint64_t nextTicket = 0;
+  bool busy = false;
+  int depth = 0;
+  const SHIObject *owner = nullptr;
+  std::thread::id ownerThread;
+  Clock::time_point acquiredAt;
+  std::map<const SHIObject *, DeviceStatistics> statistics;
+};
+
+/// Holds the bus for its lifetime:
+///   {
+///     BusTransaction transaction(bus, this);
+///     bus->beginTransmission(address);
+///     ...
+///   }
+class BusTransaction {
+ public:
+  BusTransaction(Bus *bus, const SHIObject *device, int priority = 0);
+  BusTransaction(const BusTransaction &) = delete;
+  BusTransaction &operator=(const BusTransaction &) = delete;
+  ~BusTransaction();
+
+ private:
+  BusArbiter *arbiter;
+};
+
+}  // namespace SHI
@@ -0,0 +1,355 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "SHIBus.h"
+
+namespace SHI {
+
+/// A compact binary log of bus operations. Every record stores the
+/// operation, the time since the previous record, its duration, an
+/// argument, the result and the sent and received bytes. Numbers are
+/// stored as varints, so a record takes 7 bytes plus its data. A register
+/// read, one write of the register and one read of two bytes, takes about
+/// 17 bytes.
+class BusTrace {
+ public:
+  enum class Operation : uint8_t {
+    I2C_WRITE = 1,
+    I2C_READ,
+    SPI_TRANSFER,
+    SPI_WRITE,
+    SPI_WRITE_PATTERN,
+    SPI_TRANSFER_BITS,
+    SERIAL_AVAILABLE,
+    SERIAL_PEEK,
+    SERIAL_READ,
+    SERIAL_WRITE,
+    /// read(buffer, size), the argument is the requested size
+    SERIAL_READ_BYTES
+  };
+  struct Record {
+    Operation operation;
+    /// Time since the start of the previous record
+    uint32_t delayUs;
+    uint32_t durationUs;
+    /// The I2C address, number of bits or repeat count
+    uint32_t argument;
+    int32_t result;
+    /// Point into the trace, they stay valid until the trace is changed
+    const uint8_t *tx;
+    uint32_t txSize;
+    const uint8_t *rx;
+    uint32_t rxSize;
+  };
+
+  class Reader {
+   public:
+    explicit Reader(const BusTrace *trace) : trace(trace) {}
+    bool next(Record *record);
+    void rewind() { position = 0; }
+    /// For going back to a record that was read already
+    size_t getPosition() const { return position; }
+    void seek(size_t newPosition) { position = newPosition; }
+    bool atEnd() const { return position >= trace->data.size(); }
+
+   private:
+    bool readVarint(uint32_t *value);
+    const BusTrace *trace;
+    size_t position = 0;
+  };
+
+  void add(const Record &record);
+  void clear() {
+    data.clear();
+    records = 0;
+  }
+  bool empty() const { return data.empty(); }
+  size_t getSize() const { return data.size(); }
+  size_t getRecordCount() const { return records; }
+  Reader reader() const { return Reader(this); }
+
+  bool save(std::ostream &out) const;
+  bool load(std::istream &in);
+
+ private:
+  void writeVarint(uint32_t value);
+  std::vector<uint8_t> data;
+  size_t records = 0;
+};
+
+/// Measures the time of a recorded operation
+class TraceClock {
+ public:
+  TraceClock() : last(std::chrono::steady_clock::now()) {}
+  /// Starts an operation, returns the time since the previous one
+  uint32_t start();
+  /// Returns the time since start()
+  uint32_t stop() const;
+
+ private:
+  std::chrono::steady_clock::time_point last;
+  std::chrono::steady_clock::time_point started;
+};
+
+enum class ReplayLatency {
+  /// Every operation takes as long as it did when it was recorded
+  RECORDED,
+  /// Operations return right away, for throughput measurements
+  ZERO
+};
+
+/// Replays records of a BusTrace in order. An operation of another kind
+/// than the next record is answered with an error and leaves the record for
+/// the next operation, so an extra call doesn't shift the rest of the
+/// replay. Another argument or other data than recorded is answered as
+/// recorded. All of them are counted as mismatches.
+class TraceReplayer {
+ public:
+  TraceReplayer(const BusTrace *trace, ReplayLatency latency)
+      : reader(trace->reader()), latency(latency) {}
+  /// Returns false if the trace is exhausted or the next record is of
+  /// another operation
+  bool next(BusTrace::Operation operation, uint32_t argument,
+            const uint8_t *tx, uint32_t txSize, BusTrace::Record *record);
+  void rewind() { reader.rewind(); }
+  uint32_t getReplayed() const { return replayed; }
+  uint32_t getMismatches() const { return mismatches; }
+  std::vector<std::pair<std::string, std::string>> getStatistics() const;
+
+ private:
+  BusTrace::Reader reader;
+  ReplayLatency latency;
+  uint32_t replayed = 0;
+  uint32_t mismatches = 0;
+};
+
+/// Forwards to another I2CBus and records the transfers
+class RecordingI2CBus : public BufferedI2CBus {
+ public:
+  RecordingI2CBus(I2CBus *bus, BusTrace *trace)
+      : BufferedI2CBus("RecordingI2CBus"), bus(bus), trace(trace) {}
+  void begin(Configuration *config) override { bus->begin(config); }
+  void stop() override { bus->stop(); }
+  void loop() override { processSubmitted(); }
+  std::vector<std::pair<int, std::string>> getUsedPins() override {
+    return bus->getUsedPins();
+  }
+  void accept(Visitor &visitor) override {}
+  const Configuration *getConfig() const override { return bus->getConfig(); }
+  bool reconfigure(Configuration *newConfig) override {
+    return bus->reconfigure(newConfig);
+  }
+
+  uint8_t lastError() override { return bus->lastError(); }
+  char *getErrorText(uint8_t err) override { return bus->getErrorText(err); }
+  I2CError writeTransmission(uint16_t address, uint8_t *buff, uint16_t size,
+                             bool sendStop = true) override;
+  I2CError readTransmission(uint16_t address, uint8_t *buff, uint16_t size,
+                            bool sendStop = true,
+                            uint32_t *readCount = NULL) override;
+  bool busy() override { return bus->busy(); }
+
+ private:
+  I2CBus *bus;
+  BusTrace *trace;
+  TraceClock clock;
+};
+
+/// An I2CBus that answers from a recorded trace
+class ReplayI2CBus : public BufferedI2CBus {
+ public:
+  ReplayI2CBus(const BusTrace *trace,
+               ReplayLatency latency = ReplayLatency::ZERO)
+      : BufferedI2CBus("ReplayI2CBus"), replayer(trace, latency) {}
+  void begin(Configuration *config) override {}
+  void stop() override {}
+  void loop() override { processSubmitted(); }
+  std::vector<std::pair<int, std::string>> getUsedPins() override {
+    return {};
+  }
+  void accept(Visitor &visitor) override {}
+  const Configuration *getConfig() const override { return nullptr; }
+  bool reconfigure(Configuration *newConfig) override { return true; }
+
+  uint8_t lastError() override { return static_cast<uint8_t>(error); }
+  char *getErrorText(uint8_t err) override {
+    return getDefaultErrorText(err);
+  }
+  I2CError writeTransmission(uint16_t address, uint8_t *buff, uint16_t size,
+                             bool sendStop = true) override;
+  I2CError readTransmission(uint16_t address, uint8_t *buff, uint16_t size,
+                            bool sendStop = true,
+                            uint32_t *readCount = NULL) override;
+  bool busy() override { return false; }
+
+  TraceReplayer *getReplayer() { return &replayer; }
+  std::vector<std::pair<std::string, std::string>> getStatistics() override;
+
+ private:
+  TraceReplayer replayer;
+  I2CError error = I2CError::I2C_ERROR_OK;
+};
+
+/// Forwards to another SPIBus and records the transfers
+class RecordingSPIBus : public SPIBus {
+ public:
+  RecordingSPIBus(SPIBus *bus, BusTrace *trace)
+      : SPIBus("RecordingSPIBus"), bus(bus), trace(trace) {}
+  void begin(Configuration *config) override { bus->begin(config); }
+  void stop() override { bus->stop(); }
+  void loop() override { bus->loop(); }
+  std::vector<std::pair<int, std::string>> getUsedPins() override {
+    return bus->getUsedPins();
+  }
+  void accept(Visitor &visitor) override {}
+  const Configuration *getConfig() const override { return bus->getConfig(); }
+  bool reconfigure(Configuration *newConfig) override {
+    return bus->reconfigure(newConfig);
+  }
+
+  void beginTransaction(Configuration *settings) override {
+    bus->beginTransaction(settings);
+  }
+  void endTransaction(void) override { bus->endTransaction(); }
+  void transfer(uint8_t *data, uint32_t size) override;
+  uint8_t transfer(uint8_t data) override;
+  uint16_t transfer16(uint16_t data) override;
+  uint32_t transfer32(uint32_t data) override;
+  void transferBytes(const uint8_t *data, uint8_t *out,
+                     uint32_t size) override;
+  void transferBits(uint32_t data, uint32_t *out, uint8_t bits) override;
+  void write(uint8_t data) override;
+  void write16(uint16_t data) override;
+  void write32(uint32_t data) override;
+  void writeBytes(const uint8_t *data, uint32_t size) override;
+  void writePattern(const uint8_t *data, uint8_t size,
+                    uint32_t repeat) override;
+
+ private:
+  SPIBus *bus;
+  BusTrace *trace;
+  TraceClock clock;
+  std::vector<uint8_t> txCopy;
+};
+
+/// An SPIBus that answers from a recorded trace
+class ReplaySPIBus : public SPIBus {
+ public:
+  ReplaySPIBus(const BusTrace *trace,
+               ReplayLatency latency = ReplayLatency::ZERO)
+      : SPIBus("ReplaySPIBus"), replayer(trace, latency) {}
+  void begin(Configuration *config) override {}
+  void stop() override {}
+  void loop() override {}
+  std::vector<std::pair<int, std::string>> getUsedPins() override {
+    return {};
+  }
+  void accept(Visitor &visitor) override {}
+  const Configuration *getConfig() const override { return nullptr; }
+  bool reconfigure(Configuration *newConfig) override { return true; }
+
+  void beginTransaction(Configuration *settings) override {}
+  void endTransaction(void) override {}
+  void transfer(uint8_t *data, uint32_t size) override;
+  uint8_t transfer(uint8_t data) override;
+  uint16_t transfer16(uint16_t data) override;
+  uint32_t transfer32(uint32_t data) override;
+  void transferBytes(const uint8_t *data, uint8_t *out,
+                     uint32_t size) override;
+  void transferBits(uint32_t data, uint32_t *out, uint8_t bits) override;
+  void write(uint8_t data) override;
+  void write16(uint16_t data) override;
+  void write32(uint32_t data) override;
+  void writeBytes(const uint8_t *data, uint32_t size) override;
+  void writePattern(const uint8_t *data, uint8_t size,
+                    uint32_t repeat) override;
+
+  TraceReplayer *getReplayer() { return &replayer; }
+  std::vector<std::pair<std::string, std::string>> getStatistics() override;
+
+ private:
+  void replay(BusTrace::Operation operation, uint32_t argument,
+              const uint8_t *tx, uint8_t *rx, uint32_t size);
+  TraceReplayer replayer;
+  std::vector<uint8_t> txCopy;
+};
+
+/// Forwards to another SerialBus and records the traffic
+class RecordingSerialBus : public SerialBus {
+ public:
+  RecordingSerialBus(SerialBus *bus, BusTrace *trace)
+      : SerialBus("RecordingSerialBus"), bus(bus), trace(trace) {}
+  void begin(Configuration *config) override { bus->begin(config); }
+  void stop() override { bus->stop(); }
+  void loop() override { bus->loop(); }
+  std::vector<std::pair<int, std::string>> getUsedPins() override {
+    return bus->getUsedPins();
+  }
+  void accept(Visitor &visitor) override {}
+  const Configuration *getConfig() const override { return bus->getConfig(); }
+  bool reconfigure(Configuration *newConfig) override {
+    return bus->reconfigure(newConfig);
+  }
+
+  int available(void) override;
+  int availableForWrite(void) override { return bus->availableForWrite(); }
+  int peek(void) override;
+  int read(void) override;
+  size_t read(uint8_t *buffer, size_t size) override;
+  void flush(bool txOnly) override { bus->flush(txOnly); }
+  using Print::write;
+  size_t write(uint8_t data) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+
+ private:
+  SerialBus *bus;
+  BusTrace *trace;
+  TraceClock clock;
+};
+
+/// A SerialBus that answers from a recorded trace
+class ReplaySerialBus : public SerialBus {
+ public:
+  ReplaySerialBus(const BusTrace *trace,
+                  ReplayLatency latency = ReplayLatency::ZERO)
+      : SerialBus("ReplaySerialBus"), replayer(trace, latency) {}
+  void begin(Configuration *config) override {}
+  void stop() override {}
+  void loop() override {}
+  std::vector<std::pair<int, std::string>> getUsedPins() override {
+    return {};
+  }
+  void accept(Visitor &visitor) override {}
+  const Configuration *getConfig() const override { return nullptr; }
+  bool reconfigure(Configuration *newConfig) override { return true; }
+
+  int available(void) override;
+  int availableForWrite(void) override { return 4096; }
+  int peek(void) override;
+  int read(void) override;
+  size_t read(uint8_t *buffer, size_t size) override;
+  void flush(bool txOnly) override {}
+  using Print::write;
+  size_t write(uint8_t data) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+
+  TraceReplayer *getReplayer() { return &replayer; }
+  std::vector<std::pair<std::string, std::string>> getStatistics() override;
+
+ private:
+  TraceReplayer replayer;
+};
+
+}  // namespace SHI
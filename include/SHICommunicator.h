@@ -18,6 +18,13 @@ class Communicator : public SHIObject {
   virtual void setupCommunication() = 0;
   virtual void loopCommunication() = 0;
   virtual void newReading(const MeasurementBundle &reading) {}
+  /// Called for readings of sensors that support readSensorInto(). The
+  /// default converts the reading into a re-used bundle and forwards it to
+  /// newReading().
+  virtual void newCompactReading(const ColumnarMeasurementBundle &reading) {
+    reading.toBundle(&converted);
+    newReading(converted);
+  }
   virtual void newStatus(const Measurement &status, SHIObject *src) {}
 
   void accept(Visitor &visitor) override;
@@ -30,6 +37,9 @@ class Communicator : public SHIObject {
  protected:
   explicit Communicator(const std::string &name) : SHIObject(name) {}
   bool isConnected = false;
+
+ private:
+  MeasurementBundle converted;
 };
 
 }  // namespace SHI
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace SHI {
+
+/// Writes the compact binary form of a configuration. Members are written
+/// in declaration order without names: integers as zigzag varints, floats
+/// and doubles as little endian IEEE 754, strings and vectors prefixed with
+/// their length. Reading it back requires the same configuration class.
+class ConfigEncoder {
+ public:
+  explicit ConfigEncoder(std::vector<uint8_t> *out) : out(out) {}
+  void write(bool value) { out->push_back(value ? 1 : 0); }
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value &&
+                          !std::is_same<T, bool>::value>::type
+  write(T value) {
+    if (std::is_signed<T>::value)
+      writeSigned(static_cast<int64_t>(value));
+    else
+      writeUnsigned(static_cast<uint64_t>(value));
+  }
+  void write(float value);
+  void write(double value);
+  void write(const std::string &value);
+  template <typename T>
+  void write(const std::vector<T> &values) {
+    writeUnsigned(values.size());
+    for (auto &&value : values) write(static_cast<const T &>(value));
+  }
+
+ private:
+  void writeSigned(int64_t value);
+  void writeUnsigned(uint64_t value);
+  std::vector<uint8_t> *out;
+};
+
+/// Reads what ConfigEncoder wrote. Reading past the end or a malformed
+/// value returns zero or empty values and sets failed().
+class ConfigDecoder {
+ public:
+  ConfigDecoder(const uint8_t *data, size_t size)
+      : position(data), end(data + size) {}
+  template <typename T>
+  typename std::enable_if<std::is_same<T, bool>::value, T>::type read() {
+    return readUnsigned() != 0;
+  }
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value &&
+                              !std::is_same<T, bool>::value,
+                          T>::type
+  read() {
+    if (std::is_signed<T>::value) return static_cast<T>(readSigned());
+    return static_cast<T>(readUnsigned());
+  }
+  template <typename T>
+  typename std::enable_if<std::is_same<T, float>::value, T>::type read() {
+    return readFloat();
+  }
+  template <typename T>
+  typename std::enable_if<std::is_same<T, double>::value, T>::type read() {
+    return readDouble();
+  }
+  template <typename T>
+  typename std::enable_if<std::is_same<T, std::string>::value, T>::type
+  read() {
+    return readString();
+  }
+  template <typename T>
+  std::vector<T> readVector() {
+    std::vector<T> values;
+    // Every element takes at least one byte
+    uint64_t size = readUnsigned();
+    if (size > static_cast<uint64_t>(end - position)) {
+      failure = true;
+      return values;
+    }
+    values.reserve(size);
+    for (uint64_t i = 0; i < size; i++) values.push_back(read<T>());
+    return values;
+  }
+  bool failed() const { return failure; }
+  bool atEnd() const { return position == end; }
+
+ private:
+  int64_t readSigned();
+  uint64_t readUnsigned();
+  float readFloat();
+  double readDouble();
+  std::string readString();
+  bool take(size_t size, const uint8_t **data);
+  const uint8_t *position;
+  const uint8_t *end;
+  bool failure = false;
+};
+
+}  // namespace SHI
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace SHI {
+
+/// Holds the configuration of an object as an immutable snapshot. Readers
+/// share the current snapshot instead of copying it, reconfiguring swaps in
+/// a new one atomically. A snapshot stays valid and unchanged for as long as
+/// a reader holds it, even when it was replaced meanwhile.
+template <typename T>
+class ConfigHolder {
+ public:
+  explicit ConfigHolder(const T &config)
+      : ConfigHolder(std::make_shared<const T>(config)) {}
+  explicit ConfigHolder(std::shared_ptr<const T> config)
+      : snapshot(std::move(config)), current(snapshot.get()) {}
+  ConfigHolder(const ConfigHolder &) = delete;
+  ConfigHolder &operator=(const ConfigHolder &) = delete;
+
+  /// The current snapshot, safe to call from any thread
+  std::shared_ptr<const T> load() const { return std::atomic_load(&snapshot); }
+  /// The current snapshot without touching the reference count, for the
+  /// thread that calls loop() and the sensor reads it waits for. It stays
+  /// valid until the second store() after it, other threads use load().
+  const T *get() const { return current.load(std::memory_order_acquire); }
+  const T *operator->() const { return get(); }
+
+  void store(const T &config) { store(std::make_shared<const T>(config)); }
+  void store(std::shared_ptr<const T> config) {
+    auto next = config.get();
+    // Keeps what get() returned before alive for one more store()
+    previous = std::atomic_exchange(&snapshot, std::move(config));
+    current.store(next, std::memory_order_release);
+    version.fetch_add(1, std::memory_order_release);
+  }
+  /// Increases with every store(), so readers can keep values derived from
+  /// a snapshot until the version changes
+  uint32_t getVersion() const {
+    return version.load(std::memory_order_acquire);
+  }
+
+ private:
+  std::shared_ptr<const T> snapshot;
+  std::shared_ptr<const T> previous;
+  std::atomic<const T *> current;
+  std::atomic<uint32_t> version{0};
+};
+
+}  // namespace SHI
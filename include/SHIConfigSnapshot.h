@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ArduinoJson.h"
+
+namespace SHI {
+
+/// A configuration compiled into a flat binary form. It consists of a
+/// header, a table of class names, a table of objects in the order the
+/// factory would construct them and the fields of each object. The fields
+/// are encoded by the codec of the configuration class if it was registered
+/// with Factory::registerConfiguredFactory(), and as MessagePack otherwise.
+/// The children of an object are not part of its fields, the
+/// object table links them to their parent instead. All numbers are little
+/// endian, so a snapshot can be used straight from a mapped file.
+class ConfigSnapshot {
+ public:
+  /// Where an object is attached to its parent
+  enum class Section : uint8_t { ROOT = 0, SENSORS, GROUPS, COMMS };
+  /// How the fields of an object are encoded
+  enum class Encoding : uint8_t { MSGPACK = 0, CODEC };
+  struct Object {
+    uint16_t classId;
+    Section section;
+    /// 0 for the hardware, 1 for its children and so on
+    uint8_t depth;
+    uint32_t parent;
+    Encoding encoding;
+    const uint8_t *fields;
+    uint32_t fieldsSize;
+  };
+  static const uint16_t VERSION = 2;
+
+  /// Checks the header and that all tables stay within the data, which
+  /// has to stay valid as long as the snapshot is used
+  bool open(const uint8_t *data, size_t size);
+  uint32_t getClassCount() const { return classCount; }
+  std::string getClassName(uint16_t classId) const;
+  uint32_t getObjectCount() const { return objectCount; }
+  Object getObject(uint32_t index) const;
+  /// A document of this capacity holds the fields of any object encoded
+  /// as MessagePack
+  uint32_t getMaxCapacity() const { return maxCapacity; }
+
+ private:
+  const uint8_t *data = nullptr;
+  uint32_t classCount = 0;
+  uint32_t objectCount = 0;
+  uint32_t maxCapacity = 0;
+  const uint8_t *classes = nullptr;
+  const uint8_t *objects = nullptr;
+  const uint8_t *strings = nullptr;
+  const uint8_t *fields = nullptr;
+};
+
+/// Writes a ConfigSnapshot, objects have to be added parents first
+class ConfigSnapshotBuilder {
+ public:
+  uint32_t addObject(const std::string &className,
+                     ConfigSnapshot::Section section, uint8_t depth,
+                     uint32_t parent, JsonObjectConst fields);
+  /// Adds an object whose fields were written by a ConfigEncoder
+  uint32_t addObject(const std::string &className,
+                     ConfigSnapshot::Section section, uint8_t depth,
+                     uint32_t parent, const std::vector<uint8_t> &encoded);
+  uint32_t getObjectCount() const { return objectCount; }
+  void finish(std::vector<uint8_t> *snapshot) const;
+
+ private:
+  uint16_t getClassId(const std::string &className);
+  uint32_t addEntry(const std::string &className,
+                    ConfigSnapshot::Section section, uint8_t depth,
+                    uint32_t parent, ConfigSnapshot::Encoding encoding,
+                    const char *data, size_t size);
+  std::map<std::string, uint16_t> classIds;
+  std::vector<uint8_t> classTable;
+  std::vector<uint8_t> objectTable;
+  std::string strings;
+  std::string fields;
+  uint32_t objectCount = 0;
+  uint32_t maxCapacity = 0;
+};
+
+/// A read-only file in memory. It is mapped on Linux and read into a
+/// buffer elsewhere.
+class SnapshotFile {
+ public:
+  explicit SnapshotFile(const std::string &path);
+  SnapshotFile(const SnapshotFile &) = delete;
+  SnapshotFile &operator=(const SnapshotFile &) = delete;
+  ~SnapshotFile();
+  bool isOpen() const { return opened; }
+  const uint8_t *getData() const { return data; }
+  size_t getSize() const { return size; }
+
+ private:
+  bool opened = false;
+  bool mapped = false;
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+  std::vector<uint8_t> buffer;
+};
+
+}  // namespace SHI
@@ -6,19 +6,23 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <stdio.h>
 
 #include <functional>
 #include <iostream>
-#include <map>
 #include <memory>
-#include <stack>
+#include <sstream>
 #include <string>
 #include <tuple>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 #include "ArduinoJson.h"
+#include "SHIConfigCodec.h"
+#include "SHIConfigSnapshot.h"
+#include "SHIJsonWriter.h"
 #include "SHIObject.h"
 
 namespace SHI {
@@ -37,21 +41,52 @@ enum class FactoryErrors {
   /// There is no entry for the requested hardware
   MissingRegistryForEntry,
   /// When bootstrapping from a file-system, the file was not found
-  FailureToLoadFile
+  FailureToLoadFile,
+  /// The binary snapshot is corrupt or of another version
+  InvalidSnapshot,
+  /// Reconfiguring needs a hardware that was constructed before
+  NoHardwareToReconfigure
 };
 
 class Configuration {
  public:
   virtual std::string toJson() const;
-  virtual void printJson(std::ostream printer) const;
+  virtual void printJson(std::ostream &printer) const;  // NOLINT
+  /// Writes the members into an object that the writer has already opened
+  virtual void writeJson(JsonWriter &writer) const;  // NOLINT
   virtual void fillData(
       JsonObject &obj) const = 0;  // NOLINT Yes, non constant reference
  protected:
   virtual int getExpectedCapacity() const = 0;
 };
 
+/// What Factory::reconfigure() did with the objects of the configuration
+struct ReconfigurationStats {
+  size_t unchanged = 0;
+  /// reconfigure() accepted the new configuration
+  size_t reconfigured = 0;
+  /// reconfigure() refused, so a new object took the place of the old one
+  size_t replaced = 0;
+  size_t added = 0;
+  size_t removed = 0;
+  /// Refused by the hardware or a group, which can't be replaced
+  size_t failed = 0;
+};
+
 typedef std::tuple<SHIObject *, SHI::FactoryErrors> FactoryResult;
 typedef std::function<FactoryResult(const JsonObject &obj)> factoryFunction;
+typedef FactoryResult (*factoryPointer)(const JsonObject &obj);
+typedef std::function<void(const JsonObject &obj, ConfigEncoder &encoder)>
+    snapshotEncoder;
+typedef std::function<FactoryResult(ConfigDecoder &decoder)> snapshotDecoder;
+
+/// FNV-1a hash of a class name, usable at compile time
+constexpr uint32_t factoryHash(const char *name, uint32_t hash = 2166136261u) {
+  return *name == '\0'
+             ? hash
+             : factoryHash(name + 1,
+                           (hash ^ static_cast<uint8_t>(*name)) * 16777619u);
+}
 
 class Factory {
  public:
@@ -63,12 +98,86 @@ class Factory {
     instance = nullptr;
   }
   bool registerFactory(const std::string &name, factoryFunction factory);
+  /// Plain functions are called without the std::function indirection
+  bool registerFactory(const std::string &name, factoryPointer factory);
+  /// Lambdas without captures are registered as plain functions
+  template <typename F>
+  bool registerFactory(const std::string &name, F factory) {
+    return registerFactory(name, factory,
+                           std::is_convertible<F, factoryPointer>());
+  }
+  /// Registers a class that is constructed from its configuration C. C needs
+  /// the JSON and ConfigDecoder constructors and encode() that
+  /// prepareConfigImpl.py generates. compileSnapshot() stores C in its
+  /// binary form, so constructFromSnapshot() builds the object without a
+  /// JsonDocument. T is what the object is attached as: Hardware,
+  /// SensorGroup, Sensor or Communicator.
+  template <typename C, typename T>
+  bool registerConfiguredFactory(const std::string &name,
+                                 std::function<T *(const C &)> construct) {
+    static_assert(std::is_base_of<Configuration, C>::value,
+                  "Type needs to derive of Config");
+    // The object changes its own copy when it is reconfigured, the
+    // published one stays as it is for readers on other threads
+    Entry entry = {factoryHash(name.c_str()), name, nullptr,
+                   [this, construct](const JsonObject &obj) {
+                     auto config = std::make_shared<const C>(obj);
+                     T *object = construct(*config);
+                     object->publishConfig(config);
+                     return attach(object, obj);
+                   }};
+    entry.encode = [](const JsonObject &obj, ConfigEncoder &encoder) {
+      C(obj).encode(encoder);
+      encodeExtras(static_cast<T *>(nullptr), obj, encoder);
+    };
+    entry.decode = [this, construct](ConfigDecoder &decoder) {
+      auto config = std::make_shared<const C>(decoder);
+      if (decoder.failed())
+        return errorToResult(FactoryErrors::InvalidSnapshot);
+      T *object = construct(*config);
+      object->publishConfig(config);
+      return decodeExtras(object, decoder);
+    };
+    factories.push_back(std::move(entry));
+    frozen = false;
+    return true;
+  }
+  /// Sorts the registry for lookups. The first lookup after registering
+  /// does this as well, registering again later is allowed but sorts again.
+  void freeze();
   FactoryResult construct(const std::string &json);
+  /// Parses json in place, the buffer is modified and has to stay valid
+  /// only until construct() returns
+  FactoryResult construct(char *json, size_t size);
+  /// Parses the configuration while reading it from the stream
+  FactoryResult construct(std::istream &json);
+  FactoryResult constructFromFile(const std::string &path);
+  /// Compiles a JSON configuration into a binary snapshot, see
+  /// ConfigSnapshot. Only the structure understood by the default factories
+  /// is kept, and every class needs a registered factory.
+  FactoryErrors compileSnapshot(const std::string &json,
+                                std::vector<uint8_t> *snapshot);
+  /// Constructs from a snapshot without parsing any JSON. The data has to
+  /// stay valid only until the call returns.
+  FactoryResult constructFromSnapshot(const uint8_t *snapshot, size_t size);
+  FactoryResult constructFromSnapshotFile(const std::string &path);
+  /// Applies a new configuration to the running hw without restarting it.
+  /// The configuration is compared with what ConfigurationVisitor writes,
+  /// children are matched by the n-th occurrence of their key in the same
+  /// list, groups by their name. Only objects whose configuration changed
+  /// are reconfigured, sensors and communicators that are new or gone are
+  /// set up or stopped, all others keep sampling on their schedule. Nothing
+  /// is changed if an object can't be constructed. Call it from the thread
+  /// that calls loop().
+  FactoryErrors reconfigure(const std::string &json,
+                            ReconfigurationStats *stats = nullptr);
   FactoryResult defaultHardwareFactory(SHI::Hardware *hardware,
                                        const JsonObject &obj);
   FactoryResult defaultCommunicatorFactory(SHI::Communicator *comm,
                                            const JsonObject &obj);
   FactoryResult defaultSensorGroupFactory(const JsonObject &obj);
+  FactoryResult defaultSensorGroupFactory(SHI::SensorGroup *group,
+                                          const JsonObject &obj);
   FactoryResult defaultSensorFactory(SHI::Sensor *hardware,
                                      const JsonObject &obj);
   static SHI::FactoryErrors getError(FactoryResult result);
@@ -91,16 +200,91 @@ class Factory {
   Factory() {}
   Factory(const Factory &copy) = delete;
   ~Factory() {}
+  struct Entry {
+    uint32_t hash;
+    std::string name;
+    factoryPointer function;
+    factoryFunction factory;
+    /// Only set by registerConfiguredFactory()
+    snapshotEncoder encode;
+    snapshotDecoder decode;
+    FactoryResult call(const JsonObject &obj) const {
+      return function != nullptr ? function(obj) : factory(obj);
+    }
+  };
+  FactoryResult attach(Hardware *hardware, const JsonObject &obj) {
+    return defaultHardwareFactory(hardware, obj);
+  }
+  FactoryResult attach(SensorGroup *group, const JsonObject &obj) {
+    return defaultSensorGroupFactory(group, obj);
+  }
+  FactoryResult attach(Sensor *sensor, const JsonObject &obj) {
+    return defaultSensorFactory(sensor, obj);
+  }
+  FactoryResult attach(Communicator *comm, const JsonObject &obj) {
+    return defaultCommunicatorFactory(comm, obj);
+  }
+  /// What the default factories read from obj besides the configuration,
+  /// in the binary form of snapshots
+  static void encodeExtras(const Hardware *, const JsonObject &obj,
+                           ConfigEncoder &encoder) {}  // NOLINT
+  static void encodeExtras(const SensorGroup *, const JsonObject &obj,
+                           ConfigEncoder &encoder) {}  // NOLINT
+  static void encodeExtras(const Sensor *, const JsonObject &obj,
+                           ConfigEncoder &encoder);  // NOLINT
+  static void encodeExtras(const Communicator *, const JsonObject &obj,
+                           ConfigEncoder &encoder) {}  // NOLINT
+  /// The counterparts of encodeExtras(), they delete the object if the
+  /// snapshot is corrupt
+  FactoryResult decodeExtras(Hardware *hardware,
+                             ConfigDecoder &decoder);  // NOLINT
+  FactoryResult decodeExtras(SensorGroup *group,
+                             ConfigDecoder &decoder);  // NOLINT
+  FactoryResult decodeExtras(Sensor *sensor, ConfigDecoder &decoder);  // NOLINT
+  FactoryResult decodeExtras(Communicator *comm,
+                             ConfigDecoder &decoder);  // NOLINT
+  template <typename F>
+  bool registerFactory(const std::string &name, F factory, std::true_type) {
+    return registerFactory(name, static_cast<factoryPointer>(factory));
+  }
+  template <typename F>
+  bool registerFactory(const std::string &name, F factory, std::false_type) {
+    return registerFactory(name, factoryFunction(factory));
+  }
+  const Entry *findFactory(const char *name, uint32_t hash);
+  const Entry *findFactory(const char *name) {
+    return findFactory(name, factoryHash(name));
+  }
   static Factory *instance;
-  std::map<std::string, factoryFunction> factories;
+  /// Sorted by hash and name once frozen
+  std::vector<Entry> factories;
+  bool frozen = true;
   std::tuple<SHIObject *, SHI::FactoryErrors> callFactory(
-      const ArduinoJson::JsonObject &arguments, const std::string &className);
-  DynamicJsonDocument doc{5000};
+      const ArduinoJson::JsonObject &arguments, const char *className);
+  FactoryResult constructFromDocument(JsonDocument &doc);  // NOLINT
+  /// Constructs an object without its children, for comparing and handing
+  /// over its configuration. hw is left untouched.
+  FactoryResult constructWithoutChildren(const char *className,
+                                         JsonObjectConst obj);
+  uint32_t addToSnapshot(const Entry *entry, ConfigSnapshot::Section section,
+                         uint8_t depth, uint32_t parent, const JsonObject &obj,
+                         ConfigSnapshotBuilder *builder);
+  FactoryErrors compileChildren(const JsonObject &obj, uint8_t depth,
+                                uint32_t parent,
+                                ConfigSnapshotBuilder *builder);
 };
 
+/// Writes the configuration of everything it visits as JSON. The output is
+/// produced while visiting, so the memory used does not depend on the
+/// number of objects.
 class ConfigurationVisitor : public Visitor {
  public:
-  std::string toJson() const;
+  /// Collects the JSON in memory, it is returned by toJson()
+  ConfigurationVisitor() : writer(&buffer, true) {}
+  /// Streams the JSON to out, toJson() stays empty
+  explicit ConfigurationVisitor(std::ostream *out, bool pretty = true)
+      : writer(out, pretty) {}
+  std::string toJson() const { return buffer.str(); }
 
  protected:
   void enterVisit(Sensor *sensor) override;
@@ -113,15 +297,14 @@ class ConfigurationVisitor : public Visitor {
   void visit(MeasurementMetaData *data) override;
 
  private:
-  struct Record {
-    std::vector<std::shared_ptr<Record>> sensors;
-    std::vector<std::shared_ptr<Record>> comms;
-    std::vector<std::shared_ptr<Record>> groups;
-    DynamicJsonDocument doc{5000};
-    JsonObject buildTree();
-  };
-  std::stack<std::shared_ptr<Record>> stack;
-  std::shared_ptr<Record> currentNode;
+  /// The child array that is currently open in an object
+  enum class Section { NONE, SENSORS, GROUPS, COMMS };
+  void beginNode(Section section, const std::string &name,
+                 const Configuration *config);
+  void endNode();
+  std::ostringstream buffer;
+  JsonWriter writer;
+  std::vector<Section> sections;
 };
 
 }  // namespace SHI
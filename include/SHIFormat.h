@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace SHI {
+
+/// Number formatting without printf. All functions write into a caller
+/// provided buffer without a terminating null and return the length.
+namespace Format {
+
+/// Enough for a 64 bit number in binary plus a sign
+const size_t MAX_INTEGER_LENGTH = 65;
+/// Enough for any result of formatFixed()
+const size_t MAX_FIXED_LENGTH = 32;
+/// The largest precision formatFixed() handles
+const int MAX_FIXED_PRECISION = 9;
+
+size_t formatUnsigned(uint64_t value, char *out);
+size_t formatSigned(int64_t value, char *out);
+size_t formatHex(uint64_t value, char *out, bool upperCase = true);
+size_t formatBinary(uint64_t value, char *out);
+/// Any base from 2 to 36, bases that are a power of two don't divide
+size_t formatBase(uint64_t value, int base, char *out);
+
+/// Formats like printf("%.*f", precision, value). Returns 0 if the value is
+/// too large or the precision is above MAX_FIXED_PRECISION, the caller has
+/// to fall back to printf then.
+size_t formatFixed(double value, int precision, char *out);
+/// Returns N for a format of the form "%.Nf" or "%0.Nf", otherwise -1
+int parseFixedPrecision(const char *format);
+
+std::string toString(int64_t value);
+/// Formats with formatFixed() when possible and snprintf otherwise
+std::string toString(double value, const char *format);
+
+}  // namespace Format
+}  // namespace SHI
@@ -8,7 +8,10 @@
 #include <string>
 #include <vector>
 
+#include "SHIArena.h"
 #include "SHIObject.h"
+#include "SHIScheduler.h"
+#include "SHIThreadPool.h"
 
 #define SHI_LOGINFO(message) ::SHI::hw->logInfo(name, __func__, message)
 #define SHI_LOGWARN(message) ::SHI::hw->logWarn(name, __func__, message)
@@ -16,6 +19,9 @@
 
 namespace SHI {
 
+class BufferedPrint;
+class MeasurementBuffer;
+
 extern const uint8_t MAJOR_VERSION;
 extern const uint8_t MINOR_VERSION;
 extern const uint8_t PATCH_VERSION;
@@ -38,6 +44,18 @@ class Hardware : public SHIObject {
   void addSensorGroup(std::shared_ptr<SensorGroup> sensor);
   void addSensor(std::shared_ptr<Sensor> sensor);
   void addCommunicator(std::shared_ptr<Communicator> communicator);
+  /// Detaches a sensor from its group and drops a triggered read of it that
+  /// was not collected yet. Returns false if the sensor is not attached.
+  /// Like adding, this has to happen on the thread that calls loop().
+  bool removeSensor(const Sensor *sensor);
+  /// Detaches a group with all its sensors, the default group stays
+  bool removeSensorGroup(const SensorGroup *sensorGroup);
+  bool removeCommunicator(const Communicator *communicator);
+  /// Polls the print from every loop, so that FLUSH_ON_TIMEOUT output goes
+  /// out without further writes. It has to be removed before it is
+  /// destroyed.
+  void addBufferedPrint(BufferedPrint *print);
+  bool removeBufferedPrint(const BufferedPrint *print);
 
   virtual void setup(const std::string &defaultName) = 0;
   virtual void loop() = 0;
@@ -50,9 +68,46 @@ class Hardware : public SHIObject {
                         std::string message);
 
   void accept(Visitor &visitor) override;
+  std::vector<std::pair<std::string, std::string>> getStatistics() override;
 
   virtual int64_t getEpochInMs() = 0;
 
+  /// Memory for data that only lives during one loop iteration. Everything
+  /// allocated from it is released at once at the end of the loop. It is not
+  /// thread safe, so only use it from the thread that calls loop().
+  Arena &getLoopArena() { return loopArena; }
+
+  /// Limits the time in ms spent on reading sensors in one loop, sensors
+  /// that did not fit are read first in the next loop. 0 means no limit.
+  void setLoopBudget(int budget) { loopBudget = budget; }
+  Scheduler *getScheduler() { return &scheduler; }
+  /// The epoch in ms at which the next sensor is due or a triggered sensor
+  /// can be collected, -1 if there is nothing scheduled. Platforms can use
+  /// this to sleep until the next loop is needed.
+  int64_t getNextEventTime() const;
+  /// Reads due sensors on that many threads, 0 (the default) reads them
+  /// sequentially on the loop thread. Sensors returning the same getBus()
+  /// are read one after the other, as are all sensors without a bus that
+  /// are not Sensor::isIndependent(). The readings are handed to the
+  /// communicators in the same order as when reading sequentially. In this
+  /// mode getEpochInMs() and logging need to be thread safe.
+  void setSamplingThreads(size_t threads);
+
+  /// How long setting up a sensor took, times are in ms since
+  /// setupSensors() started
+  struct SetupRecord {
+    std::string sensor;
+    int64_t start;
+    int64_t duration;
+    bool success;
+    /// Set up on its first read instead of during boot
+    bool lazy;
+  };
+  /// All sensor setups in the order they finished, including lazy ones
+  const std::vector<SetupRecord> &getSetupTimeline() const {
+    return setupTimeline;
+  }
+
   void publishStatus(const SHI::Measurement &status, SHI::SHIObject *src);
   Hardware(const Hardware &) = delete;
   Hardware(Hardware &&) = delete;
@@ -64,12 +119,40 @@ class Hardware : public SHIObject {
   std::shared_ptr<SensorGroup> defaultGroup;
   std::vector<std::shared_ptr<SensorGroup>> sensors;
   std::vector<std::shared_ptr<Communicator>> communicators = {};
+  std::shared_ptr<MeasurementBuffer> readings;
+  Arena loopArena{512};
+  Scheduler scheduler;
+  int loopBudget = 0;
+  struct PendingRead {
+    Sensor *sensor;
+    int64_t readyAt;
+  };
+  /// Triggered two-phase reads, sorted by readyAt
+  std::vector<PendingRead> pendingReads;
+  std::shared_ptr<ThreadPool> pool;
+  std::vector<std::shared_ptr<MeasurementBuffer>> parallelReadings;
+  std::vector<BufferedPrint *> bufferedPrints;
+  std::vector<SetupRecord> setupTimeline;
+  int64_t setupStart = 0;
+  int64_t setupDuration = 0;
 
   explicit Hardware(const std::string &name);
   virtual void log(const std::string &message) = 0;
 
   void internalLoop();
+  void dispatchReadings(const MeasurementBuffer &buffer);
+  void collectReadySensors(int64_t now);
+  void readSensors(ArenaVector<Scheduler::Entry *> *due, int64_t passStart);
+  void readSensorsParallel(ArenaVector<Scheduler::Entry *> *due);
+  bool isPending(const Sensor *sensor) const;
+  /// Drops everything that refers to a sensor that is being removed
+  void forgetSensor(Sensor *sensor);
+  /// Sets up all sensors that are not lazy. When setSamplingThreads() was
+  /// called before, sensors on different buses are set up in parallel and
+  /// the watchdog is fed while waiting for them.
   void setupSensors();
+  void setupSensor(Sensor *sensor, SetupRecord *record);
+  bool setupLazily(Sensor *sensor);
   void setupCommunicators();
 };
 
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <vector>
+
+#include "SHIBus.h"
+
+namespace SHI {
+
+struct I2CBuffer {
+  const uint8_t *data;
+  size_t size;
+};
+
+struct I2CMutableBuffer {
+  uint8_t *data;
+  size_t size;
+};
+
+/// A list of complete I2C operations that is executed back-to-back while
+/// holding the bus once. Write segments are gathered into one transfer and
+/// reads can be scattered into several buffers. The queue keeps its memory
+/// across clear(), so it can be filled again every cycle without
+/// allocating.
+class I2CTransactionQueue {
+ public:
+  typedef std::function<void(I2CError)> Callback;
+
+  void write(uint16_t address, std::initializer_list<I2CBuffer> segments,
+             Callback callback = nullptr);
+  void write(uint16_t address, const uint8_t *data, size_t size,
+             Callback callback = nullptr);
+  void read(uint16_t address, std::initializer_list<I2CMutableBuffer> segments,
+            Callback callback = nullptr);
+  void read(uint16_t address, uint8_t *buffer, size_t size,
+            Callback callback = nullptr);
+  /// Writes data without a stop condition and reads the answer, i.e. to
+  /// read a register
+  void writeRead(uint16_t address, const uint8_t *data, size_t writeSize,
+                 uint8_t *buffer, size_t readSize, Callback callback = nullptr);
+  void readRegister(uint16_t address, uint8_t reg, uint8_t *buffer,
+                    size_t size, Callback callback = nullptr);
+
+  /// Executes all operations within one BusTransaction. The callbacks are
+  /// invoked as each operation finishes, the first error is returned.
+  /// Operations longer than MAX_TRANSFER_SIZE fail with I2C_ERROR_MEMORY.
+  I2CError execute(I2CBus *bus, const SHIObject *device = nullptr);
+  /// How many bytes the index-th operation read during the last execute(),
+  /// less than requested after a short read
+  size_t getReceived(size_t index) const {
+    return operations[index].received;
+  }
+  void clear();
+  size_t size() const { return operations.size(); }
+  static const size_t MAX_TRANSFER_SIZE = 0xFFFF;
+  bool empty() const { return operations.empty(); }
+
+ private:
+  struct Operation {
+    uint16_t address;
+    size_t writeOffset;
+    size_t writeSize;
+    size_t readOffset;
+    size_t readSegmentCount;
+    size_t readSize;
+    size_t received;
+    Callback callback;
+  };
+  void add(uint16_t address, std::initializer_list<I2CBuffer> writes,
+           std::initializer_list<I2CMutableBuffer> reads, Callback callback);
+  I2CError run(I2CBus *bus, Operation *operation);
+
+  std::vector<Operation> operations;
+  std::vector<uint8_t> staging;
+  std::vector<I2CMutableBuffer> readSegments;
+  std::vector<uint8_t> scatter;
+};
+
+}  // namespace SHI
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "SHIBus.h"
+
+namespace SHI {
+
+/// Caches the registers of a device with 8 bit register addresses.
+/// Registers are volatile unless declared otherwise, volatile registers
+/// always go to the bus. Non-volatile registers, i.e. configuration and
+/// calibration data, are read once and served from the cache afterwards.
+/// Writes go to the bus and update the cache. Any bus error invalidates the
+/// whole cache, as the device might have been reset. A short read counts as
+/// an I2C_ERROR_BUS.
+class I2CRegisterCache {
+ public:
+  I2CRegisterCache(I2CBus *bus, uint16_t address,
+                   const SHIObject *device = nullptr)
+      : bus(bus), address(address), device(device) {}
+
+  void declareNonVolatile(uint8_t reg, uint16_t count = 1);
+  void declareVolatile(uint8_t reg, uint16_t count = 1);
+
+  I2CError read(uint8_t reg, uint8_t *buffer, uint8_t size);
+  I2CError write(uint8_t reg, const uint8_t *data, uint8_t size);
+  I2CError readRegister(uint8_t reg, uint8_t *value) {
+    return read(reg, value, 1);
+  }
+  I2CError writeRegister(uint8_t reg, uint8_t value) {
+    return write(reg, &value, 1);
+  }
+  /// Read-modify-write of the bits in mask, the write is skipped if nothing
+  /// changes
+  I2CError update(uint8_t reg, uint8_t mask, uint8_t value);
+
+  void invalidate() { valid.reset(); }
+  void invalidate(uint8_t reg, uint16_t count = 1);
+
+  /// Hits and misses count reads of non-volatile registers only
+  std::vector<std::pair<std::string, std::string>> getStatistics() const;
+
+ private:
+  bool isCached(uint8_t reg, uint8_t size) const;
+  void store(uint8_t reg, const uint8_t *data, uint8_t size);
+  I2CError failed(I2CError error);
+
+  I2CBus *bus;
+  uint16_t address;
+  const SHIObject *device;
+  std::bitset<256> nonVolatile;
+  std::bitset<256> valid;
+  uint8_t values[256];
+  uint32_t hits = 0;
+  uint32_t misses = 0;
+  uint32_t volatileReads = 0;
+  uint32_t writes = 0;
+  uint32_t errors = 0;
+};
+
+}  // namespace SHI
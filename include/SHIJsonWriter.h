@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "ArduinoJson.h"
+
+namespace SHI {
+
+/// Writes JSON directly to a stream while it is produced, nothing is kept
+/// in memory except one flag per open object or array. The caller is
+/// responsible for a well-formed sequence of calls.
+class JsonWriter {
+ public:
+  explicit JsonWriter(std::ostream *out, bool pretty = false)
+      : out(out), pretty(pretty) {}
+
+  void beginObject();
+  void endObject();
+  void beginArray();
+  void endArray();
+  void key(const char *name);
+  void key(const std::string &name) { key(name.c_str()); }
+
+  void value(const char *text);
+  void value(const std::string &text) { value(text.c_str()); }
+  void value(bool flag);
+  void value(double number);
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value &&
+                          !std::is_same<T, bool>::value>::type
+  value(T number) {
+    if (std::is_signed<T>::value)
+      writeSigned(static_cast<int64_t>(number));
+    else
+      writeUnsigned(static_cast<uint64_t>(number));
+  }
+  void null();
+  /// Writes an ArduinoJson value including all its members
+  void variant(JsonVariantConst value);
+
+  /// Number of objects and arrays that are still open
+  size_t getDepth() const { return hasMembers.size(); }
+  bool failed() const { return out->fail(); }
+
+ private:
+  void beginValue();
+  void writeSigned(int64_t number);
+  void writeUnsigned(uint64_t number);
+  void writeString(const char *text);
+  void endContainer(char bracket);
+  void newLine();
+
+  std::ostream *out;
+  bool pretty;
+  bool afterKey = false;
+  std::vector<bool> hasMembers;
+};
+
+}  // namespace SHI
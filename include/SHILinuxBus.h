@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ArduinoJson.h"
+#include "SHIBus.h"
+#include "SHIConfigHolder.h"
+#include "SHIFactory.h"
+
+namespace SHI {
+
+class LinuxSPIBusConfiguration : public Configuration {
+ public:
+  LinuxSPIBusConfiguration() {}
+  explicit LinuxSPIBusConfiguration(const JsonObject &obj);
+  explicit LinuxSPIBusConfiguration(ConfigDecoder &decoder);  // NOLINT
+  void fillData(JsonObject &doc) const override;
+  void writeJson(JsonWriter &writer) const override;  // NOLINT
+  void encode(ConfigEncoder &encoder) const;  // NOLINT
+  std::string device = "/dev/spidev0.0";
+  int speed = 1000000;
+  int mode = 0;
+  int bitsPerWord = 8;
+
+ protected:
+  int getExpectedCapacity() const override;
+};
+
+class LinuxSerialBusConfiguration : public Configuration {
+ public:
+  LinuxSerialBusConfiguration() {}
+  explicit LinuxSerialBusConfiguration(const JsonObject &obj);
+  explicit LinuxSerialBusConfiguration(ConfigDecoder &decoder);  // NOLINT
+  void fillData(JsonObject &doc) const override;
+  void writeJson(JsonWriter &writer) const override;  // NOLINT
+  void encode(ConfigEncoder &encoder) const;  // NOLINT
+  std::string device = "/dev/ttyUSB0";
+  int baudRate = 115200;
+  int dataBits = 8;
+  /// N, E or O
+  std::string parity = "N";
+  int stopBits = 1;
+  /// How long a write waits for the driver to accept more data
+  int writeTimeout = 1000;
+
+ protected:
+  int getExpectedCapacity() const override;
+};
+
+class LinuxI2CBusConfiguration : public Configuration {
+ public:
+  LinuxI2CBusConfiguration() {}
+  explicit LinuxI2CBusConfiguration(const JsonObject &obj);
+  explicit LinuxI2CBusConfiguration(ConfigDecoder &decoder);  // NOLINT
+  void fillData(JsonObject &doc) const override;
+  void writeJson(JsonWriter &writer) const override;  // NOLINT
+  void encode(ConfigEncoder &encoder) const;  // NOLINT
+  std::string device = "/dev/i2c-1";
+
+ protected:
+  int getExpectedCapacity() const override;
+};
+
+#if defined(__linux__)
+
+/// SerialBus on top of a termios device, ptys work as well. The device is
+/// used non-blocking, received data is read in bulk into a local buffer.
+class LinuxSerialBus : public SerialBus {
+ public:
+  explicit LinuxSerialBus(const LinuxSerialBusConfiguration &config)
+      : SerialBus("LinuxSerialBus"), config(config) {}
+  ~LinuxSerialBus();
+
+  void begin(Configuration *newConfig) override;
+  void stop() override;
+  void loop() override {}
+  std::vector<std::pair<int, std::string>> getUsedPins() override {
+    return {};
+  }
+  void accept(Visitor &visitor) override {}
+  const Configuration *getConfig() const override { return config.get(); }
+  std::shared_ptr<const Configuration> getConfigSnapshot() const override {
+    return config.load();
+  }
+  bool reconfigure(Configuration *newConfig) override;
+
+  int available(void) override;
+  int availableForWrite(void) override;
+  int peek(void) override;
+  int read(void) override;
+  size_t read(uint8_t *buffer, size_t size) override;
+  void flush(bool txOnly) override;
+  void flush() override { flush(true); }
+  using Print::write;
+  size_t write(uint8_t data) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+
+  /// Blocks until data can be read or the timeout in ms expired
+  bool waitForData(int timeoutMs);
+
+ private:
+  bool waitFor(uint32_t events, int timeoutMs);
+  size_t fill();
+
+  ConfigHolder<LinuxSerialBusConfiguration> config;
+  int fd = -1;
+  int epollFd = -1;
+  std::vector<uint8_t> rxBuffer = std::vector<uint8_t>(4096);
+  size_t rxHead = 0;
+  size_t rxTail = 0;
+};
+
+/// I2CBus on top of the Linux i2c-dev driver. A write without stop is
+/// combined with the following read into one I2C_RDWR call, so register
+/// reads use a repeated start. A read always ends with a stop, because its
+/// data has to be returned right away, so sendStop = false is not supported
+/// for reads.
+class LinuxI2CBus : public BufferedI2CBus {
+ public:
+  explicit LinuxI2CBus(const LinuxI2CBusConfiguration &config)
+      : BufferedI2CBus("LinuxI2CBus"), config(config) {}
+  ~LinuxI2CBus();
+
+  void begin(Configuration *newConfig) override;
+  void stop() override;
+  void loop() override { processSubmitted(); }
+  std::vector<std::pair<int, std::string>> getUsedPins() override {
+    return {};
+  }
+  void accept(Visitor &visitor) override {}
+  const Configuration *getConfig() const override { return config.get(); }
+  std::shared_ptr<const Configuration> getConfigSnapshot() const override {
+    return config.load();
+  }
+  bool reconfigure(Configuration *newConfig) override;
+
+  uint8_t lastError() override { return static_cast<uint8_t>(error); }
+  char *getErrorText(uint8_t err) override {
+    return getDefaultErrorText(err);
+  }
+
+  I2CError writeTransmission(uint16_t address, uint8_t *buff, uint16_t size,
+                             bool sendStop = true) override;
+  I2CError readTransmission(uint16_t address, uint8_t *buff, uint16_t size,
+                            bool sendStop = true,
+                            uint32_t *readCount = NULL) override;
+  bool busy() override { return false; }
+
+ private:
+  I2CError transfer(uint16_t address, uint8_t *readBuffer, uint16_t readSize);
+
+  ConfigHolder<LinuxI2CBusConfiguration> config;
+  int fd = -1;
+  I2CError error = I2CError::I2C_ERROR_OK;
+  /// A write without stop, it is sent together with the next operation
+  std::vector<uint8_t> pendingWrite;
+  uint16_t pendingAddress = 0;
+  bool hasPendingWrite = false;
+};
+
+/// SPIBus on top of the Linux spidev driver. Transfers submitted with
+/// submitTransfer() are executed by a worker thread, which holds the bus
+/// arbiter for each transfer.
+class LinuxSPIBus : public SPIBus {
+ public:
+  explicit LinuxSPIBus(const LinuxSPIBusConfiguration &config)
+      : SPIBus("LinuxSPIBus"), config(config) {}
+  ~LinuxSPIBus();
+
+  void begin(Configuration *newConfig) override;
+  void stop() override;
+  void loop() override {}
+  std::vector<std::pair<int, std::string>> getUsedPins() override {
+    return {};
+  }
+  void accept(Visitor &visitor) override {}
+  const Configuration *getConfig() const override { return config.get(); }
+  std::shared_ptr<const Configuration> getConfigSnapshot() const override {
+    return config.load();
+  }
+  bool reconfigure(Configuration *newConfig) override;
+
+  void beginTransaction(Configuration *settings) override;
+  void endTransaction(void) override;
+  void transfer(uint8_t *data, uint32_t size) override;
+  uint8_t transfer(uint8_t data) override;
+  uint16_t transfer16(uint16_t data) override;
+  uint32_t transfer32(uint32_t data) override;
+  void transferBytes(const uint8_t *data, uint8_t *out,
+                     uint32_t size) override;
+  void transferBits(uint32_t data, uint32_t *out, uint8_t bits) override;
+  void write(uint8_t data) override;
+  void write16(uint16_t data) override;
+  void write32(uint32_t data) override;
+  void writeBytes(const uint8_t *data, uint32_t size) override;
+  void writePattern(const uint8_t *data, uint8_t size,
+                    uint32_t repeat) override;
+
+  SPITransferHandle submitTransfer(const SPITransfer &transfer,
+                                   std::function<void()> done) override;
+
+ private:
+  struct Job {
+    SPITransfer transfer;
+    std::function<void()> done;
+    std::promise<bool> finished;
+  };
+  /// Transfers with speed, or the configured one if it is 0. Failures are
+  /// described in error, which the worker thread keeps to itself.
+  bool transferRaw(const uint8_t *tx, uint8_t *rx, uint32_t size,
+                   uint32_t speed, std::string *error);
+  /// For the synchronous transfers of the thread holding the bus
+  bool transferRaw(const uint8_t *tx, uint8_t *rx, uint32_t size) {
+    return transferRaw(tx, rx, size, transactionSpeed, &statusMessage);
+  }
+  void runJobs();
+  void stopWorker();
+
+  ConfigHolder<LinuxSPIBusConfiguration> config;
+  /// Set by beginTransaction(), only used by synchronous transfers
+  uint32_t transactionSpeed = 0;
+  int fd = -1;
+  std::mutex mutex;
+  std::condition_variable jobAdded;
+  std::deque<Job> jobs;
+  std::thread worker;
+  bool stopping = false;
+};
+
+#endif  // __linux__
+
+}  // namespace SHI
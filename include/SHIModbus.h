@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "SHIBus.h"
+#include "SHIRingBuffer.h"
+#include "SHISensor.h"
+
+namespace SHI {
+
+enum class ModbusFunction : uint8_t {
+  READ_HOLDING_REGISTERS = 3,
+  READ_INPUT_REGISTERS = 4
+};
+
+enum class ModbusDataType : uint8_t { INT16, UINT16, INT32, UINT32, FLOAT32 };
+
+/// A value of a Modbus slave. 32 bit values occupy two registers, the high
+/// word first unless swapWords is set.
+struct ModbusPoint {
+  uint8_t slave;
+  ModbusFunction function;
+  uint16_t address;
+  ModbusDataType type;
+  float scale;
+  bool swapWords;
+};
+
+uint16_t modbusCRC(const uint8_t *data, size_t size, uint16_t crc = 0xFFFF);
+
+/// Polls the points of any number of slaves on one RS485 bus. Points of the
+/// same slave and function whose registers are close together are read
+/// with a single request of up to 125 registers. process() is a state
+/// machine that sends the next request as soon as the 3.5 character idle
+/// time after the previous response has passed.
+class ModbusRTUMaster {
+ public:
+  ModbusRTUMaster(SerialBus *bus, uint32_t baudRate);
+
+  /// Returns the index of the point, which identifies its value
+  size_t addPoint(const ModbusPoint &point);
+  /// Points this many registers apart are still read with one request
+  void setMaxGap(uint16_t registers) {
+    maxGap = registers;
+    dirty = true;
+  }
+  void setResponseTimeout(uint32_t timeoutMs) { responseTimeoutMs = timeoutMs; }
+
+  /// Starts reading all points, does nothing if a cycle is running
+  void startCycle();
+  /// Advances the state machine, returns true while a cycle is running
+  bool process();
+  /// Processes until the cycle has finished
+  void finishCycle();
+  bool isBusy() const { return state != State::IDLE; }
+  /// The number of completed cycles
+  uint32_t getCycle() const { return completedCycles; }
+  SerialBus *getBus() const { return bus; }
+  /// The expected duration of a cycle in ms
+  int64_t estimateCycleTime();
+
+  MeasurementDataState getState(size_t point) const {
+    return values[point].state;
+  }
+  /// The value multiplied by the scale of the point
+  float getFloatValue(size_t point) const { return values[point].value; }
+  /// The unscaled value
+  int32_t getIntValue(size_t point) const { return values[point].raw; }
+  size_t getRequestCount() {
+    if (dirty) rebuild();
+    return batches.size();
+  }
+  std::vector<std::pair<std::string, std::string>> getStatistics() const;
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+  enum class State { IDLE, WAIT_IDLE, WAIT_RESPONSE };
+  struct Batch {
+    uint8_t slave;
+    ModbusFunction function;
+    uint16_t start;
+    uint16_t count;
+    /// Range in sortedPoints
+    size_t firstPoint;
+    size_t pointCount;
+  };
+  struct Value {
+    float value;
+    int32_t raw;
+    MeasurementDataState state;
+  };
+  class ResponseParser : public FrameParser {
+   public:
+    explicit ResponseParser(RingBuffer *ring);
+    void expect(uint8_t slave, ModbusFunction function);
+
+   protected:
+    size_t headerSize() const override { return 3; }
+    size_t frameLength(const FrameView &header) override;
+    bool isValid(const FrameView &frame) override;
+
+   private:
+    uint8_t function = 0;
+  };
+
+  static uint16_t registerCount(ModbusDataType type);
+  void rebuild();
+  void send(const Batch &batch);
+  void decode(const Batch &batch, const FrameView &frame);
+  void fail(const Batch &batch);
+  void nextBatch(Clock::time_point now);
+
+  SerialBus *bus;
+  std::chrono::microseconds interFrameDelay;
+  std::chrono::microseconds characterTime;
+  uint32_t responseTimeoutMs = 100;
+  uint16_t maxGap = 0;
+  bool dirty = true;
+  std::vector<ModbusPoint> points;
+  std::vector<size_t> sortedPoints;
+  std::vector<Batch> batches;
+  std::vector<Value> values;
+  RingBuffer ring{256};
+  ResponseParser parser{&ring};
+  State state = State::IDLE;
+  size_t currentBatch = 0;
+  Clock::time_point lastActivity;
+  Clock::time_point sentAt;
+  uint32_t completedCycles = 0;
+  uint32_t requests = 0;
+  uint32_t timeouts = 0;
+  uint32_t exceptions = 0;
+};
+
+/// A sensor that reports a set of points of a ModbusRTUMaster. Several
+/// sensors can share a master, a cycle then serves all of them. A sensor
+/// only starts a new cycle if no cycle finished since its last read.
+class ModbusSensor : public Sensor {
+ public:
+  ModbusSensor(const std::string &name,
+               std::shared_ptr<ModbusRTUMaster> master)
+      : Sensor(name), master(master) {}
+  void addPoint(const ModbusPoint &point,
+                std::shared_ptr<MeasurementMetaData> meta);
+
+  std::vector<MeasurementBundle> readSensor() override {
+    return readIntoBundles();
+  }
+  void readSensorInto(MeasurementBuffer &buffer) override;  // NOLINT
+  int64_t triggerSensor() override;
+  void collectSensor(MeasurementBuffer &buffer) override;  // NOLINT
+  bool setupSensor() override { return true; }
+  bool stopSensor() override { return true; }
+  Bus *getBus() override { return master->getBus(); }
+  const Configuration *getConfig() const override { return nullptr; }
+  bool reconfigure(Configuration *newConfig) override { return false; }
+  std::vector<std::pair<std::string, std::string>> getStatistics() override {
+    return master->getStatistics();
+  }
+
+ private:
+  void addReadings(MeasurementBuffer &buffer);  // NOLINT
+  void startCycleIfStale();
+  std::shared_ptr<ModbusRTUMaster> master;
+  std::vector<size_t> pointIds;
+  /// The cycle of the master at the last read
+  uint32_t readCycle = 0;
+};
+
+}  // namespace SHI
@@ -7,6 +7,7 @@
 
 #include <memory>
 #include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -39,13 +40,40 @@ class SHIObject {
   virtual std::string getQualifiedName(
       const std::string &seperator = ".") const;
   virtual Measurement getStatus();
+  /// The name the object was registered under in the Factory, empty for
+  /// objects that were constructed directly
+  const std::string &getClassName() const { return className; }
+  void setClassName(const std::string &newClassName) {
+    className = newClassName;
+  }
+  /// The snapshot of getConfigSnapshot() as the configuration class
   template <typename T>
-  constexpr const T getConfigAs() const {
+  std::shared_ptr<const T> getConfigAs() const {
     static_assert(std::is_base_of<Configuration, T>::value,
                   "Type needs to derive of Config");
-    return *static_cast<const T *>(getConfig());
+    return std::static_pointer_cast<const T>(getConfigSnapshot());
   }
+  /// The configuration for the thread that calls loop() and the sensor
+  /// reads it waits for, which is also where reconfigure() is called. It
+  /// can change or go away when the object is reconfigured.
   virtual const Configuration *getConfig() const = 0;
+  /// The configuration for readers on other threads, it does not change
+  /// while it is held. Objects with a ConfigHolder, like SensorGroup and the
+  /// Linux buses, return its snapshot. Others return what was published
+  /// with publishConfig(), Factory does so for sensors and communicators it
+  /// reconfigures and for classes registered with
+  /// registerConfiguredFactory(). Without either, this only aliases
+  /// getConfig().
+  virtual std::shared_ptr<const Configuration> getConfigSnapshot() const {
+    auto published = std::atomic_load(&publishedConfig);
+    if (published != nullptr) return published;
+    return std::shared_ptr<const Configuration>(
+        std::shared_ptr<const Configuration>(), getConfig());
+  }
+  /// Hands out config to getConfigSnapshot(), nothing may change it anymore
+  void publishConfig(std::shared_ptr<const Configuration> config) {
+    std::atomic_store(&publishedConfig, std::move(config));
+  }
   virtual bool reconfigure(Configuration *newConfig) = 0;
 
  protected:
@@ -57,6 +85,8 @@ class SHIObject {
   }
   SHIObject *parent = nullptr;
   std::string name;
+  std::string className;
+  std::shared_ptr<const Configuration> publishedConfig;
   std::string statusMessage = STATUS_OK;
   bool fatalError = false;
   std::shared_ptr<MeasurementMetaData> status;
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "SHIBus.h"
+
+namespace SHI {
+
+/// Up to two contiguous pieces of a RingBuffer, the second one is used when
+/// the data wraps around the end of the storage
+struct FrameView {
+  const uint8_t *first;
+  size_t firstSize;
+  const uint8_t *second;
+  size_t secondSize;
+
+  size_t size() const { return firstSize + secondSize; }
+  uint8_t operator[](size_t index) const {
+    return index < firstSize ? first[index] : second[index - firstSize];
+  }
+  void copy(size_t offset, uint8_t *out, size_t count) const;
+};
+
+/// A byte queue with a power of two capacity. Data can be written and read
+/// in place, so bulk reads from a bus don't need an intermediate buffer.
+class RingBuffer {
+ public:
+  static const size_t npos = static_cast<size_t>(-1);
+  /// The capacity is rounded up to the next power of two
+  explicit RingBuffer(size_t capacity);
+
+  size_t size() const { return tail - head; }
+  size_t space() const { return storage.size() - size(); }
+  size_t capacity() const { return storage.size(); }
+  bool empty() const { return head == tail; }
+
+  size_t write(const uint8_t *data, size_t count);
+  /// The contiguous free space at the end, fill it and call commit()
+  uint8_t *writePointer(size_t *contiguous);
+  void commit(size_t count) { tail += count; }
+  /// Reads everything the bus has available, in at most two reads
+  size_t fill(SerialBus *bus);
+
+  uint8_t at(size_t offset) const { return storage[(head + offset) & mask]; }
+  FrameView view(size_t offset, size_t count) const;
+  /// The offset of the first occurrence of value at or after from
+  size_t find(uint8_t value, size_t from = 0) const;
+  void consume(size_t count);
+  void clear() { head = tail = 0; }
+
+ private:
+  std::vector<uint8_t> storage;
+  size_t mask;
+  size_t head = 0;
+  size_t tail = 0;
+};
+
+/// Finds frames that start with sync bytes in a RingBuffer. Subclasses
+/// tell the length of a frame from its header and validate it, i.e. with
+/// a checksum. Garbage between frames and invalid frames are skipped.
+/// Frames are returned in place:
+///   ring.fill(bus);
+///   FrameView frame;
+///   while (parser.next(&frame)) {
+///     decode(frame);
+///     parser.release();
+///   }
+class FrameParser {
+ public:
+  FrameParser(RingBuffer *ring, const uint8_t *sync, size_t syncSize)
+      : ring(ring), sync(sync, sync + syncSize) {}
+  virtual ~FrameParser() = default;
+  /// Returns false if no complete frame is available yet
+  bool next(FrameView *frame);
+  /// Removes the frame returned by next() from the ring buffer
+  void release();
+  void setSync(const uint8_t *newSync, size_t syncSize) {
+    sync.assign(newSync, newSync + syncSize);
+  }
+
+  uint32_t getFrames() const { return frames; }
+  uint32_t getInvalidFrames() const { return invalidFrames; }
+  std::vector<std::pair<std::string, std::string>> getStatistics() const;
+
+ protected:
+  /// The number of bytes, including the sync bytes, that frameLength()
+  /// needs to see
+  virtual size_t headerSize() const { return sync.size(); }
+  /// The total length of the frame, 0 if the header is invalid
+  virtual size_t frameLength(const FrameView &header) = 0;
+  virtual bool isValid(const FrameView &frame) { return true; }
+
+ private:
+  void skip(size_t count);
+
+  RingBuffer *ring;
+  std::vector<uint8_t> sync;
+  size_t pending = 0;
+  uint32_t frames = 0;
+  uint32_t invalidFrames = 0;
+  uint32_t skippedBytes = 0;
+};
+
+/// Frames of a fixed length. An SDS011 for example sends 10 byte frames
+/// starting with 0xAA 0xC0, a subclass only needs to check the checksum.
+class FixedLengthFrameParser : public FrameParser {
+ public:
+  FixedLengthFrameParser(RingBuffer *ring, const uint8_t *sync,
+                         size_t syncSize, size_t length)
+      : FrameParser(ring, sync, syncSize), length(length) {}
+
+ protected:
+  size_t frameLength(const FrameView &header) override { return length; }
+
+ private:
+  size_t length;
+};
+
+}  // namespace SHI
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace SHI {
+
+class Sensor;
+class SensorGroup;
+
+/// Earliest deadline first scheduling of sensor reads. Every sensor is due
+/// once its sampling interval (or the one of its SensorGroup) has passed.
+/// Sensors with the same deadline are served round robin, and sensors that
+/// did not fit into a pass keep their (now older) deadline, so they are
+/// first in line on the next pass.
+class Scheduler {
+ public:
+  struct Entry {
+    Sensor *sensor;
+    SensorGroup *group;
+    int64_t deadline;
+    uint64_t sequence;
+    uint32_t runs;
+    uint32_t overruns;
+    int64_t totalJitter;
+    int64_t maxJitter;
+    int64_t lastDuration;
+    int64_t maxDuration;
+  };
+
+  /// Starts a new pass at now, the entries are re-created when the sensors
+  /// of groups changed, also when they were changed on a group directly
+  void beginPass(const std::vector<std::shared_ptr<SensorGroup>> &groups,
+                 int64_t now);
+  /// Returns the due entry with the earliest deadline, or nullptr if no
+  /// entry is due anymore in this pass. Every entry returned needs to be
+  /// handed back with complete().
+  Entry *nextDue();
+  void complete(Entry *entry, int64_t start, int64_t end);
+  /// Reschedules an entry that was due but could not be read, i.e. because
+  /// its previous read has not finished yet. This is counted as an overrun.
+  void skip(Entry *entry, int64_t now);
+  /// Puts an entry back without changing its deadline
+  void postpone(Entry *entry);
+  /// Forces the entries to be re-created on the next pass
+  void invalidate() { dirty = true; }
+
+  /// The earliest deadline of all entries or -1 if there are none
+  int64_t getNextDeadline() const;
+  const Entry *find(const Sensor *sensor) const;
+  static int getInterval(const Entry &entry);
+  std::vector<std::pair<std::string, std::string>> getStatistics() const;
+  std::vector<std::pair<std::string, std::string>> getStatistics(
+      const Sensor *sensor) const;
+
+ private:
+  /// Whether the entries are for exactly the sensors of groups
+  bool matches(const std::vector<std::shared_ptr<SensorGroup>> &groups) const;
+  void rebuild(const std::vector<std::shared_ptr<SensorGroup>> &groups,
+               int64_t now);
+  void reschedule(Entry *entry, int interval, int64_t start);
+  bool isBefore(size_t a, size_t b) const;
+  void pushHeap(size_t index);
+  void makeHeap();
+
+  std::vector<Entry> entries;
+  std::vector<size_t> heap;
+  int64_t passStart = 0;
+  uint64_t sequence = 0;
+  bool dirty = true;
+};
+
+}  // namespace SHI
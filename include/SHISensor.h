@@ -9,11 +9,15 @@
 #include <functional>
 #include <memory>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "ArduinoJson.h"
+#include "SHIConfigHolder.h"
 #include "SHIEventBus.h"
 #include "SHIFactory.h"
+#include "SHIFormat.h"
 #include "SHIHardware.h"
 
 // SHI stands for SmartHomeIntegration
@@ -22,20 +26,30 @@ namespace SHI {
 extern const std::string STATUS_ITEM;
 extern const std::string STATUS_OK;
 
-enum class SensorDataType { INT, FLOAT, STRING, STATUS };
+enum class SensorDataType : uint8_t { INT, FLOAT, STRING, STATUS };
 
-enum class MeasurementDataState { VALID, NO_DATA, ERROR };
+enum class MeasurementDataState : uint8_t { VALID, NO_DATA, ERROR };
 
 class MeasurementMetaData;
+class Bus;
+
+const char *const DEFAULT_FLOAT_REPRESENTATION = "%0.1f";
 
 class Measurement {
  public:
   Measurement(float value, MeasurementMetaData *metaData,
-              const char *floatRepresentation = "%0.1f")
+              const char *floatRepresentation = DEFAULT_FLOAT_REPRESENTATION)
       : stringRepresentation(toString(value, floatRepresentation)),
         metaData(metaData),
         floatValue(value),
         state(MeasurementDataState::VALID) {}
+  /// A float that was already formatted
+  Measurement(float value, const std::string &representation,
+              MeasurementMetaData *metaData)
+      : stringRepresentation(representation),
+        metaData(metaData),
+        floatValue(value),
+        state(MeasurementDataState::VALID) {}
   Measurement(int value, MeasurementMetaData *metaData)
       : stringRepresentation(toString(value)),
         metaData(metaData),
@@ -72,26 +86,28 @@ class Measurement {
   const MeasurementDataState state;
 
  private:
-  static std::string toString(int value) {
-    char buf[2 + 8 * sizeof(int)];
-    snprintf(buf, sizeof(buf), "%d", value);
-    return std::string(buf);
-  }
+  static std::string toString(int value) { return Format::toString(value); }
   static std::string toString(float value, const char *floatRepresentation) {
-    char buf[33];
-    snprintf(buf, sizeof(buf), floatRepresentation, value);
-    return std::string(buf);
+    return Format::toString(value, floatRepresentation);
   }
 };
 
 class MeasurementMetaData : public SHIObject {
  public:
+  static const uint32_t INVALID_ID = 0xFFFFFFFF;
   MeasurementMetaData(const std::string &name, const std::string &unit,
-                      SensorDataType type)
-      : SHIObject(name, false), unit(unit), type(type) {}
+                      SensorDataType type);
+  ~MeasurementMetaData();
   const std::string unit;
   SensorDataType type;
   void accept(Visitor &visitor) override;
+  /// An id that can be used to refer to this meta data from a
+  /// CompactMeasurement. The lower 16 bits are a dense slot that is re-used
+  /// once the meta data is destroyed, the upper 16 bits count the re-uses
+  /// of the slot.
+  uint32_t getId() const { return id; }
+  /// Returns nullptr if the meta data was destroyed
+  static MeasurementMetaData *getById(uint32_t id);
 
   Measurement measuredFloat(float value);
   Measurement measuredInt(int value);
@@ -102,26 +118,171 @@ class MeasurementMetaData : public SHIObject {
   bool reconfigure(Configuration *newConfig) override { return false; }
   EventBus::SubscriberBuilder getSubscriberBuilder();
   EventBus::EventBuilder getEventBuilder();
+
+ private:
+  uint32_t id = INVALID_ID;
+};
+
+union MeasurementValue {
+  float floatValue;
+  int32_t intValue;
 };
 
+/// A trivially copyable measurement record. String values are not stored in
+/// the record itself, instead intValue is the index into the string pool of
+/// the ColumnarMeasurementBundle that holds it.
+struct CompactMeasurement {
+  uint32_t metaDataId;
+  MeasurementDataState state;
+  SensorDataType type;
+  MeasurementValue value;
+};
+
+static_assert(sizeof(CompactMeasurement) <= 16,
+              "CompactMeasurement should fit into 16 bytes");
+static_assert(std::is_trivially_copyable<CompactMeasurement>::value,
+              "CompactMeasurement needs to be trivially copyable");
+
 class MeasurementBundle {
  public:
+  MeasurementBundle() : src(nullptr) {}
   MeasurementBundle(std::initializer_list<Measurement> data, SHIObject *src)
       : timeStamp(hw->getEpochInMs()), data(data), src(src) {}
   MeasurementBundle(std::vector<Measurement> &data, SHIObject *src)
       : timeStamp(hw->getEpochInMs()), data(data), src(src) {}
+  MeasurementBundle(std::vector<Measurement> &&data, SHIObject *src)
+      : timeStamp(hw->getEpochInMs()), data(std::move(data)), src(src) {}
   uint64_t timeStamp = 0;
   std::vector<Measurement> data = {};
   SHIObject *src;
 };
 
+/// A structure-of-arrays variant of the MeasurementBundle. Each measurement
+/// is spread over the ids, values, types and states columns. Calling reset()
+/// keeps the capacity of all columns and the string pool, so a bundle can be
+/// re-used without allocating once it has grown to its working size.
+class ColumnarMeasurementBundle {
+ public:
+  explicit ColumnarMeasurementBundle(SHIObject *src = nullptr) : src(src) {}
+  void reset(SHIObject *newSrc, uint64_t newTimeStamp);
+  void reserve(size_t size);
+
+  void add(const MeasurementMetaData *metaData, float value);
+  void add(const MeasurementMetaData *metaData, int value);
+  void add(const MeasurementMetaData *metaData, const std::string &value,
+           bool error = false);
+  void add(const Measurement &measurement);
+  /// Only valid for non string measurements, as the string pool index of
+  /// the record can not be translated
+  void add(const CompactMeasurement &measurement);
+  void addNoData(const MeasurementMetaData *metaData);
+  void addError(const MeasurementMetaData *metaData);
+
+  size_t size() const { return ids.size(); }
+  bool empty() const { return ids.empty(); }
+  CompactMeasurement at(size_t index) const;
+  /// Empty for records without a string, like those of addError()
+  const std::string &getString(size_t index) const;
+  Measurement toMeasurement(size_t index) const;
+  MeasurementBundle toBundle() const;
+  /// Like toBundle(), but re-uses the measurements of bundle
+  void toBundle(MeasurementBundle *bundle) const;
+
+  const std::vector<uint32_t> &getIds() const { return ids; }
+  const std::vector<MeasurementValue> &getValues() const { return values; }
+  const std::vector<SensorDataType> &getTypes() const { return types; }
+  const std::vector<MeasurementDataState> &getStates() const {
+    return states;
+  }
+
+  uint64_t timeStamp = 0;
+  SHIObject *src;
+
+ private:
+  void addRecord(const MeasurementMetaData *metaData, SensorDataType type,
+                 MeasurementDataState state, MeasurementValue value);
+  int32_t addString(const std::string &value);
+  std::vector<uint32_t> ids;
+  std::vector<MeasurementValue> values;
+  std::vector<SensorDataType> types;
+  std::vector<MeasurementDataState> states;
+  std::vector<std::string> strings;
+  /// Record and string index of floats not formatted with the default,
+  /// sorted by record
+  std::vector<std::pair<uint32_t, int32_t>> representations;
+  size_t usedStrings = 0;
+};
+
+/// A caller owned sink for sensor readings. Bundles handed out by
+/// nextBundle() are kept when the buffer is cleared, so once the buffer has
+/// grown to its working size, reading into it does not allocate anymore.
+class MeasurementBuffer {
+ public:
+  /// Returns an empty bundle for src, the reference stays valid until the
+  /// buffer is destroyed
+  ColumnarMeasurementBundle &nextBundle(SHIObject *src);
+  void addBundle(MeasurementBundle &&bundle);
+  void addBundles(std::vector<MeasurementBundle> &&bundles);
+  void clear();
+  bool empty() const { return usedBundles == 0 && legacyBundles.empty(); }
+  size_t size() const { return usedBundles; }
+  const ColumnarMeasurementBundle &operator[](size_t index) const {
+    return *bundles[index];
+  }
+  const std::vector<MeasurementBundle> &getLegacyBundles() const {
+    return legacyBundles;
+  }
+  /// How many columnar bundles were added before the legacy bundle, for
+  /// handing all bundles on in the order they were added
+  size_t getLegacyPosition(size_t index) const {
+    return legacyPositions[index];
+  }
+
+ private:
+  std::vector<std::unique_ptr<ColumnarMeasurementBundle>> bundles;
+  size_t usedBundles = 0;
+  std::vector<MeasurementBundle> legacyBundles;
+  std::vector<size_t> legacyPositions;
+};
+
 class Sensor : public SHIObject {
  public:
   virtual std::vector<MeasurementBundle> readSensor() = 0;
+  /// Write the readings into a buffer owned by the caller. Sensors that
+  /// implement this can be read without allocating memory, the default
+  /// calls readSensor().
+  virtual void readSensorInto(MeasurementBuffer &buffer);  // NOLINT
+  /// Optional two-phase read: start a conversion and return the epoch in ms
+  /// at which collectSensor() can fetch the result. The default of -1 means
+  /// that the sensor does not support it and is read with readSensorInto().
+  virtual int64_t triggerSensor() { return -1; }
+  virtual void collectSensor(MeasurementBuffer &buffer) {}  // NOLINT
   virtual bool setupSensor() = 0;
   virtual bool stopSensor() = 0;
   void accept(Visitor &visitor) override;
   virtual std::vector<std::shared_ptr<MeasurementMetaData>> *getMetaData();
+  /// The time in ms between two reads of this sensor, -1 means that the
+  /// interval of the SensorGroup is used
+  int getSamplingInterval() const { return samplingInterval; }
+  void setSamplingInterval(int interval) { samplingInterval = interval; }
+  /// The bus this sensor is attached to. Sensors on the same bus are never
+  /// read concurrently.
+  virtual Bus *getBus() { return nullptr; }
+  /// Whether a sensor without a bus can be read concurrently with all other
+  /// sensors. Sensors that return false here and nullptr from getBus() could
+  /// share a bus nobody knows about, so they are read one after the other.
+  virtual bool isIndependent() { return false; }
+  /// Calls setupSensor() unless that succeeded before, returns whether the
+  /// sensor is set up
+  bool runSetup() {
+    if (!setUp) setUp = setupSensor();
+    return setUp;
+  }
+  bool isSetUp() const { return setUp; }
+  /// A lazy sensor is not set up during boot, but right before its first
+  /// scheduled read
+  void setLazySetup(bool lazy) { lazySetup = lazy; }
+  bool isLazySetup() const { return lazySetup; }
   Sensor(const Sensor &) = delete;
   Sensor(Sensor &&) = delete;
   Sensor &operator=(const Sensor &) = delete;
@@ -130,18 +291,30 @@ class Sensor : public SHIObject {
 
  protected:
   explicit Sensor(const std::string &name) : SHIObject(name) {}
+  /// For readSensor() of sensors that implement readSensorInto(), it must
+  /// not be used otherwise
+  std::vector<MeasurementBundle> readIntoBundles();
   void addMetaData(std::shared_ptr<MeasurementMetaData> meta);
   std::vector<std::shared_ptr<MeasurementMetaData>> metaData;
+  int samplingInterval = -1;
+  bool lazySetup = false;
+  bool setUp = false;
 };
 
 class Configuration;
 
 class SensorGroupConfiguration : public Configuration {
  public:
+  SensorGroupConfiguration() {}
   explicit SensorGroupConfiguration(const JsonObject &obj);
+  explicit SensorGroupConfiguration(ConfigDecoder &decoder);  // NOLINT
   explicit SensorGroupConfiguration(const std::string &name) : name(name) {}
   void fillData(JsonObject &doc) const override;
+  void writeJson(JsonWriter &writer) const override;  // NOLINT
+  void encode(ConfigEncoder &encoder) const;  // NOLINT
   std::string name = "default";
+  /// The time in ms between two reads of the sensors in this group
+  int interval = 0;
 
  protected:
   int getExpectedCapacity() const override;
@@ -151,6 +324,8 @@ class SensorGroup : public SHIObject {
  public:
   explicit SensorGroup(const std::string &name)
       : SHIObject(name, false), config(SensorGroupConfiguration(name)) {}
+  explicit SensorGroup(const SensorGroupConfiguration &config)
+      : SHIObject(config.name, false), config(config) {}
   SensorGroup(const std::string &name,
               std::initializer_list<std::shared_ptr<Sensor>> sensors)
       : SHIObject(name), config(SensorGroupConfiguration(name)) {
@@ -160,13 +335,18 @@ class SensorGroup : public SHIObject {
   }
   void accept(Visitor &visitor) override;
   void addSensor(std::shared_ptr<Sensor> sensor);
+  /// Returns false if the sensor is not part of this group
+  bool removeSensor(const Sensor *sensor);
   std::vector<std::shared_ptr<Sensor>> *getSensors() { return &sensors; }
-  const Configuration *getConfig() const override { return &config; }
+  const Configuration *getConfig() const override { return config.get(); }
+  std::shared_ptr<const Configuration> getConfigSnapshot() const override {
+    return config.load();
+  }
   bool reconfigure(Configuration *newConfig) override {
-    config = castConfig<SensorGroupConfiguration>(newConfig);
+    config.store(castConfig<SensorGroupConfiguration>(newConfig));
     return true;
   }
-  SensorGroupConfiguration config;
+  ConfigHolder<SensorGroupConfiguration> config;
 
  private:
   std::vector<std::shared_ptr<Sensor>> sensors;
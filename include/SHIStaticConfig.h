@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+#include "SHIArena.h"
+
+namespace SHI {
+
+class Hardware;
+
+/// Defined by the file that prepareStaticConfig.py generates from a JSON
+/// configuration. Builds the configured objects on the first call without
+/// parsing JSON or going through the Factory, later calls return the same
+/// hardware.
+Hardware *staticHardware();
+
+/// Places an object and its shared_ptr control block in the arena
+template <typename T, typename... Args>
+std::shared_ptr<T> makeStaticShared(Arena *arena, Args &&... args) {
+  return std::allocate_shared<T>(ArenaAllocator<T>(arena),
+                                 std::forward<Args>(args)...);
+}
+
+/// Places an object in the arena, it is never destroyed
+template <typename T, typename... Args>
+T *makeStaticObject(Arena *arena, Args &&... args) {
+  return new (arena->allocate(sizeof(T), alignof(T)))
+      T(std::forward<Args>(args)...);
+}
+
+/// Enough arena space for one makeStaticShared<T>() including the control
+/// block and alignment
+template <typename T>
+constexpr size_t staticSize() {
+  return sizeof(T) + 4 * sizeof(void *) + 2 * alignof(std::max_align_t);
+}
+
+}  // namespace SHI
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace SHI {
+
+/// A fixed size pool of threads with one task queue per thread. Tasks are
+/// distributed round robin, a thread that runs out of work steals from the
+/// queues of the others.
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t threadCount);
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ~ThreadPool();
+
+  void submit(std::function<void()> task);
+  /// Blocks until all submitted tasks are finished
+  void wait();
+  /// Like wait(), but gives up after timeoutMs, returns true when all tasks
+  /// are finished
+  bool waitFor(int timeoutMs);
+  size_t getThreadCount() const { return threads.size(); }
+  std::vector<std::pair<std::string, std::string>> getStatistics() const;
+
+ private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+  void run(size_t index);
+  bool takeTask(size_t index, std::function<void()> *task);
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  std::condition_variable finished;
+  std::atomic<size_t> queued{0};
+  size_t unfinished = 0;
+  size_t nextWorker = 0;
+  bool stopping = false;
+  std::atomic<uint32_t> executed{0};
+  std::atomic<uint32_t> steals{0};
+};
+
+}  // namespace SHI
@@ -27,17 +27,30 @@ namespace {{
 {qfn}::{name}(const JsonObject &obj){initializer}
   {{}}
 
+{qfn}::{name}(ConfigDecoder &decoder){decodeInitializer}
+  {{}}
+
 void {qfn}::fillData(JsonObject &doc) const {{
   {filler}
 }}
 
+void {qfn}::writeJson(JsonWriter &writer) const {{
+  {writer}
+}}
+
+void {qfn}::encode(ConfigEncoder &encoder) const {{
+  {encoder}
+}}
+
 int {qfn}::getExpectedCapacity() const {{
-  return JSON_OBJECT_SIZE({len});
+  return {capacity};
 }}
 '''
 
+BASIC_TYPES = ["bool", "int", "std::string", "float", "double"]
+
 
-def generateCodeForProperty(p: CppVariable, initializer: list, toString: list, arrayFunctions: list):
+def generateCodeForProperty(p: CppVariable, code: dict):
     if p['constant'] == 1:
         print("You can't have a const in the Configuration class!")
         exit(1)
@@ -46,36 +59,69 @@ def generateCodeForProperty(p: CppVariable, initializer: list, toString: list, a
         map['default'] = " | "+p["default"]
     print("   Code for %s" % (p["name"]))
     if p["type"].startswith("std::vector"):
-        arrayFunctions.append('''
+        map['stringCapacity'] = ""
+        if p["type"] == "std::vector<std::string>":
+            map['stringCapacity'] = '''
+    for (auto &&var : arrVar) {
+        capacity += JSON_STRING_SIZE(var.size() + 1);
+    }'''
+        code['arrayFunctions'].append('''
 {type} {name}FromArray(JsonArray array) {{
     {type} result;
-    for (JsonVariant &&elem : array) {{
-        result.push_back(elem);
+    result.reserve(array.size());
+    for (JsonVariant elem : array) {{
+        result.push_back(elem.as<{type}::value_type>());
     }}
     return result;
 }}
 
-JsonArray {name}ToArray({type} arrVar) {{
-    JsonArray result;
+void {name}ToArray(const {type} &arrVar, JsonArray array) {{
     for (auto &&var : arrVar) {{
-        result.add(var);
+        array.add(var);
     }}
-    return result;
+}}
+
+size_t {name}Capacity(const {type} &arrVar) {{
+    size_t capacity = JSON_ARRAY_SIZE(arrVar.size());{stringCapacity}
+    return capacity;
 }}
         '''.format_map(map))
-        initializer.append(
+        code['initializer'].append(
             "      {name}({name}FromArray(obj[\"{name}\"].as<JsonArray>()))".format_map(map))
-    elif (not p["type"] in ["bool", "int", "std::string", "float", "double"]):
-        initializer.append(
+        code['decodeInitializer'].append(
+            "      {name}(decoder.readVector<{type}::value_type>())".format_map(map))
+        code['filler'].append(
+            "  {name}ToArray({name}, doc.createNestedArray(\"{name}\"));".format_map(map))
+        code['writer'].append('''  writer.key("{name}");
+  writer.beginArray();
+  for (auto &&var : {name}) writer.value(var);
+  writer.endArray();'''.format_map(map))
+        code['encoder'].append("  encoder.write({name});".format_map(map))
+        code['capacity'].append("{name}Capacity({name})".format_map(map))
+    elif (not p["type"] in BASIC_TYPES):
+        code['initializer'].append(
             "      {name}(static_cast<{type}>(obj[\"{name}\"].as<int>(){default}))".format_map(map))
+        code['decodeInitializer'].append(
+            "      {name}(static_cast<{type}>(decoder.read<int>()))".format_map(map))
+        code['filler'].append(
+            "  doc[\"{name}\"] = static_cast<int>({name});".format_map(map))
+        code['writer'].append('''  writer.key("{name}");
+  writer.value(static_cast<int>({name}));'''.format_map(map))
+        code['encoder'].append(
+            "  encoder.write(static_cast<int>({name}));".format_map(map))
     else:
-        initializer.append(
+        code['initializer'].append(
             "      {name}(obj[\"{name}\"]{default})".format_map(map))
-    if p["type"].startswith("std::vector"):
-        toString.append(
-            "  doc[\"{name}\"] = {name}ToArray({name});".format_map(map))
-    else:
-        toString.append("  doc[\"{name}\"] = {name};".format_map(map))
+        code['decodeInitializer'].append(
+            "      {name}(decoder.read<{type}>())".format_map(map))
+        code['filler'].append("  doc[\"{name}\"] = {name};".format_map(map))
+        code['writer'].append('''  writer.key("{name}");
+  writer.value({name});'''.format_map(map))
+        code['encoder'].append("  encoder.write({name});".format_map(map))
+        if p["type"] == "std::string":
+            # fillData() copies strings into the document
+            code['capacity'].append(
+                "JSON_STRING_SIZE({name}.size() + 1)".format_map(map))
 
 
 def parseHeader(headerFullPath: str):
@@ -88,9 +134,9 @@ def parseHeader(headerFullPath: str):
         return
     sensorSpecifics = []
     for name, clazz in cppHeader.classes.items():
-        initializer = []
-        toString = []
-        arrayInitFunctions = []
+        code = {'initializer': [], 'decodeInitializer': [], 'filler': [],
+                'writer': [], 'encoder': [], 'capacity': [],
+                'arrayFunctions': []}
         nameSpacePrefix = ""
         if clazz["namespace"]:
             nameSpacePrefix = clazz["namespace"]+"::"
@@ -110,17 +156,21 @@ def parseHeader(headerFullPath: str):
             if (access == "public"):
                 for p in prop:
                     print("  %s" % p)
-                    generateCodeForProperty(
-                        p, initializer, toString, arrayInitFunctions)
+                    generateCodeForProperty(p, code)
             else:
                 print("  Skipping non public members")
-        map['len'] = len(initializer)
-        map['arrayInitFunctions'] = "".join(arrayInitFunctions)
-        if len(initializer) > 0:
-            map['initializer'] = ":\n"+(",\n".join(initializer))
-        else:
-            map['initializer'] = ""
-        map['filler'] = "\n".join(toString)
+        members = len(code['initializer'])
+        map['arrayInitFunctions'] = "".join(code['arrayFunctions'])
+        for key in ['initializer', 'decodeInitializer']:
+            if members > 0:
+                map[key] = ":\n"+(",\n".join(code[key]))
+            else:
+                map[key] = ""
+        map['filler'] = "\n".join(code['filler'])
+        map['writer'] = "\n".join(code['writer'])
+        map['encoder'] = "\n".join(code['encoder'])
+        map['capacity'] = " + ".join(
+            ["JSON_OBJECT_SIZE({})".format(members)]+code['capacity'])
         sensorSpecifics.append(sensorSpecific.format_map(map))
 
     if len(sensorSpecifics) > 0:
@@ -136,6 +186,7 @@ def parseHeader(headerFullPath: str):
 
 basePath = "/Users/karstenbecker/PlatformIO/Projects/"
 parseHeader(basePath+"SHIT/include/SHISensor.h")
+parseHeader(basePath+"SHIT/include/SHILinuxBus.h")
 parseHeader(basePath+"SHIESP32HW/include/SHIESP32HW.h")
 parseHeader(basePath+"SHIMulticast/include/SHIMulticastHandler.h")
 parseHeader(basePath+"SHIMQTT/include/SHIMQTT.h")
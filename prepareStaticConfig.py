@@ -0,0 +1,197 @@
+import sys
+import datetime
+import json
+
+# Turns a JSON configuration into C++ that builds the same objects as
+# SHI::Factory::construct() without parsing JSON and without the factories.
+#
+# Usage: prepareStaticConfig.py config.json classes.json output.cpp
+#
+# classes.json maps every class name used in the configuration to its C++
+# class, the header declaring it and its configuration class, for example:
+#   {"hw": {"class": "SHI::ESP32HW", "header": "SHIESP32HW.h",
+#           "config": "SHI::ESP32HWConfig"},
+#    "BME280": {"class": "SHI::BME280", "header": "SHIBME280.h",
+#               "config": "SHI::BME280Config"}}
+# The object is constructed with its configuration, or without arguments
+# if config is null. The members of the configuration are set from the JSON
+# keys of the same name, so an unknown key fails to compile. Integers are
+# cast to the type of the member, which also allows enum members.
+
+fileStart = '''/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+// WARNING, this is an automatically generated file!
+// Don't change anything in here.
+// Generated from {source} by prepareStaticConfig.py
+// Last update {date}
+
+# include <cstddef>
+# include <cstdint>
+
+# include "SHIArena.h"
+# include "SHIHardware.h"
+# include "SHISensor.h"
+# include "SHIStaticConfig.h"
+{includes}
+
+namespace {{
+
+// All objects and their shared_ptr control blocks
+const size_t ARENA_SIZE = {arenaSize};
+alignas(std::max_align_t) uint8_t arenaBuffer[ARENA_SIZE];
+
+SHI::Hardware *build() {{
+  static SHI::Arena arena(arenaBuffer, sizeof(arenaBuffer));
+{body}
+  return hardware;
+}}
+
+}}  // namespace
+
+SHI::Hardware *SHI::staticHardware() {{
+  static SHI::Hardware *hardware = build();
+  return hardware;
+}}
+'''
+
+BUILTIN_CLASSES = {
+    "sensorGroup": {"class": "SHI::SensorGroup", "header": "SHISensor.h",
+                    "config": "SHI::SensorGroupConfiguration"}
+}
+
+# Keys the default factories handle themselves
+FACTORY_KEYS = ["$sensors", "$groups", "$comms", "$interval", "$lazySetup"]
+
+
+def fail(message: str):
+    print(message, file=sys.stderr)
+    exit(1)
+
+
+# target is the C++ type of the member, integers are cast to it so that
+# enum members compile like they do in prepareConfigImpl.py
+def cppValue(value, key: str, target: str):
+    if isinstance(value, bool):
+        return "true" if value else "false"
+    if isinstance(value, int):
+        literal = str(value)
+        if value > 2**31-1 or value < -2**31:
+            literal += "LL"
+        return "static_cast<{}>({})".format(target, literal)
+    if isinstance(value, float):
+        return repr(value)
+    if isinstance(value, str):
+        return json.dumps(value)
+    if isinstance(value, list):
+        element = "{}::value_type".format(target)
+        return "{"+", ".join([cppValue(v, key, element) for v in value])+"}"
+    fail("Unsupported value for {}: {}".format(key, value))
+
+
+class Generator:
+    def __init__(self, classes: dict):
+        self.classes = dict(BUILTIN_CLASSES)
+        self.classes.update(classes)
+        self.lines = []
+        # The generated file includes these already
+        self.headers = ["SHIHardware.h", "SHISensor.h"]
+        self.sizes = []
+        self.count = 0
+
+    def lookup(self, className: str):
+        if className not in self.classes:
+            fail("No entry for class {} in the class map".format(className))
+        entry = self.classes[className]
+        if entry["header"] not in self.headers:
+            self.headers.append(entry["header"])
+        self.sizes.append("SHI::staticSize<{}>()".format(entry["class"]))
+        return entry
+
+    def construct(self, className: str, obj: dict, variable: str, shared=True):
+        entry = self.lookup(className)
+        arguments = ""
+        if entry.get("config"):
+            config = "config{}".format(self.count)
+            self.lines.append("  {} {};".format(entry["config"], config))
+            for key, value in obj.items():
+                if key in FACTORY_KEYS or value is None:
+                    continue
+                if key.startswith("$"):
+                    print("Ignoring {} of {}".format(key, className))
+                    continue
+                member = "{}.{}".format(config, key)
+                target = "decltype({})".format(member)
+                self.lines.append("  {} = {};".format(
+                    member, cppValue(value, key, target)))
+            arguments = ", "+config
+        self.count += 1
+        make = "makeStaticShared" if shared else "makeStaticObject"
+        self.lines.append("  auto {} = SHI::{}<{}>(&arena{});".format(
+            variable, make, entry["class"], arguments))
+        if className != "hw":
+            self.lines.append("  {}->setClassName({});".format(
+                variable, json.dumps(className)))
+
+    def children(self, obj: dict, key: str):
+        for child in obj.get(key, []):
+            for className, arguments in child.items():
+                yield className, arguments
+
+    def sensor(self, className: str, obj: dict):
+        variable = "sensor{}".format(self.count)
+        self.construct(className, obj, variable)
+        if "$interval" in obj:
+            self.lines.append("  {}->setSamplingInterval({});".format(
+                variable, obj["$interval"]))
+        if obj.get("$lazySetup"):
+            self.lines.append("  {}->setLazySetup(true);".format(variable))
+        return variable
+
+    def generate(self, config: dict):
+        if "hw" not in config or not isinstance(config["hw"], dict):
+            fail("The configuration has no hw object")
+        hwObj = config["hw"]
+        self.construct("hw", hwObj, "hardware", shared=False)
+        self.lines.append("  SHI::hw = hardware;")
+        # The same order as Factory::defaultHardwareFactory()
+        for className, obj in self.children(hwObj, "$sensors"):
+            sensor = self.sensor(className, obj)
+            self.lines.append("  hardware->addSensor({});".format(sensor))
+        for className, obj in self.children(hwObj, "$groups"):
+            group = "group{}".format(self.count)
+            self.construct(className, obj, group)
+            for sensorClass, sensorObj in self.children(obj, "$sensors"):
+                sensor = self.sensor(sensorClass, sensorObj)
+                self.lines.append("  {}->addSensor({});".format(group, sensor))
+            self.lines.append("  hardware->addSensorGroup({});".format(group))
+        for className, obj in self.children(hwObj, "$comms"):
+            comm = "comm{}".format(self.count)
+            self.construct(className, obj, comm)
+            self.lines.append("  hardware->addCommunicator({});".format(comm))
+
+
+def main():
+    if len(sys.argv) != 4:
+        fail("Usage: {} config.json classes.json output.cpp".format(
+            sys.argv[0]))
+    with open(sys.argv[1]) as f:
+        config = json.load(f)
+    with open(sys.argv[2]) as f:
+        classes = json.load(f)
+    generator = Generator(classes)
+    generator.generate(config)
+    map = {'source': sys.argv[1], 'date': "{}".format(datetime.date.today()),
+           'includes': "\n".join(['# include "{}"'.format(h)
+                                  for h in generator.headers[2:]]),
+           'arenaSize': " +\n    ".join(generator.sizes),
+           'body': "\n".join(generator.lines)}
+    with open(sys.argv[3], 'w') as cpp:
+        print(fileStart.format_map(map), file=cpp, end="")
+    print("Writing output to {}".format(sys.argv[3]))
+
+
+main()
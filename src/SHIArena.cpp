@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include "SHIArena.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+using SHI::Arena;
+
+Arena::Arena(void *buffer, size_t size) : blockSize(size) {
+  blocks.push_back({static_cast<uint8_t *>(buffer), size, false});
+  capacity = size;
+}
+
+Arena::~Arena() {
+  for (auto &&block : blocks) {
+    if (block.owned) delete[] block.data;
+  }
+}
+
+void *Arena::allocate(size_t size, size_t alignment) {
+  while (currentBlock < blocks.size()) {
+    auto &block = blocks[currentBlock];
+    auto address = reinterpret_cast<uintptr_t>(block.data) + offset;
+    size_t padding = (alignment - (address % alignment)) % alignment;
+    if (offset + padding + size <= block.size) {
+      offset += padding + size;
+      used += padding + size;
+      if (used > highWaterMark) highWaterMark = used;
+      return block.data + offset - size;
+    }
+    // The rest of this block is wasted, account for it so that the high
+    // water mark reflects the memory that is really needed
+    used += block.size - offset;
+    currentBlock++;
+    offset = 0;
+  }
+  size_t newSize = size + alignment;
+  if (newSize < blockSize) newSize = blockSize;
+  blocks.push_back({new uint8_t[newSize], newSize, true});
+  capacity += newSize;
+  blockAllocations++;
+  currentBlock = blocks.size() - 1;
+  return allocate(size, alignment);
+}
+
+void Arena::reset() {
+  currentBlock = 0;
+  offset = 0;
+  used = 0;
+}
+
+std::vector<std::pair<std::string, std::string>> Arena::getStatistics()
+    const {
+  return {{"arenaUsed", std::to_string(used)},
+          {"arenaCapacity", std::to_string(capacity)},
+          {"arenaHighWaterMark", std::to_string(highWaterMark)},
+          {"arenaBlockAllocations", std::to_string(blockAllocations)}};
+}
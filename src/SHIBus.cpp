@@ -6,7 +6,10 @@
 
 #include "SHIBus.h"
 
+#include <chrono>
 #include <cstdarg>
+#include <cstring>
+#include <vector>
 
 int SHI::Print::getWriteError() { return writeError; }
 void SHI::Print::clearWriteError() { writeError = 0; }
@@ -33,7 +36,7 @@ size_t SHI::Print::printf(const char* format, ...) {
   va_end(args);
   // The written includes the terminating null (because of +1)
   if (written <= sizeof(buf)) {
-    write(buf, written);
+    write(buf, written - 1);
   } else {
     std::unique_ptr<char[]> newBuf(new char[written]);
     if (newBuf) {
@@ -41,7 +44,7 @@ size_t SHI::Print::printf(const char* format, ...) {
       va_start(newArgs, format);
       vsnprintf(newBuf.get(), written, format, newArgs);
       va_end(newArgs);
-      write(newBuf.get(), written);
+      write(newBuf.get(), written - 1);
     } else {
       return -1;
     }
@@ -50,49 +53,27 @@ size_t SHI::Print::printf(const char* format, ...) {
   return written - 1;
 }
 size_t SHI::Print::printSigned(int64_t value, int base) {
-  if (value < 0) {
-    return print('-') + printUnsigned(-value, base);
-  }
-  return printUnsigned(value, base);
+  if (value >= 0) return printUnsigned(value, base);
+  char result[Format::MAX_INTEGER_LENGTH];
+  result[0] = '-';
+  // Negate in unsigned to handle the smallest value
+  uint64_t magnitude = 0 - static_cast<uint64_t>(value);
+  return write(result, 1 + Format::formatBase(magnitude, base, result + 1));
 }
 
-std::string toString(int value) {
-  char result[20 + 1];
-  result[20] = 0;
-  size_t pos = 20;
-  do {
-    int current = value;
-    value /= 10;
-    char number = current - 10 * value;
-    result[--pos] = number + '0';
-  } while (value != 0);
-  return std::string(&result[pos], 20 - pos);
-}
 size_t SHI::Print::printUnsigned(uint64_t value, int base) {
-  if (base <= 1) base = 10;
-  uint8_t result[20 + 1];
-  result[20] = 0;
-  size_t pos = 20;
-  do {
-    uint64_t current = value;
-    value /= base;
-    char number = current - base * value;
-    if (number < 10)
-      result[--pos] = number + '0';
-    else
-      result[--pos] = (number - 10) + 'A';
-  } while (value != 0);
-  return write(&result[pos], static_cast<size_t>(20 - pos));
+  char result[Format::MAX_INTEGER_LENGTH];
+  return write(result, Format::formatBase(value, base, result));
 }
 
 size_t SHI::Print::print(const char value[]) { return write(value); }
 size_t SHI::Print::print(char value) { return write(value); }
 
 size_t SHI::Print::print(double value, int precision) {
-  if (precision == 2)  // This is the default, so be smarter here
-    return printf("%0.2f", value);
-  std::string format = std::string("%0.") + toString(precision) + "f";
-  return printf(format.c_str(), value);
+  char result[Format::MAX_FIXED_LENGTH];
+  size_t length = Format::formatFixed(value, precision, result);
+  if (length > 0) return write(result, length);
+  return printf("%0.*f", precision, value);
 }
 
 size_t SHI::Print::print(struct tm* timeinfo, const char* format) {
@@ -112,7 +93,209 @@ size_t SHI::Print::println(const char value[]) {
 }
 
 size_t SHI::Print::println(char value) { return print(value) + println(); }
+size_t SHI::Print::println(double value, int precision) {
+  return print(value, precision) + println();
+}
 size_t SHI::Print::println(void) { return print('\n'); }
 size_t SHI::Print::println(struct tm* timeinfo, const char* format) {
   return print(timeinfo, format) + println();
 }
+
+namespace {
+
+int64_t steadyMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+size_t SHI::BufferedPrint::write(uint8_t data) {
+  if (used == capacity && !flushBuffer()) {
+    setWriteError();
+    return 0;
+  }
+  buffer[used++] = data;
+  appended(buffer + used - 1, 1);
+  return 1;
+}
+
+size_t SHI::BufferedPrint::write(const uint8_t* data, size_t size) {
+  if (used + size > capacity) {
+    if (!flushBuffer()) {
+      setWriteError();
+      return 0;
+    }
+    // Too large to be combined with anything, hand it through unbuffered
+    if (size >= capacity) {
+      auto written = target->write(data, size);
+      if (written < size) setWriteError();
+      return written;
+    }
+  }
+  memcpy(buffer + used, data, size);
+  used += size;
+  appended(buffer + used - size, size);
+  return size;
+}
+
+void SHI::BufferedPrint::appended(const uint8_t* data, size_t size) {
+  if (used == size && (policy & FLUSH_ON_TIMEOUT)) firstPendingMs = steadyMs();
+  if ((policy & FLUSH_ON_NEWLINE) && memchr(data, '\n', size) != nullptr) {
+    flushBuffer();
+  } else if (used == capacity) {
+    flushBuffer();
+  } else {
+    poll();
+  }
+}
+
+void SHI::BufferedPrint::flush() {
+  flushBuffer();
+  target->flush();
+}
+
+bool SHI::BufferedPrint::flushBuffer() {
+  if (used == 0) return true;
+  consume(target->write(buffer, used));
+  if (used == 0) return true;
+  setWriteError();
+  return false;
+}
+
+bool SHI::BufferedPrint::poll() {
+  if (!(policy & FLUSH_ON_TIMEOUT) || used == 0) return false;
+  if (steadyMs() - firstPendingMs < timeoutMs) return false;
+  return flushBuffer();
+}
+
+void SHI::BufferedPrint::consume(size_t count) {
+  if (count >= used) {
+    used = 0;
+    return;
+  }
+  memmove(buffer, buffer + count, used - count);
+  used -= count;
+}
+
+uint8_t* SHI::BufferedPrint::reserve(size_t count) {
+  if (used + count > capacity && !flushBuffer()) return nullptr;
+  if (used + count > capacity) return nullptr;
+  return buffer + used;
+}
+
+void SHI::BufferedPrint::commit(size_t count) {
+  used += count;
+  appended(buffer + used - count, count);
+}
+
+bool SHI::SPITransferHandle::isDone() const { return waitFor(0); }
+
+void SHI::SPITransferHandle::wait() const {
+  if (future.valid()) future.wait();
+}
+
+bool SHI::SPITransferHandle::succeeded() const {
+  return !future.valid() || future.get();
+}
+
+bool SHI::SPITransferHandle::waitFor(int timeoutMs) const {
+  if (!future.valid()) return true;
+  return future.wait_for(std::chrono::milliseconds(timeoutMs)) ==
+         std::future_status::ready;
+}
+
+SHI::SPITransferHandle SHI::SPIBus::submitTransfer(
+    const SPITransfer& transfer, std::function<void()> done) {
+  if (transfer.settings != nullptr) beginTransaction(transfer.settings);
+  if (transfer.tx != nullptr && transfer.rx != nullptr) {
+    transferBytes(transfer.tx, transfer.rx, transfer.size);
+  } else if (transfer.tx != nullptr) {
+    writeBytes(transfer.tx, transfer.size);
+  } else {
+    std::vector<uint8_t> zeros(transfer.size, 0);
+    this->transfer(zeros.data(), transfer.size);
+    if (transfer.rx != nullptr)
+      memcpy(transfer.rx, zeros.data(), transfer.size);
+  }
+  if (transfer.settings != nullptr) endTransaction();
+  if (done) done();
+  std::promise<bool> finished;
+  finished.set_value(true);
+  return SPITransferHandle(finished.get_future().share());
+}
+
+SHI::SPIDoubleBuffer::SPIDoubleBuffer(size_t size) {
+  for (int i = 0; i < 2; i++) {
+    tx[i].resize(size);
+    rx[i].resize(size);
+  }
+}
+
+SHI::SPITransferHandle SHI::SPIDoubleBuffer::submit(SPIBus* bus,
+                                                    uint32_t size,
+                                                    Configuration* settings) {
+  inFlight.wait();
+  if (size > getSize()) size = getSize();
+  inFlight = bus->submitTransfer(
+      {tx[current].data(), rx[current].data(), size, settings});
+  current = 1 - current;
+  return inFlight;
+}
+
+void SHI::BufferedI2CBus::beginTransmission(uint16_t address) {
+  txAddress = address;
+  txBuffer.clear();
+}
+
+uint8_t SHI::BufferedI2CBus::endTransmission(bool sendStop) {
+  return static_cast<uint8_t>(
+      writeTransmission(txAddress, txBuffer.data(), txBuffer.size(), sendStop));
+}
+
+uint8_t SHI::BufferedI2CBus::requestFrom(uint16_t address, uint8_t size,
+                                         bool sendStop) {
+  rxBuffer.resize(size);
+  rxPos = 0;
+  uint32_t count = 0;
+  readTransmission(address, rxBuffer.data(), size, sendStop, &count);
+  rxBuffer.resize(count);
+  return count;
+}
+
+size_t SHI::BufferedI2CBus::write(uint8_t data) {
+  txBuffer.push_back(data);
+  return 1;
+}
+
+size_t SHI::BufferedI2CBus::write(const uint8_t* data, size_t size) {
+  txBuffer.insert(txBuffer.end(), data, data + size);
+  return size;
+}
+
+int SHI::BufferedI2CBus::available(void) { return rxBuffer.size() - rxPos; }
+
+int SHI::BufferedI2CBus::read(void) {
+  if (rxPos >= rxBuffer.size()) return -1;
+  return rxBuffer[rxPos++];
+}
+
+int SHI::BufferedI2CBus::peek(void) {
+  if (rxPos >= rxBuffer.size()) return -1;
+  return rxBuffer[rxPos];
+}
+
+void SHI::BufferedI2CBus::flush(void) {
+  txBuffer.clear();
+  rxBuffer.clear();
+  rxPos = 0;
+}
+
+char* SHI::BufferedI2CBus::getDefaultErrorText(uint8_t err) {
+  static char texts[][16] = {"OK",     "DEV",      "ACK",      "TIMEOUT",
+                             "BUS",    "BUSY",     "MEMORY",   "CONTINUE",
+                             "NO_BEGIN", "UNKNOWN"};
+  const uint8_t count = sizeof(texts) / sizeof(texts[0]);
+  return texts[err < count ? err : count - 1];
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include "SHIBusArbiter.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "SHIBus.h"
+
+using SHI::BusArbiter;
+using SHI::BusTransaction;
+
+bool BusArbiter::isNext(uint64_t ticket) const {
+  const Waiter *best = nullptr;
+  for (auto &&waiter : waiting) {
+    if (best == nullptr || waiter.priority > best->priority ||
+        (waiter.priority == best->priority && waiter.ticket < best->ticket))
+      best = &waiter;
+  }
+  return best != nullptr && best->ticket == ticket;
+}
+
+void BusArbiter::acquire(const SHIObject *device, int priority) {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (busy && ownerThread == std::this_thread::get_id()) {
+    depth++;
+    return;
+  }
+  auto start = Clock::now();
+  bool contended = busy || !waiting.empty();
+  auto ticket = nextTicket++;
+  waiting.push_back({priority, ticket});
+  released.wait(lock, [this, ticket] { return !busy && isNext(ticket); });
+  for (auto it = waiting.begin(); it != waiting.end(); ++it) {
+    if (it->ticket == ticket) {
+      waiting.erase(it);
+      break;
+    }
+  }
+  busy = true;
+  depth = 1;
+  owner = device;
+  ownerThread = std::this_thread::get_id();
+  acquiredAt = Clock::now();
+  uint64_t waitUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                        acquiredAt - start)
+                        .count();
+  countTransaction(device, waitUs, contended);
+}
+
+void BusArbiter::handOver(const SHIObject *device) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!busy || ownerThread != std::this_thread::get_id() || owner == device)
+    return;
+  auto now = Clock::now();
+  chargeHold(now);
+  owner = device;
+  acquiredAt = now;
+  countTransaction(device, 0, false);
+}
+
+void BusArbiter::countTransaction(const SHIObject *device, uint64_t waitUs,
+                                  bool contended) {
+  auto &stats = statistics[device];
+  if (stats.transactions == 0)
+    stats.name = device != nullptr ? device->getName() : "unknown";
+  stats.transactions++;
+  if (contended) stats.contended++;
+  stats.totalWaitUs += waitUs;
+  if (waitUs > stats.maxWaitUs) stats.maxWaitUs = waitUs;
+}
+
+void BusArbiter::chargeHold(Clock::time_point now) {
+  uint64_t holdUs =
+      std::chrono::duration_cast<std::chrono::microseconds>(now - acquiredAt)
+          .count();
+  auto it = statistics.find(owner);
+  if (it == statistics.end()) return;
+  auto &stats = it->second;
+  stats.totalHoldUs += holdUs;
+  if (holdUs > stats.maxHoldUs) stats.maxHoldUs = holdUs;
+}
+
+void BusArbiter::release() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!busy || --depth > 0) return;
+    chargeHold(Clock::now());
+    busy = false;
+    owner = nullptr;
+    ownerThread = std::thread::id();
+  }
+  released.notify_all();
+}
+
+bool BusArbiter::isBusy() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return busy;
+}
+
+void BusArbiter::unregisterDevice(const SHIObject *device) {
+  std::lock_guard<std::mutex> lock(mutex);
+  statistics.erase(device);
+}
+
+std::vector<std::pair<std::string, std::string>> BusArbiter::getStatistics() {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<std::pair<std::string, std::string>> result;
+  for (auto &&kv : statistics) {
+    auto &stats = kv.second;
+    auto &name = stats.name;
+    auto count = stats.transactions == 0 ? 1 : stats.transactions;
+    result.push_back({name + ".transactions",
+                      std::to_string(stats.transactions)});
+    result.push_back({name + ".contended", std::to_string(stats.contended)});
+    result.push_back(
+        {name + ".avgWaitUs", std::to_string(stats.totalWaitUs / count)});
+    result.push_back({name + ".maxWaitUs", std::to_string(stats.maxWaitUs)});
+    result.push_back(
+        {name + ".avgHoldUs", std::to_string(stats.totalHoldUs / count)});
+    result.push_back({name + ".maxHoldUs", std::to_string(stats.maxHoldUs)});
+  }
+  return result;
+}
+
+BusTransaction::BusTransaction(Bus *bus, const SHIObject *device,
+                               int priority)
+    : arbiter(bus->getArbiter()) {
+  arbiter->acquire(device, priority);
+}
+
+BusTransaction::~BusTransaction() { arbiter->release(); }
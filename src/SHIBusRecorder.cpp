@@ -0,0 +1,498 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include "SHIBusRecorder.h"
+
+#include <string.h>
+
+#include <iterator>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using SHI::BusTrace;
+using SHI::I2CError;
+using SHI::RecordingI2CBus;
+using SHI::RecordingSerialBus;
+using SHI::RecordingSPIBus;
+using SHI::ReplayI2CBus;
+using SHI::ReplaySerialBus;
+using SHI::ReplaySPIBus;
+using SHI::TraceClock;
+using SHI::TraceReplayer;
+using Operation = SHI::BusTrace::Operation;
+
+namespace {
+
+const char TRACE_MAGIC[4] = {'S', 'H', 'B', 'T'};
+const uint8_t TRACE_VERSION = 1;
+
+uint32_t zigZag(int32_t value) {
+  return (static_cast<uint32_t>(value) << 1) ^
+         static_cast<uint32_t>(value >> 31);
+}
+
+int32_t unZigZag(uint32_t value) {
+  return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+void toBigEndian(uint32_t value, uint8_t *out, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    out[i] = value >> (8 * (bytes - 1 - i));
+  }
+}
+
+uint32_t fromBigEndian(const uint8_t *data, uint32_t size) {
+  uint32_t result = 0;
+  for (uint32_t i = 0; i < size; i++) {
+    result = result << 8 | data[i];
+  }
+  return result;
+}
+
+BusTrace::Record makeRecord(Operation operation, uint32_t delayUs,
+                            uint32_t durationUs, uint32_t argument,
+                            int32_t result, const uint8_t *tx, uint32_t txSize,
+                            const uint8_t *rx, uint32_t rxSize) {
+  BusTrace::Record record = {operation, delayUs, durationUs,
+                             argument,  result,  tx,
+                             txSize,    rx,      rxSize};
+  return record;
+}
+
+}  // namespace
+
+void BusTrace::writeVarint(uint32_t value) {
+  while (value >= 0x80) {
+    data.push_back(static_cast<uint8_t>(value) | 0x80);
+    value >>= 7;
+  }
+  data.push_back(static_cast<uint8_t>(value));
+}
+
+void BusTrace::add(const Record &record) {
+  data.push_back(static_cast<uint8_t>(record.operation));
+  writeVarint(record.delayUs);
+  writeVarint(record.durationUs);
+  writeVarint(record.argument);
+  writeVarint(zigZag(record.result));
+  writeVarint(record.txSize);
+  if (record.txSize > 0)
+    data.insert(data.end(), record.tx, record.tx + record.txSize);
+  writeVarint(record.rxSize);
+  if (record.rxSize > 0)
+    data.insert(data.end(), record.rx, record.rx + record.rxSize);
+  records++;
+}
+
+bool BusTrace::save(std::ostream &out) const {
+  out.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  out.put(TRACE_VERSION);
+  out.write(reinterpret_cast<const char *>(data.data()), data.size());
+  return out.good();
+}
+
+bool BusTrace::load(std::istream &in) {
+  char magic[sizeof(TRACE_MAGIC)];
+  if (!in.read(magic, sizeof(magic)) ||
+      memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 ||
+      in.get() != TRACE_VERSION) {
+    return false;
+  }
+  data.assign(std::istreambuf_iterator<char>(in),
+              std::istreambuf_iterator<char>());
+  records = 0;
+  Record record;
+  auto traceReader = reader();
+  while (traceReader.next(&record)) records++;
+  if (traceReader.atEnd()) return true;
+  clear();
+  return false;
+}
+
+bool BusTrace::Reader::readVarint(uint32_t *value) {
+  *value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (position >= trace->data.size()) return false;
+    uint8_t byte = trace->data[position++];
+    *value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+bool BusTrace::Reader::next(Record *record) {
+  auto &data = trace->data;
+  if (position >= data.size()) return false;
+  size_t start = position;
+  record->operation = static_cast<Operation>(data[position++]);
+  uint32_t result;
+  if (!readVarint(&record->delayUs) || !readVarint(&record->durationUs) ||
+      !readVarint(&record->argument) || !readVarint(&result) ||
+      !readVarint(&record->txSize) ||
+      data.size() - position < record->txSize) {
+    position = start;
+    return false;
+  }
+  record->result = unZigZag(result);
+  record->tx = data.data() + position;
+  position += record->txSize;
+  if (!readVarint(&record->rxSize) || data.size() - position < record->rxSize) {
+    position = start;
+    return false;
+  }
+  record->rx = data.data() + position;
+  position += record->rxSize;
+  return true;
+}
+
+uint32_t TraceClock::start() {
+  started = std::chrono::steady_clock::now();
+  auto delay = started - last;
+  last = started;
+  return std::chrono::duration_cast<std::chrono::microseconds>(delay).count();
+}
+
+uint32_t TraceClock::stop() const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - started)
+      .count();
+}
+
+bool TraceReplayer::next(Operation operation, uint32_t argument,
+                         const uint8_t *tx, uint32_t txSize,
+                         BusTrace::Record *record) {
+  auto position = reader.getPosition();
+  if (!reader.next(record)) {
+    mismatches++;
+    return false;
+  }
+  if (record->operation != operation) {
+    mismatches++;
+    reader.seek(position);
+    return false;
+  }
+  if (record->argument != argument || record->txSize != txSize ||
+      (txSize > 0 && memcmp(record->tx, tx, txSize) != 0)) {
+    mismatches++;
+  }
+  replayed++;
+  if (latency == ReplayLatency::RECORDED && record->durationUs > 0) {
+    std::this_thread::sleep_for(std::chrono::microseconds(record->durationUs));
+  }
+  return true;
+}
+
+std::vector<std::pair<std::string, std::string>> TraceReplayer::getStatistics()
+    const {
+  return {{"replayed", std::to_string(replayed)},
+          {"replayMismatches", std::to_string(mismatches)}};
+}
+
+I2CError RecordingI2CBus::writeTransmission(uint16_t address, uint8_t *buff,
+                                            uint16_t size, bool sendStop) {
+  auto delay = clock.start();
+  auto result = bus->writeTransmission(address, buff, size, sendStop);
+  trace->add(makeRecord(Operation::I2C_WRITE, delay, clock.stop(), address,
+                        static_cast<int32_t>(result), buff, size, nullptr, 0));
+  return result;
+}
+
+I2CError RecordingI2CBus::readTransmission(uint16_t address, uint8_t *buff,
+                                           uint16_t size, bool sendStop,
+                                           uint32_t *readCount) {
+  auto delay = clock.start();
+  uint32_t count = 0;
+  auto result = bus->readTransmission(address, buff, size, sendStop, &count);
+  if (result != I2CError::I2C_ERROR_OK) count = 0;
+  trace->add(makeRecord(Operation::I2C_READ, delay, clock.stop(), address,
+                        static_cast<int32_t>(result), nullptr, 0, buff, count));
+  if (readCount != nullptr) *readCount = count;
+  return result;
+}
+
+I2CError ReplayI2CBus::writeTransmission(uint16_t address, uint8_t *buff,
+                                         uint16_t size, bool sendStop) {
+  BusTrace::Record record;
+  if (!replayer.next(Operation::I2C_WRITE, address, buff, size, &record))
+    return error = I2CError::I2C_ERROR_BUS;
+  return error = static_cast<I2CError>(record.result);
+}
+
+I2CError ReplayI2CBus::readTransmission(uint16_t address, uint8_t *buff,
+                                        uint16_t size, bool sendStop,
+                                        uint32_t *readCount) {
+  BusTrace::Record record;
+  uint32_t count = 0;
+  if (!replayer.next(Operation::I2C_READ, address, nullptr, 0, &record)) {
+    error = I2CError::I2C_ERROR_BUS;
+  } else {
+    count = record.rxSize < size ? record.rxSize : size;
+    memcpy(buff, record.rx, count);
+    error = static_cast<I2CError>(record.result);
+  }
+  if (readCount != nullptr) *readCount = count;
+  return error;
+}
+
+std::vector<std::pair<std::string, std::string>>
+ReplayI2CBus::getStatistics() {
+  return replayer.getStatistics();
+}
+
+void RecordingSPIBus::transfer(uint8_t *data, uint32_t size) {
+  txCopy.assign(data, data + size);
+  auto delay = clock.start();
+  bus->transfer(data, size);
+  auto duration = clock.stop();
+  trace->add(makeRecord(Operation::SPI_TRANSFER, delay, duration, 0, 0,
+                        txCopy.data(), size, data, size));
+}
+
+uint8_t RecordingSPIBus::transfer(uint8_t data) {
+  uint8_t buffer = data;
+  transfer(&buffer, 1);
+  return buffer;
+}
+
+uint16_t RecordingSPIBus::transfer16(uint16_t data) {
+  uint8_t buffer[2];
+  toBigEndian(data, buffer, sizeof(buffer));
+  transfer(buffer, sizeof(buffer));
+  return fromBigEndian(buffer, sizeof(buffer));
+}
+
+uint32_t RecordingSPIBus::transfer32(uint32_t data) {
+  uint8_t buffer[4];
+  toBigEndian(data, buffer, sizeof(buffer));
+  transfer(buffer, sizeof(buffer));
+  return fromBigEndian(buffer, sizeof(buffer));
+}
+
+void RecordingSPIBus::transferBytes(const uint8_t *data, uint8_t *out,
+                                    uint32_t size) {
+  auto delay = clock.start();
+  bus->transferBytes(data, out, size);
+  auto duration = clock.stop();
+  trace->add(makeRecord(Operation::SPI_TRANSFER, delay, duration, 0, 0, data,
+                        data != nullptr ? size : 0, out,
+                        out != nullptr ? size : 0));
+}
+
+void RecordingSPIBus::transferBits(uint32_t data, uint32_t *out,
+                                   uint8_t bits) {
+  uint32_t received = 0;
+  auto delay = clock.start();
+  bus->transferBits(data, &received, bits);
+  auto duration = clock.stop();
+  uint8_t tx[4];
+  uint8_t rx[4];
+  toBigEndian(data, tx, sizeof(tx));
+  toBigEndian(received, rx, sizeof(rx));
+  trace->add(makeRecord(Operation::SPI_TRANSFER_BITS, delay, duration, bits, 0,
+                        tx, sizeof(tx), rx, sizeof(rx)));
+  if (out != nullptr) *out = received;
+}
+
+void RecordingSPIBus::write(uint8_t data) { writeBytes(&data, 1); }
+
+void RecordingSPIBus::write16(uint16_t data) {
+  uint8_t buffer[2];
+  toBigEndian(data, buffer, sizeof(buffer));
+  writeBytes(buffer, sizeof(buffer));
+}
+
+void RecordingSPIBus::write32(uint32_t data) {
+  uint8_t buffer[4];
+  toBigEndian(data, buffer, sizeof(buffer));
+  writeBytes(buffer, sizeof(buffer));
+}
+
+void RecordingSPIBus::writeBytes(const uint8_t *data, uint32_t size) {
+  auto delay = clock.start();
+  bus->writeBytes(data, size);
+  trace->add(makeRecord(Operation::SPI_WRITE, delay, clock.stop(), 0, 0, data,
+                        size, nullptr, 0));
+}
+
+void RecordingSPIBus::writePattern(const uint8_t *data, uint8_t size,
+                                   uint32_t repeat) {
+  auto delay = clock.start();
+  bus->writePattern(data, size, repeat);
+  trace->add(makeRecord(Operation::SPI_WRITE_PATTERN, delay, clock.stop(),
+                        repeat, 0, data, size, nullptr, 0));
+}
+
+void ReplaySPIBus::replay(Operation operation, uint32_t argument,
+                          const uint8_t *tx, uint8_t *rx, uint32_t size) {
+  BusTrace::Record record;
+  bool found = replayer.next(operation, argument, tx,
+                             tx != nullptr ? size : 0, &record);
+  if (rx == nullptr) return;
+  uint32_t count = 0;
+  if (found) {
+    count = record.rxSize < size ? record.rxSize : size;
+    memcpy(rx, record.rx, count);
+  }
+  memset(rx + count, 0, size - count);
+}
+
+void ReplaySPIBus::transfer(uint8_t *data, uint32_t size) {
+  txCopy.assign(data, data + size);
+  replay(Operation::SPI_TRANSFER, 0, txCopy.data(), data, size);
+}
+
+uint8_t ReplaySPIBus::transfer(uint8_t data) {
+  uint8_t result = 0;
+  replay(Operation::SPI_TRANSFER, 0, &data, &result, 1);
+  return result;
+}
+
+uint16_t ReplaySPIBus::transfer16(uint16_t data) {
+  uint8_t tx[2];
+  uint8_t rx[2];
+  toBigEndian(data, tx, sizeof(tx));
+  replay(Operation::SPI_TRANSFER, 0, tx, rx, sizeof(rx));
+  return fromBigEndian(rx, sizeof(rx));
+}
+
+uint32_t ReplaySPIBus::transfer32(uint32_t data) {
+  uint8_t tx[4];
+  uint8_t rx[4];
+  toBigEndian(data, tx, sizeof(tx));
+  replay(Operation::SPI_TRANSFER, 0, tx, rx, sizeof(rx));
+  return fromBigEndian(rx, sizeof(rx));
+}
+
+void ReplaySPIBus::transferBytes(const uint8_t *data, uint8_t *out,
+                                 uint32_t size) {
+  replay(Operation::SPI_TRANSFER, 0, data, out, size);
+}
+
+void ReplaySPIBus::transferBits(uint32_t data, uint32_t *out, uint8_t bits) {
+  uint8_t tx[4];
+  uint8_t rx[4];
+  toBigEndian(data, tx, sizeof(tx));
+  replay(Operation::SPI_TRANSFER_BITS, bits, tx, rx, sizeof(rx));
+  if (out != nullptr) *out = fromBigEndian(rx, sizeof(rx));
+}
+
+void ReplaySPIBus::write(uint8_t data) { writeBytes(&data, 1); }
+
+void ReplaySPIBus::write16(uint16_t data) {
+  uint8_t buffer[2];
+  toBigEndian(data, buffer, sizeof(buffer));
+  writeBytes(buffer, sizeof(buffer));
+}
+
+void ReplaySPIBus::write32(uint32_t data) {
+  uint8_t buffer[4];
+  toBigEndian(data, buffer, sizeof(buffer));
+  writeBytes(buffer, sizeof(buffer));
+}
+
+void ReplaySPIBus::writeBytes(const uint8_t *data, uint32_t size) {
+  replay(Operation::SPI_WRITE, 0, data, nullptr, size);
+}
+
+void ReplaySPIBus::writePattern(const uint8_t *data, uint8_t size,
+                                uint32_t repeat) {
+  replay(Operation::SPI_WRITE_PATTERN, repeat, data, nullptr, size);
+}
+
+std::vector<std::pair<std::string, std::string>>
+ReplaySPIBus::getStatistics() {
+  return replayer.getStatistics();
+}
+
+int RecordingSerialBus::available(void) {
+  auto delay = clock.start();
+  int result = bus->available();
+  trace->add(makeRecord(Operation::SERIAL_AVAILABLE, delay, clock.stop(), 0,
+                        result, nullptr, 0, nullptr, 0));
+  return result;
+}
+
+int RecordingSerialBus::peek(void) {
+  auto delay = clock.start();
+  int result = bus->peek();
+  trace->add(makeRecord(Operation::SERIAL_PEEK, delay, clock.stop(), 0, result,
+                        nullptr, 0, nullptr, 0));
+  return result;
+}
+
+int RecordingSerialBus::read(void) {
+  auto delay = clock.start();
+  int result = bus->read();
+  trace->add(makeRecord(Operation::SERIAL_READ, delay, clock.stop(), 0, result,
+                        nullptr, 0, nullptr, 0));
+  return result;
+}
+
+size_t RecordingSerialBus::read(uint8_t *buffer, size_t size) {
+  auto delay = clock.start();
+  size_t result = bus->read(buffer, size);
+  trace->add(makeRecord(Operation::SERIAL_READ_BYTES, delay, clock.stop(),
+                        size, result, nullptr, 0, buffer, result));
+  return result;
+}
+
+size_t RecordingSerialBus::write(uint8_t data) { return write(&data, 1); }
+
+size_t RecordingSerialBus::write(const uint8_t *buffer, size_t size) {
+  auto delay = clock.start();
+  size_t result = bus->write(buffer, size);
+  trace->add(makeRecord(Operation::SERIAL_WRITE, delay, clock.stop(), 0,
+                        result, buffer, size, nullptr, 0));
+  return result;
+}
+
+int ReplaySerialBus::available(void) {
+  BusTrace::Record record;
+  if (!replayer.next(Operation::SERIAL_AVAILABLE, 0, nullptr, 0, &record))
+    return 0;
+  return record.result;
+}
+
+int ReplaySerialBus::peek(void) {
+  BusTrace::Record record;
+  if (!replayer.next(Operation::SERIAL_PEEK, 0, nullptr, 0, &record))
+    return -1;
+  return record.result;
+}
+
+int ReplaySerialBus::read(void) {
+  BusTrace::Record record;
+  if (!replayer.next(Operation::SERIAL_READ, 0, nullptr, 0, &record))
+    return -1;
+  return record.result;
+}
+
+size_t ReplaySerialBus::read(uint8_t *buffer, size_t size) {
+  BusTrace::Record record;
+  if (!replayer.next(Operation::SERIAL_READ_BYTES, size, nullptr, 0,
+                     &record))
+    return 0;
+  size_t count = record.rxSize < size ? record.rxSize : size;
+  memcpy(buffer, record.rx, count);
+  return count;
+}
+
+size_t ReplaySerialBus::write(uint8_t data) { return write(&data, 1); }
+
+size_t ReplaySerialBus::write(const uint8_t *buffer, size_t size) {
+  BusTrace::Record record;
+  if (!replayer.next(Operation::SERIAL_WRITE, 0, buffer, size, &record)) {
+    setWriteError();
+    return 0;
+  }
+  return record.result;
+}
+
+std::vector<std::pair<std::string, std::string>>
+ReplaySerialBus::getStatistics() {
+  return replayer.getStatistics();
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include "SHIConfigCodec.h"
+
+#include <string.h>
+
+#include <string>
+
+using SHI::ConfigDecoder;
+using SHI::ConfigEncoder;
+
+namespace {
+
+void writeLittleEndian(uint64_t bits, int size, std::vector<uint8_t> *out) {
+  for (int i = 0; i < size; i++) out->push_back((bits >> (i * 8)) & 0xFF);
+}
+
+uint64_t readLittleEndian(const uint8_t *data, int size) {
+  uint64_t bits = 0;
+  for (int i = 0; i < size; i++)
+    bits |= static_cast<uint64_t>(data[i]) << (i * 8);
+  return bits;
+}
+
+}  // namespace
+
+void ConfigEncoder::write(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  writeLittleEndian(bits, sizeof(bits), out);
+}
+
+void ConfigEncoder::write(double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  writeLittleEndian(bits, sizeof(bits), out);
+}
+
+void ConfigEncoder::write(const std::string &value) {
+  writeUnsigned(value.size());
+  out->insert(out->end(), value.begin(), value.end());
+}
+
+void ConfigEncoder::writeSigned(int64_t value) {
+  writeUnsigned((static_cast<uint64_t>(value) << 1) ^
+                static_cast<uint64_t>(value >> 63));
+}
+
+void ConfigEncoder::writeUnsigned(uint64_t value) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<uint8_t>(value));
+}
+
+int64_t ConfigDecoder::readSigned() {
+  uint64_t value = readUnsigned();
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+uint64_t ConfigDecoder::readUnsigned() {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (position == end) break;
+    uint8_t byte = *position++;
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) return value;
+  }
+  failure = true;
+  return 0;
+}
+
+float ConfigDecoder::readFloat() {
+  const uint8_t *data;
+  if (!take(sizeof(float), &data)) return 0;
+  auto bits = static_cast<uint32_t>(readLittleEndian(data, sizeof(float)));
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+double ConfigDecoder::readDouble() {
+  const uint8_t *data;
+  if (!take(sizeof(double), &data)) return 0;
+  uint64_t bits = readLittleEndian(data, sizeof(double));
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+std::string ConfigDecoder::readString() {
+  const uint8_t *data;
+  uint64_t size = readUnsigned();
+  if (size > static_cast<uint64_t>(end - position) || !take(size, &data)) {
+    failure = true;
+    return std::string();
+  }
+  return std::string(reinterpret_cast<const char *>(data), size);
+}
+
+bool ConfigDecoder::take(size_t size, const uint8_t **data) {
+  if (static_cast<size_t>(end - position) < size) {
+    failure = true;
+    position = end;
+    return false;
+  }
+  *data = position;
+  position += size;
+  return true;
+}
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include "SHIConfigSnapshot.h"
+
+#include <string.h>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using SHI::ConfigSnapshot;
+using SHI::ConfigSnapshotBuilder;
+using SHI::SnapshotFile;
+
+namespace {
+
+const char MAGIC[] = {'S', 'H', 'C', 'S'};
+const size_t HEADER_SIZE = 28;
+const size_t CLASS_ENTRY_SIZE = 8;
+const size_t OBJECT_ENTRY_SIZE = 16;
+
+uint16_t readU16(const uint8_t *data) {
+  return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+uint32_t readU32(const uint8_t *data) {
+  return static_cast<uint32_t>(data[0]) |
+         (static_cast<uint32_t>(data[1]) << 8) |
+         (static_cast<uint32_t>(data[2]) << 16) |
+         (static_cast<uint32_t>(data[3]) << 24);
+}
+
+void writeU16(uint16_t value, std::vector<uint8_t> *out) {
+  out->push_back(value & 0xFF);
+  out->push_back(value >> 8);
+}
+
+void writeU32(uint32_t value, std::vector<uint8_t> *out) {
+  for (int shift = 0; shift < 32; shift += 8)
+    out->push_back((value >> shift) & 0xFF);
+}
+
+bool isChildrenKey(const char *key) {
+  return strcmp(key, "$sensors") == 0 || strcmp(key, "$groups") == 0 ||
+         strcmp(key, "$comms") == 0;
+}
+
+}  // namespace
+
+bool ConfigSnapshot::open(const uint8_t *newData, size_t size) {
+  objectCount = 0;
+  if (newData == nullptr || size < HEADER_SIZE) return false;
+  if (memcmp(newData, MAGIC, sizeof(MAGIC)) != 0) return false;
+  if (readU16(newData + 4) != VERSION) return false;
+  uint32_t newClassCount = readU32(newData + 8);
+  uint32_t newObjectCount = readU32(newData + 12);
+  uint32_t stringsSize = readU32(newData + 16);
+  uint32_t fieldsSize = readU32(newData + 20);
+  uint64_t total = HEADER_SIZE +
+                   static_cast<uint64_t>(newClassCount) * CLASS_ENTRY_SIZE +
+                   static_cast<uint64_t>(newObjectCount) * OBJECT_ENTRY_SIZE +
+                   stringsSize + fieldsSize;
+  if (total > size || newObjectCount == 0 || newClassCount > 0xFFFF)
+    return false;
+  data = newData;
+  maxCapacity = readU32(newData + 24);
+  classes = newData + HEADER_SIZE;
+  objects = classes + newClassCount * CLASS_ENTRY_SIZE;
+  strings = objects + newObjectCount * OBJECT_ENTRY_SIZE;
+  fields = strings + stringsSize;
+  // Validate once, so the loader can use the tables without checks
+  for (uint32_t i = 0; i < newClassCount; i++) {
+    const uint8_t *entry = classes + i * CLASS_ENTRY_SIZE;
+    if (static_cast<uint64_t>(readU32(entry)) + readU32(entry + 4) >
+        stringsSize)
+      return false;
+  }
+  for (uint32_t i = 0; i < newObjectCount; i++) {
+    const uint8_t *entry = objects + i * OBJECT_ENTRY_SIZE;
+    auto section = static_cast<Section>(entry[2]);
+    bool isRoot = section == Section::ROOT;
+    uint32_t offset = readU32(entry + 8);
+    uint32_t objectSize = readU32(entry + 12);
+    // The fields start with their encoding
+    if (readU16(entry) >= newClassCount || entry[2] > 3 ||
+        isRoot != (i == 0) || (i != 0 && readU32(entry + 4) >= i) ||
+        objectSize == 0 ||
+        static_cast<uint64_t>(offset) + objectSize > fieldsSize ||
+        fields[offset] > static_cast<uint8_t>(Encoding::CODEC))
+      return false;
+  }
+  classCount = newClassCount;
+  objectCount = newObjectCount;
+  return true;
+}
+
+std::string ConfigSnapshot::getClassName(uint16_t classId) const {
+  const uint8_t *entry = classes + classId * CLASS_ENTRY_SIZE;
+  return std::string(reinterpret_cast<const char *>(strings + readU32(entry)),
+                     readU32(entry + 4));
+}
+
+ConfigSnapshot::Object ConfigSnapshot::getObject(uint32_t index) const {
+  const uint8_t *entry = objects + index * OBJECT_ENTRY_SIZE;
+  Object object;
+  object.classId = readU16(entry);
+  object.section = static_cast<Section>(entry[2]);
+  object.depth = entry[3];
+  object.parent = readU32(entry + 4);
+  const uint8_t *objectFields = fields + readU32(entry + 8);
+  object.encoding = static_cast<Encoding>(objectFields[0]);
+  object.fields = objectFields + 1;
+  object.fieldsSize = readU32(entry + 12) - 1;
+  return object;
+}
+
+uint32_t ConfigSnapshotBuilder::addObject(const std::string &className,
+                                          ConfigSnapshot::Section section,
+                                          uint8_t depth, uint32_t parent,
+                                          JsonObjectConst source) {
+  // Children are linked through the object table, not stored as fields
+  DynamicJsonDocument copy(JSON_OBJECT_SIZE(source.size()) +
+                           source.memoryUsage());
+  JsonObject copied = copy.to<JsonObject>();
+  for (auto kv : source) {
+    if (!isChildrenKey(kv.key().c_str()))
+      copied[kv.key().c_str()].set(kv.value());
+  }
+  std::string encoded;
+  serializeMsgPack(copy, encoded);
+
+  // The exact capacity the loader needs, strings are copied there
+  DynamicJsonDocument decoded(JSON_OBJECT_SIZE(encoded.size()) +
+                              encoded.size());
+  deserializeMsgPack(decoded, encoded.data(), encoded.size());
+  maxCapacity =
+      std::max(maxCapacity, static_cast<uint32_t>(decoded.memoryUsage()));
+  return addEntry(className, section, depth, parent,
+                  ConfigSnapshot::Encoding::MSGPACK, encoded.data(),
+                  encoded.size());
+}
+
+uint32_t ConfigSnapshotBuilder::addObject(const std::string &className,
+                                          ConfigSnapshot::Section section,
+                                          uint8_t depth, uint32_t parent,
+                                          const std::vector<uint8_t> &encoded) {
+  return addEntry(className, section, depth, parent,
+                  ConfigSnapshot::Encoding::CODEC,
+                  reinterpret_cast<const char *>(encoded.data()),
+                  encoded.size());
+}
+
+uint32_t ConfigSnapshotBuilder::addEntry(const std::string &className,
+                                         ConfigSnapshot::Section section,
+                                         uint8_t depth, uint32_t parent,
+                                         ConfigSnapshot::Encoding encoding,
+                                         const char *data, size_t size) {
+  writeU16(getClassId(className), &objectTable);
+  objectTable.push_back(static_cast<uint8_t>(section));
+  objectTable.push_back(depth);
+  writeU32(parent, &objectTable);
+  writeU32(fields.size(), &objectTable);
+  writeU32(size + 1, &objectTable);
+  fields += static_cast<char>(encoding);
+  fields.append(data, size);
+  return objectCount++;
+}
+
+void ConfigSnapshotBuilder::finish(std::vector<uint8_t> *snapshot) const {
+  snapshot->clear();
+  snapshot->reserve(HEADER_SIZE + classTable.size() + objectTable.size() +
+                    strings.size() + fields.size());
+  snapshot->insert(snapshot->end(), MAGIC, MAGIC + sizeof(MAGIC));
+  writeU16(ConfigSnapshot::VERSION, snapshot);
+  writeU16(0, snapshot);
+  writeU32(classIds.size(), snapshot);
+  writeU32(objectCount, snapshot);
+  writeU32(strings.size(), snapshot);
+  writeU32(fields.size(), snapshot);
+  writeU32(maxCapacity, snapshot);
+  snapshot->insert(snapshot->end(), classTable.begin(), classTable.end());
+  snapshot->insert(snapshot->end(), objectTable.begin(), objectTable.end());
+  snapshot->insert(snapshot->end(), strings.begin(), strings.end());
+  snapshot->insert(snapshot->end(), fields.begin(), fields.end());
+}
+
+uint16_t ConfigSnapshotBuilder::getClassId(const std::string &className) {
+  auto found = classIds.find(className);
+  if (found != classIds.end()) return found->second;
+  auto classId = static_cast<uint16_t>(classIds.size());
+  classIds[className] = classId;
+  writeU32(strings.size(), &classTable);
+  writeU32(className.size(), &classTable);
+  strings += className;
+  return classId;
+}
+
+#if defined(__linux__)
+
+SnapshotFile::SnapshotFile(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return;
+  struct stat info;
+  if (fstat(fd, &info) == 0) {
+    size = info.st_size;
+    if (size == 0) {
+      opened = true;
+    } else {
+      void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapping != MAP_FAILED) {
+        data = static_cast<const uint8_t *>(mapping);
+        mapped = true;
+        opened = true;
+      }
+    }
+  }
+  ::close(fd);
+}
+
+SnapshotFile::~SnapshotFile() {
+  if (mapped) munmap(const_cast<uint8_t *>(data), size);
+}
+
+#else
+
+SnapshotFile::SnapshotFile(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) return;
+  buffer.assign(std::istreambuf_iterator<char>(file),
+                std::istreambuf_iterator<char>());
+  data = buffer.data();
+  size = buffer.size();
+  opened = true;
+}
+
+SnapshotFile::~SnapshotFile() {}
+
+#endif  // __linux__
@@ -6,9 +6,18 @@
 
 #include "SHIFactory.h"
 
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "ArduinoJson.h"
 #include "SHICommunicator.h"
@@ -16,80 +25,96 @@
 #include "SHISensor.h"
 
 using SHI::Communicator;
+using SHI::ConfigDecoder;
+using SHI::ConfigEncoder;
+using SHI::ConfigSnapshot;
+using SHI::ConfigSnapshotBuilder;
 using SHI::Configuration;
 using SHI::ConfigurationVisitor;
 using SHI::Factory;
 using SHI::FactoryErrors;
 using SHI::Hardware;
+using SHI::JsonWriter;
+using SHI::ReconfigurationStats;
 using SHI::Sensor;
 using SHI::SensorGroup;
+using SHI::SHIObject;
+using SHI::SnapshotFile;
+using SHI::Visitor;
 
-void ConfigurationVisitor::enterVisit(Sensor *sensor) {
-  auto ptr = std::make_shared<Record>();
-  auto config = sensor->getConfig();
-  auto sensorConfig = ptr->doc.createNestedObject(sensor->getName());
-  if (config != nullptr) config->fillData(sensorConfig);
-  currentNode->sensors.push_back(ptr);
+namespace {
+
+const char *sectionKey(int section) {
+  static const char *SECTION_KEYS[] = {"", "$sensors", "$groups", "$comms"};
+  return SECTION_KEYS[section];
 }
-void ConfigurationVisitor::leaveVisit(Sensor *sensor) {}
 
-void ConfigurationVisitor::enterVisit(SensorGroup *group) {
-  auto ptr = std::make_shared<Record>();
-  auto config = group->getConfig();
-  auto sensorConfig = ptr->doc.createNestedObject("sensorGroup");
-  if (config != nullptr) config->fillData(sensorConfig);
+/// The key of an object in the configuration, objects that were not
+/// constructed by the Factory fall back to their name
+std::string classKey(const SHIObject *object, const std::string &fallback) {
+  auto &className = object->getClassName();
+  return className.empty() ? fallback : className;
+}
+
+/// Room for the strings that fillData() copies into the document
+const size_t STRING_CAPACITY = 512;
+
+}  // namespace
 
-  currentNode->groups.push_back(ptr);
-  stack.push(currentNode);
-  currentNode = ptr;
+void ConfigurationVisitor::beginNode(Section section, const std::string &name,
+                                     const Configuration *config) {
+  if (!sections.empty() && sections.back() != section) {
+    if (sections.back() != Section::NONE) writer.endArray();
+    writer.key(sectionKey(static_cast<int>(section)));
+    writer.beginArray();
+    sections.back() = section;
+  }
+  writer.beginObject();
+  writer.key(name);
+  writer.beginObject();
+  if (config != nullptr) config->writeJson(writer);
+  sections.push_back(Section::NONE);
 }
-void ConfigurationVisitor::leaveVisit(SensorGroup *channel) {
-  currentNode = stack.top();
-  stack.pop();
+
+void ConfigurationVisitor::endNode() {
+  if (sections.empty()) return;
+  if (sections.back() != Section::NONE) writer.endArray();
+  sections.pop_back();
+  writer.endObject();
+  writer.endObject();
 }
 
+void ConfigurationVisitor::enterVisit(Sensor *sensor) {
+  beginNode(Section::SENSORS, classKey(sensor, sensor->getName()),
+            sensor->getConfig());
+  if (sensor->getSamplingInterval() >= 0) {
+    writer.key("$interval");
+    writer.value(sensor->getSamplingInterval());
+  }
+  if (sensor->isLazySetup()) {
+    writer.key("$lazySetup");
+    writer.value(true);
+  }
+}
+void ConfigurationVisitor::leaveVisit(Sensor *sensor) { endNode(); }
+
+void ConfigurationVisitor::enterVisit(SensorGroup *group) {
+  beginNode(Section::GROUPS, classKey(group, "sensorGroup"),
+            group->getConfig());
+}
+void ConfigurationVisitor::leaveVisit(SensorGroup *channel) { endNode(); }
+
 void ConfigurationVisitor::visit(Communicator *communicator) {
-  auto ptr = std::make_shared<Record>();
-  auto config = communicator->getConfig();
-  auto sensorConfig = ptr->doc.createNestedObject(communicator->getName());
-  if (config != nullptr) config->fillData(sensorConfig);
-  currentNode->comms.push_back(ptr);
+  beginNode(Section::COMMS, classKey(communicator, communicator->getName()),
+            communicator->getConfig());
+  endNode();
 }
 void ConfigurationVisitor::enterVisit(Hardware *hardware) {
-  auto ptr = std::make_shared<Record>();
-  currentNode = ptr;
-  auto hwNode = currentNode->doc.createNestedObject("hw");
-  auto config = hardware->getConfig();
-  if (config != nullptr) config->fillData(hwNode);
+  beginNode(Section::NONE, "hw", hardware->getConfig());
 }
-void ConfigurationVisitor::leaveVisit(Hardware *hardware) {}
+void ConfigurationVisitor::leaveVisit(Hardware *hardware) { endNode(); }
 void ConfigurationVisitor::visit(MeasurementMetaData *data) {}
 
-JsonObject ConfigurationVisitor::Record::buildTree() {
-  for (auto kv : doc.as<JsonObject>()) {
-    auto rootNode = kv.value();
-    if (comms.size() != 0) {
-      auto commsArray = rootNode.createNestedArray("$comms");
-      for (auto &&commNode : comms) {
-        commsArray.add(commNode->buildTree());
-      }
-    }
-    if (groups.size() != 0) {
-      auto groupsArray = rootNode.createNestedArray("$groups");
-      for (auto &&groupNode : groups) {
-        groupsArray.add(groupNode->buildTree());
-      }
-    }
-    if (sensors.size() != 0) {
-      auto sensorsArray = rootNode.createNestedArray("$sensors");
-      for (auto &&sensorNode : sensors) {
-        sensorsArray.add(sensorNode->buildTree());
-      }
-    }
-  }
-  return doc.as<JsonObject>();
-}
-
 Factory *Factory::get() {
   if (instance == nullptr) instance = new Factory();
   return instance;
@@ -106,7 +131,9 @@ const char *Factory::errorToString(SHI::FactoryErrors error) {
                                               "InvalidHWKeyFound",
                                               "MissingRegistryForHW",
                                               "MissingRegistryForEntry",
-                                              "FailureToLoadFile"};
+                                              "FailureToLoadFile",
+                                              "InvalidSnapshot",
+                                              "NoHardwareToReconfigure"};
   return FACTORY_ERROR_NAMES[static_cast<int>(error)];
 }
 
@@ -115,20 +142,85 @@ T *Factory::getInstance(SHI::FactoryResult result) {
   return static_cast<T *>(std::get<0>(result));
 }
 
+namespace {
+
+constexpr uint32_t HW_HASH = SHI::factoryHash("hw");
+
+// Give up when the document would need more than this
+const size_t MAX_DOCUMENT_CAPACITY = 256 * 1024;
+
+/// Every member and element takes one slot of the document. Counting the
+/// separators and opening brackets gives an upper bound of the slots.
+size_t estimateCapacity(const char *json, size_t size) {
+  size_t slots = 1;
+  for (size_t i = 0; i < size; i++) {
+    char c = json[i];
+    if (c == ',' || c == '{' || c == '[') slots++;
+  }
+  return JSON_OBJECT_SIZE(slots);
+}
+
+}  // namespace
+
 SHI::FactoryResult Factory::construct(const std::string &json) {
-  DeserializationError err = deserializeJson(doc, json);
+  // A mutable copy allows parsing in place, so strings are not copied into
+  // the document again
+  std::vector<char> buffer(json.begin(), json.end());
+  return construct(buffer.data(), buffer.size());
+}
+
+SHI::FactoryResult Factory::construct(char *json, size_t size) {
+  DynamicJsonDocument doc(estimateCapacity(json, size));
+  DeserializationError err = deserializeJson(doc, json, size);
   if (err) {
     return errorToResult(FactoryErrors::FailureToParseJson);
   }
+  return constructFromDocument(doc);
+}
+
+SHI::FactoryResult Factory::construct(std::istream &json) {
+  auto start = json.tellg();
+  json.seekg(0, std::ios::end);
+  auto end = json.tellg();
+  json.seekg(start);
+  if (start < 0 || end < 0 || !json) {
+    // Not seekable, so it can't be read twice
+    json.clear();
+    std::string content((std::istreambuf_iterator<char>(json)),
+                        std::istreambuf_iterator<char>());
+    return construct(content);
+  }
+  // Strings are copied into the document, the input size bounds them
+  size_t capacity = JSON_OBJECT_SIZE(1) + static_cast<size_t>(end - start);
+  while (true) {
+    DynamicJsonDocument doc(capacity);
+    DeserializationError err = deserializeJson(doc, json);
+    if (!err) return constructFromDocument(doc);
+    if (err != DeserializationError::NoMemory ||
+        capacity >= MAX_DOCUMENT_CAPACITY) {
+      return errorToResult(FactoryErrors::FailureToParseJson);
+    }
+    capacity *= 2;
+    json.clear();
+    json.seekg(start);
+  }
+}
+
+SHI::FactoryResult Factory::constructFromFile(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) return errorToResult(FactoryErrors::FailureToLoadFile);
+  return construct(file);
+}
+
+SHI::FactoryResult Factory::constructFromDocument(JsonDocument &doc) {
   JsonObject obj = doc.as<JsonObject>();
   if (!obj.containsKey("hw")) return errorToResult(FactoryErrors::NoHWKeyFound);
   auto hwObj = obj["hw"];
   if (!hwObj.is<JsonObject>())
     return errorToResult(FactoryErrors::InvalidHWKeyFound);
-  auto factoryFind = factories.find("hw");
-  if (factoryFind != factories.end()) {
-    auto factory = factoryFind->second;
-    FactoryResult result = factory(hwObj);
+  auto entry = findFactory("hw", HW_HASH);
+  if (entry != nullptr) {
+    FactoryResult result = entry->call(hwObj);
     if (getError(result) == FactoryErrors::None)
       hw = getInstance<Hardware>(result);
     return result;
@@ -136,20 +228,673 @@ SHI::FactoryResult Factory::construct(const std::string &json) {
   return errorToResult(FactoryErrors::MissingRegistryForHW);
 }
 
+SHI::FactoryErrors Factory::compileSnapshot(const std::string &json,
+                                            std::vector<uint8_t> *snapshot) {
+  std::vector<char> buffer(json.begin(), json.end());
+  DynamicJsonDocument doc(estimateCapacity(buffer.data(), buffer.size()));
+  if (deserializeJson(doc, buffer.data(), buffer.size()))
+    return FactoryErrors::FailureToParseJson;
+  JsonObject obj = doc.as<JsonObject>();
+  if (!obj.containsKey("hw")) return FactoryErrors::NoHWKeyFound;
+  if (!obj["hw"].is<JsonObject>()) return FactoryErrors::InvalidHWKeyFound;
+  auto entry = findFactory("hw", HW_HASH);
+  if (entry == nullptr) return FactoryErrors::MissingRegistryForHW;
+  JsonObject hwObj = obj["hw"];
+  ConfigSnapshotBuilder builder;
+  addToSnapshot(entry, ConfigSnapshot::Section::ROOT, 0, 0, hwObj, &builder);
+  auto error = compileChildren(hwObj, 0, 0, &builder);
+  if (error != FactoryErrors::None) return error;
+  builder.finish(snapshot);
+  return FactoryErrors::None;
+}
+
+SHI::FactoryErrors Factory::compileChildren(const JsonObject &obj,
+                                            uint8_t depth, uint32_t parent,
+                                            ConfigSnapshotBuilder *builder) {
+  // The same children the default factories construct, groups only have
+  // sensors
+  static const std::pair<const char *, ConfigSnapshot::Section> CHILDREN[] = {
+      {"$sensors", ConfigSnapshot::Section::SENSORS},
+      {"$groups", ConfigSnapshot::Section::GROUPS},
+      {"$comms", ConfigSnapshot::Section::COMMS}};
+  size_t kinds = depth == 0 ? 3 : 1;
+  for (size_t kind = 0; kind < kinds; kind++) {
+    auto section = CHILDREN[kind].second;
+    JsonArray children = obj[CHILDREN[kind].first];
+    for (JsonObject childObj : children) {
+      for (auto kv : childObj) {
+        auto entry = findFactory(kv.key().c_str());
+        if (entry == nullptr) return FactoryErrors::MissingRegistryForEntry;
+        JsonObject arguments = kv.value();
+        auto index = addToSnapshot(entry, section, depth + 1, parent,
+                                   arguments, builder);
+        if (section != ConfigSnapshot::Section::GROUPS) continue;
+        auto error = compileChildren(arguments, depth + 1, index, builder);
+        if (error != FactoryErrors::None) return error;
+      }
+    }
+  }
+  return FactoryErrors::None;
+}
+
+uint32_t Factory::addToSnapshot(const Entry *entry,
+                                ConfigSnapshot::Section section, uint8_t depth,
+                                uint32_t parent, const JsonObject &obj,
+                                ConfigSnapshotBuilder *builder) {
+  if (!entry->encode)
+    return builder->addObject(entry->name, section, depth, parent, obj);
+  std::vector<uint8_t> encoded;
+  ConfigEncoder encoder(&encoded);
+  entry->encode(obj, encoder);
+  return builder->addObject(entry->name, section, depth, parent, encoded);
+}
+
+SHI::FactoryResult Factory::constructFromSnapshot(const uint8_t *data,
+                                                  size_t size) {
+  ConfigSnapshot snapshot;
+  if (!snapshot.open(data, size))
+    return errorToResult(FactoryErrors::InvalidSnapshot);
+  // Look up every class once instead of once per object
+  std::vector<const Entry *> classFactories;
+  classFactories.reserve(snapshot.getClassCount());
+  for (uint32_t i = 0; i < snapshot.getClassCount(); i++)
+    classFactories.push_back(findFactory(snapshot.getClassName(i).c_str()));
+  // Only hardware and groups can have children
+  uint32_t count = snapshot.getObjectCount();
+  uint8_t maxDepth = 0;
+  for (uint32_t i = 1; i < count; i++) {
+    auto object = snapshot.getObject(i);
+    auto parent = snapshot.getObject(object.parent);
+    bool intoGroup = parent.section == ConfigSnapshot::Section::GROUPS &&
+                     object.section == ConfigSnapshot::Section::SENSORS;
+    if ((object.parent != 0 && !intoGroup) ||
+        object.depth != parent.depth + 1)
+      return errorToResult(FactoryErrors::InvalidSnapshot);
+    maxDepth = std::max(maxDepth, object.depth);
+  }
+
+  std::vector<SHIObject *> objects;
+  objects.reserve(count);
+  DynamicJsonDocument doc(snapshot.getMaxCapacity());
+  FactoryErrors error = FactoryErrors::None;
+  for (uint32_t i = 0; i < count; i++) {
+    auto object = snapshot.getObject(i);
+    auto factory = classFactories[object.classId];
+    if (factory == nullptr) {
+      error = i == 0 ? FactoryErrors::MissingRegistryForHW
+                     : FactoryErrors::MissingRegistryForEntry;
+      break;
+    }
+    FactoryResult result;
+    if (object.encoding == ConfigSnapshot::Encoding::CODEC) {
+      if (!factory->decode) {
+        error = FactoryErrors::InvalidSnapshot;
+        break;
+      }
+      ConfigDecoder decoder(object.fields, object.fieldsSize);
+      result = factory->decode(decoder);
+    } else {
+      if (deserializeMsgPack(doc,
+                             reinterpret_cast<const char *>(object.fields),
+                             object.fieldsSize)) {
+        error = FactoryErrors::InvalidSnapshot;
+        break;
+      }
+      result = factory->call(doc.as<JsonObject>());
+    }
+    error = getError(result);
+    if (error != FactoryErrors::None) break;
+    objects.push_back(std::get<0>(result));
+    objects.back()->setClassName(factory->name);
+  }
+  if (error != FactoryErrors::None) {
+    // Nothing is attached yet, so nothing else owns the objects
+    if (!objects.empty() && objects[0] == hw) hw = nullptr;
+    for (auto it = objects.rbegin(); it != objects.rend(); ++it) delete *it;
+    return errorToResult(error);
+  }
+
+  // Children are attached before their parent is, as the default factories
+  // do. Attaching a group named default moves its sensors.
+  auto hardware = getInstance<Hardware>(objToResult(objects[0]));
+  for (int depth = maxDepth; depth > 0; depth--) {
+    for (uint32_t i = 1; i < count; i++) {
+      auto object = snapshot.getObject(i);
+      if (object.depth != depth) continue;
+      if (object.parent != 0) {
+        auto group = static_cast<SensorGroup *>(objects[object.parent]);
+        group->addSensor(
+            std::shared_ptr<Sensor>(static_cast<Sensor *>(objects[i])));
+      } else if (object.section == ConfigSnapshot::Section::SENSORS) {
+        hardware->addSensor(
+            std::shared_ptr<Sensor>(static_cast<Sensor *>(objects[i])));
+      } else if (object.section == ConfigSnapshot::Section::GROUPS) {
+        hardware->addSensorGroup(std::shared_ptr<SensorGroup>(
+            static_cast<SensorGroup *>(objects[i])));
+      } else {
+        hardware->addCommunicator(std::shared_ptr<Communicator>(
+            static_cast<Communicator *>(objects[i])));
+      }
+    }
+  }
+  hw = hardware;
+  return objToResult(hardware);
+}
+
+SHI::FactoryResult Factory::constructFromSnapshotFile(const std::string &path) {
+  SnapshotFile file(path);
+  if (!file.isOpen()) return errorToResult(FactoryErrors::FailureToLoadFile);
+  return constructFromSnapshot(file.getData(), file.getSize());
+}
+
+namespace {
+
+bool isChildrenKey(const char *key) {
+  return strcmp(key, "$sensors") == 0 || strcmp(key, "$groups") == 0 ||
+         strcmp(key, "$comms") == 0;
+}
+
+bool sameFields(JsonObjectConst a, JsonObjectConst b);
+
+bool sameValue(JsonVariantConst a, JsonVariantConst b) {
+  if (a.is<JsonObject>()) {
+    return b.is<JsonObject>() &&
+           sameFields(a.as<JsonObjectConst>(), b.as<JsonObjectConst>());
+  }
+  if (a.is<JsonArray>()) {
+    if (!b.is<JsonArray>()) return false;
+    auto left = a.as<JsonArrayConst>();
+    auto right = b.as<JsonArrayConst>();
+    if (left.size() != right.size()) return false;
+    for (size_t i = 0; i < left.size(); i++) {
+      if (!sameValue(left[i], right[i])) return false;
+    }
+    return true;
+  }
+  std::string left, right;
+  serializeJson(a, left);
+  serializeJson(b, right);
+  return left == right;
+}
+
+/// Members starting with $ are handled by the factories and not compared
+bool sameFields(JsonObjectConst a, JsonObjectConst b) {
+  size_t members = 0;
+  for (auto kv : a) {
+    const char *key = kv.key().c_str();
+    if (key[0] == '$') continue;
+    members++;
+    if (!b.containsKey(key) || !sameValue(kv.value(), b[key])) return false;
+  }
+  size_t otherMembers = 0;
+  for (auto kv : b) {
+    if (kv.key().c_str()[0] != '$') otherMembers++;
+  }
+  return members == otherMembers;
+}
+
+bool sameConfig(const SHIObject *a, const SHIObject *b) {
+  auto left = a->getConfig();
+  auto right = b->getConfig();
+  return left != nullptr && right != nullptr &&
+         left->toJson() == right->toJson();
+}
+
+/// One entry of a list of children. Groups are identified by their name,
+/// all others by their class name, which ConfigurationVisitor writes for
+/// objects the Factory constructed.
+struct Child {
+  std::string key;
+  const char *className;
+  JsonObject obj;
+};
+
+std::vector<Child> getChildren(JsonObject obj, const char *list) {
+  std::vector<Child> children;
+  JsonArray entries = obj[list];
+  for (JsonObject entry : entries) {
+    for (auto kv : entry) {
+      JsonObject childObj = kv.value();
+      const char *key = kv.key().c_str();
+      if (strcmp(list, "$groups") == 0) key = childObj["name"] | "default";
+      children.push_back({key, kv.key().c_str(), childObj});
+    }
+  }
+  return children;
+}
+
+/// For every next child the index of the current child with the same key
+/// and occurrence, or -1 if it is new
+std::vector<int> matchChildren(const std::vector<Child> &current,
+                               const std::vector<Child> &next) {
+  std::map<std::string, std::vector<int>> unmatched;
+  for (int i = static_cast<int>(current.size()) - 1; i >= 0; i--) {
+    unmatched[current[i].key].push_back(i);
+  }
+  std::vector<int> matches;
+  matches.reserve(next.size());
+  for (auto &&child : next) {
+    auto found = unmatched.find(child.key);
+    if (found == unmatched.end() || found->second.empty()) {
+      matches.push_back(-1);
+    } else {
+      matches.push_back(found->second.back());
+      found->second.pop_back();
+    }
+  }
+  return matches;
+}
+
+/// Collects the objects in the order ConfigurationVisitor writes them
+class TreeVisitor : public Visitor {
+ public:
+  struct Group {
+    SensorGroup *group;
+    std::vector<Sensor *> sensors;
+  };
+  void enterVisit(Sensor *sensor) override {
+    if (!groups.empty()) groups.back().sensors.push_back(sensor);
+  }
+  void enterVisit(SensorGroup *group) override {
+    groups.push_back({group, {}});
+  }
+  void visit(Communicator *communicator) override {
+    comms.push_back(communicator);
+  }
+  std::vector<Communicator *> comms;
+  std::vector<Group> groups;
+};
+
+/// The changes Factory::reconfigure() found. They are applied at once after
+/// all new objects were constructed, otherwise they are deleted unused.
+class Reconfiguration {
+ public:
+  enum class Kind { HARDWARE, GROUP, SENSOR, COMMUNICATOR };
+  explicit Reconfiguration(Hardware *hardware) : hardware(hardware) {}
+  void update(Kind kind, SHIObject *current, SHIObject *next,
+              SensorGroup *group) {
+    updates.push_back({kind, current, std::unique_ptr<SHIObject>(next), group});
+  }
+  void setInterval(Sensor *sensor, int interval) {
+    intervals.push_back({sensor, interval});
+  }
+  void setLazySetup(Sensor *sensor, bool lazy) {
+    lazySetups.push_back({sensor, lazy});
+  }
+  void add(SensorGroup *group, Sensor *sensor) {
+    addedSensors.push_back({group, std::unique_ptr<Sensor>(sensor)});
+  }
+  void add(SensorGroup *group) { addedGroups.emplace_back(group); }
+  void add(Communicator *communicator) {
+    addedComms.emplace_back(communicator);
+  }
+  void remove(Sensor *sensor) { removedSensors.push_back(sensor); }
+  void remove(SensorGroup *group) { removedGroups.push_back(group); }
+  void remove(Communicator *communicator) {
+    removedComms.push_back(communicator);
+  }
+  void apply(SHI::ReconfigurationStats *stats);
+
+ private:
+  struct Update {
+    Kind kind;
+    SHIObject *current;
+    std::unique_ptr<SHIObject> next;
+    SensorGroup *group;
+  };
+  struct Interval {
+    Sensor *sensor;
+    int interval;
+  };
+  struct LazySetup {
+    Sensor *sensor;
+    bool lazy;
+  };
+  struct AddedSensor {
+    SensorGroup *group;
+    std::unique_ptr<Sensor> sensor;
+  };
+  void attach(SensorGroup *group, std::shared_ptr<Sensor> sensor);
+  void attach(std::shared_ptr<Communicator> communicator);
+  void setup(Sensor *sensor);
+  Hardware *hardware;
+  std::vector<Update> updates;
+  std::vector<Interval> intervals;
+  std::vector<LazySetup> lazySetups;
+  std::vector<AddedSensor> addedSensors;
+  std::vector<std::unique_ptr<SensorGroup>> addedGroups;
+  std::vector<std::unique_ptr<Communicator>> addedComms;
+  std::vector<Sensor *> removedSensors;
+  std::vector<SensorGroup *> removedGroups;
+  std::vector<Communicator *> removedComms;
+};
+
+void Reconfiguration::apply(SHI::ReconfigurationStats *stats) {
+  // Stop the old objects first, so that new ones can take over their
+  // resources
+  for (auto &&communicator : removedComms) {
+    hardware->removeCommunicator(communicator);
+    stats->removed++;
+  }
+  for (auto &&group : removedGroups) {
+    for (auto &&sensor : *group->getSensors()) sensor->stopSensor();
+    stats->removed += group->getSensors()->size() + 1;
+    hardware->removeSensorGroup(group);
+  }
+  for (auto &&sensor : removedSensors) {
+    sensor->stopSensor();
+    hardware->removeSensor(sensor);
+    stats->removed++;
+  }
+  for (auto &&interval : intervals) {
+    interval.sensor->setSamplingInterval(interval.interval);
+    hardware->getScheduler()->invalidate();
+  }
+  for (auto &&lazySetup : lazySetups) {
+    lazySetup.sensor->setLazySetup(lazySetup.lazy);
+    if (!lazySetup.sensor->isSetUp()) setup(lazySetup.sensor);
+  }
+  for (auto &&update : updates) {
+    auto config = update.next->getConfig();
+    if (config != nullptr &&
+        update.current->reconfigure(const_cast<Configuration *>(config))) {
+      // reconfigure() changed the configuration in place, readers on other
+      // threads get the one of the unused replacement instead. Groups have
+      // a ConfigHolder, and the hardware isn't kept twice.
+      if (update.kind == Kind::SENSOR || update.kind == Kind::COMMUNICATOR) {
+        std::shared_ptr<SHIObject> owner(std::move(update.next));
+        update.current->publishConfig(
+            std::shared_ptr<const Configuration>(owner, config));
+      }
+      stats->reconfigured++;
+      continue;
+    }
+    if (update.kind == Kind::SENSOR) {
+      auto current = static_cast<Sensor *>(update.current);
+      current->stopSensor();
+      hardware->removeSensor(current);
+      attach(update.group, std::shared_ptr<Sensor>(
+                               static_cast<Sensor *>(update.next.release())));
+      stats->replaced++;
+    } else if (update.kind == Kind::COMMUNICATOR) {
+      hardware->removeCommunicator(static_cast<Communicator *>(update.current));
+      attach(std::shared_ptr<Communicator>(
+          static_cast<Communicator *>(update.next.release())));
+      stats->replaced++;
+    } else {
+      hardware->logWarn("Factory", __func__,
+                        update.current->getName() +
+                            " refused the new configuration");
+      stats->failed++;
+    }
+  }
+  updates.clear();
+  for (auto &&added : addedGroups) {
+    std::shared_ptr<SensorGroup> group(added.release());
+    hardware->addSensorGroup(group);
+    for (auto &&sensor : *group->getSensors()) setup(sensor.get());
+    stats->added += group->getSensors()->size() + 1;
+  }
+  for (auto &&added : addedSensors) {
+    attach(added.group, std::shared_ptr<Sensor>(added.sensor.release()));
+    stats->added++;
+  }
+  for (auto &&added : addedComms) {
+    attach(std::shared_ptr<Communicator>(added.release()));
+    stats->added++;
+  }
+}
+
+void Reconfiguration::attach(SensorGroup *group,
+                             std::shared_ptr<Sensor> sensor) {
+  group->addSensor(sensor);
+  hardware->getScheduler()->invalidate();
+  setup(sensor.get());
+}
+
+void Reconfiguration::attach(std::shared_ptr<Communicator> communicator) {
+  hardware->addCommunicator(communicator);
+  communicator->setupCommunication();
+  communicator->newStatus(hardware->getStatus(), hardware);
+}
+
+void Reconfiguration::setup(Sensor *sensor) {
+  // A lazy sensor is set up by the loop before its first read. Unlike
+  // during boot the other sensors keep running if this fails.
+  if (sensor->isLazySetup()) return;
+  if (!sensor->runSetup()) {
+    hardware->logError("Factory", __func__,
+                       "Something went wrong when setting up sensor:" +
+                           sensor->getQualifiedName() + " " +
+                           sensor->getStatus().stringRepresentation);
+  }
+}
+
+}  // namespace
+
+SHI::FactoryErrors Factory::reconfigure(const std::string &json,
+                                        ReconfigurationStats *stats) {
+  ReconfigurationStats ignored;
+  if (stats == nullptr) stats = &ignored;
+  *stats = ReconfigurationStats();
+  Hardware *hardware = hw;
+  if (hardware == nullptr) return FactoryErrors::NoHardwareToReconfigure;
+  std::vector<char> buffer(json.begin(), json.end());
+  DynamicJsonDocument doc(estimateCapacity(buffer.data(), buffer.size()));
+  if (deserializeJson(doc, buffer.data(), buffer.size()))
+    return FactoryErrors::FailureToParseJson;
+  JsonObject obj = doc.as<JsonObject>();
+  if (!obj.containsKey("hw")) return FactoryErrors::NoHWKeyFound;
+  if (!obj["hw"].is<JsonObject>()) return FactoryErrors::InvalidHWKeyFound;
+  Child next = {"hw", "hw", obj["hw"]};
+
+  // The running configuration, and its objects in the same order
+  ConfigurationVisitor visitor;
+  hardware->accept(visitor);
+  auto currentJson = visitor.toJson();
+  std::vector<char> currentBuffer(currentJson.begin(), currentJson.end());
+  DynamicJsonDocument currentDoc(
+      estimateCapacity(currentBuffer.data(), currentBuffer.size()));
+  if (deserializeJson(currentDoc, currentBuffer.data(), currentBuffer.size()))
+    return FactoryErrors::FailureToParseJson;
+  Child current = {"hw", "hw", currentDoc["hw"]};
+  TreeVisitor tree;
+  hardware->accept(tree);
+
+  Reconfiguration changes(hardware);
+  FactoryErrors error = FactoryErrors::None;
+  auto construct = [&](const Child &child) -> SHIObject * {
+    auto result = callFactory(child.obj, child.className);
+    error = getError(result);
+    return std::get<0>(result);
+  };
+  // Only constructs a new object if the configuration differs textually
+  auto compare = [&](SHIObject *object, const Child &before,
+                     const Child &after, Reconfiguration::Kind kind,
+                     SensorGroup *group) {
+    if (sameFields(before.obj, after.obj)) {
+      stats->unchanged++;
+      return true;
+    }
+    auto result = constructWithoutChildren(after.className, after.obj);
+    error = getError(result);
+    if (error != FactoryErrors::None) return false;
+    auto replacement = std::get<0>(result);
+    if (sameConfig(object, replacement)) {
+      delete replacement;
+      stats->unchanged++;
+    } else {
+      changes.update(kind, object, replacement, group);
+    }
+    return true;
+  };
+  auto compareSensors = [&](const TreeVisitor::Group &group,
+                            const std::vector<Child> &before,
+                            const std::vector<Child> &after) {
+    auto matches = matchChildren(before, after);
+    std::vector<bool> kept(before.size(), false);
+    for (size_t i = 0; i < after.size(); i++) {
+      if (matches[i] < 0) {
+        auto sensor = construct(after[i]);
+        if (error != FactoryErrors::None) return false;
+        changes.add(group.group, static_cast<Sensor *>(sensor));
+        continue;
+      }
+      kept[matches[i]] = true;
+      auto sensor = group.sensors[matches[i]];
+      int interval = after[i].obj["$interval"] | -1;
+      if (interval != sensor->getSamplingInterval())
+        changes.setInterval(sensor, interval);
+      bool lazy = after[i].obj["$lazySetup"] | false;
+      if (lazy != sensor->isLazySetup()) changes.setLazySetup(sensor, lazy);
+      if (!compare(sensor, before[matches[i]], after[i],
+                   Reconfiguration::Kind::SENSOR, group.group))
+        return false;
+    }
+    for (size_t i = 0; i < before.size(); i++) {
+      if (!kept[i]) changes.remove(group.sensors[i]);
+    }
+    return true;
+  };
+
+  if (!compare(hardware, current, next, Reconfiguration::Kind::HARDWARE,
+               nullptr))
+    return error;
+
+  auto currentComms = getChildren(current.obj, "$comms");
+  auto nextComms = getChildren(next.obj, "$comms");
+  auto commMatches = matchChildren(currentComms, nextComms);
+  std::vector<bool> keptComms(currentComms.size(), false);
+  for (size_t i = 0; i < nextComms.size(); i++) {
+    if (commMatches[i] < 0) {
+      auto communicator = construct(nextComms[i]);
+      if (error != FactoryErrors::None) return error;
+      changes.add(static_cast<Communicator *>(communicator));
+      continue;
+    }
+    keptComms[commMatches[i]] = true;
+    if (!compare(tree.comms[commMatches[i]], currentComms[commMatches[i]],
+                 nextComms[i], Reconfiguration::Kind::COMMUNICATOR, nullptr))
+      return error;
+  }
+  for (size_t i = 0; i < currentComms.size(); i++) {
+    if (!keptComms[i]) changes.remove(tree.comms[i]);
+  }
+
+  // The sensors of the hw and of groups named default are all in the
+  // default group, which is always the first one
+  auto currentGroups = getChildren(current.obj, "$groups");
+  std::vector<Child> nextGroups;
+  auto defaultSensors = getChildren(next.obj, "$sensors");
+  for (auto &&group : getChildren(next.obj, "$groups")) {
+    if (group.key != "default") {
+      nextGroups.push_back(group);
+      continue;
+    }
+    auto sensors = getChildren(group.obj, "$sensors");
+    defaultSensors.insert(defaultSensors.end(), sensors.begin(),
+                          sensors.end());
+  }
+  if (!compareSensors(tree.groups[0],
+                      getChildren(currentGroups[0].obj, "$sensors"),
+                      defaultSensors))
+    return error;
+  auto groupMatches = matchChildren(currentGroups, nextGroups);
+  std::vector<bool> keptGroups(currentGroups.size(), false);
+  for (size_t i = 0; i < nextGroups.size(); i++) {
+    if (groupMatches[i] < 0) {
+      auto group = construct(nextGroups[i]);
+      if (error != FactoryErrors::None) return error;
+      changes.add(static_cast<SensorGroup *>(group));
+      continue;
+    }
+    auto &before = currentGroups[groupMatches[i]];
+    auto &live = tree.groups[groupMatches[i]];
+    keptGroups[groupMatches[i]] = true;
+    if (!compare(live.group, before, nextGroups[i],
+                 Reconfiguration::Kind::GROUP, nullptr) ||
+        !compareSensors(live, getChildren(before.obj, "$sensors"),
+                        getChildren(nextGroups[i].obj, "$sensors")))
+      return error;
+  }
+  for (size_t i = 1; i < currentGroups.size(); i++) {
+    if (!keptGroups[i]) changes.remove(tree.groups[i].group);
+  }
+  changes.apply(stats);
+  return FactoryErrors::None;
+}
+
 bool Factory::registerFactory(const std::string &name,
                               factoryFunction factory) {
-  factories[name] = factory;
+  factories.push_back({factoryHash(name.c_str()), name, nullptr, factory});
+  frozen = false;
+  return true;
+}
+
+bool Factory::registerFactory(const std::string &name,
+                              factoryPointer factory) {
+  factories.push_back({factoryHash(name.c_str()), name, factory, nullptr});
+  frozen = false;
   return true;
 }
 
+void Factory::freeze() {
+  if (frozen) return;
+  std::stable_sort(factories.begin(), factories.end(),
+                   [](const Entry &a, const Entry &b) {
+                     if (a.hash != b.hash) return a.hash < b.hash;
+                     return a.name < b.name;
+                   });
+  // Registering a name again replaces the earlier factory
+  size_t kept = 0;
+  for (size_t i = 0; i < factories.size(); i++) {
+    if (kept != 0 && factories[kept - 1].name == factories[i].name)
+      factories[kept - 1] = std::move(factories[i]);
+    else if (kept++ != i)
+      factories[kept - 1] = std::move(factories[i]);
+  }
+  factories.resize(kept);
+  frozen = true;
+}
+
+const Factory::Entry *Factory::findFactory(const char *name, uint32_t hash) {
+  freeze();
+  auto found = std::lower_bound(
+      factories.begin(), factories.end(), hash,
+      [](const Entry &entry, uint32_t hash) { return entry.hash < hash; });
+  for (; found != factories.end() && found->hash == hash; ++found) {
+    if (found->name == name) return &*found;
+  }
+  return nullptr;
+}
+
 Factory *Factory::instance = nullptr;
 
+SHI::FactoryResult Factory::constructWithoutChildren(const char *className,
+                                                    JsonObjectConst obj) {
+  DynamicJsonDocument copy(JSON_OBJECT_SIZE(obj.size()) + obj.memoryUsage());
+  JsonObject copied = copy.to<JsonObject>();
+  for (auto kv : obj) {
+    if (!isChildrenKey(kv.key().c_str()))
+      copied[kv.key().c_str()].set(kv.value());
+  }
+  // A hardware factory makes the new hardware the current one
+  auto previous = hw;
+  auto result = callFactory(copied, className);
+  hw = previous;
+  return result;
+}
+
 SHI::FactoryResult Factory::callFactory(
-    const ArduinoJson::JsonObject &arguments, const std::string &className) {
-  if (factories.find(className) == factories.end())
+    const ArduinoJson::JsonObject &arguments, const char *className) {
+  auto entry = findFactory(className);
+  if (entry == nullptr)
     return errorToResult(FactoryErrors::MissingRegistryForEntry);
-  auto factory = factories[className];
-  return factory(arguments);
+  auto result = entry->call(arguments);
+  // Lets reconfigure() and ConfigurationVisitor find the factory again
+  if (getError(result) == FactoryErrors::None && std::get<0>(result) != nullptr)
+    std::get<0>(result)->setClassName(entry->name);
+  return result;
 }
 
 SHI::FactoryResult Factory::defaultHardwareFactory(Hardware *hardware,
@@ -158,7 +903,7 @@ SHI::FactoryResult Factory::defaultHardwareFactory(Hardware *hardware,
   JsonArray sensors = obj["$sensors"];
   for (JsonObject sensorObj : sensors) {
     for (auto kv : sensorObj) {
-      std::string className = kv.key().c_str();
+      const char *className = kv.key().c_str();
       JsonObject arguments = kv.value();
       SHI::FactoryResult result = callFactory(arguments, className);
       if (getError(result) != FactoryErrors::None) return errorToResult(result);
@@ -168,7 +913,7 @@ SHI::FactoryResult Factory::defaultHardwareFactory(Hardware *hardware,
   JsonArray sensorGroups = obj["$groups"];
   for (JsonObject sensorGroupObj : sensorGroups) {
     for (auto kv : sensorGroupObj) {
-      std::string className = kv.key().c_str();
+      const char *className = kv.key().c_str();
       JsonObject arguments = kv.value();
       SHI::FactoryResult result = callFactory(arguments, className);
       if (getError(result) != FactoryErrors::None) return errorToResult(result);
@@ -179,7 +924,7 @@ SHI::FactoryResult Factory::defaultHardwareFactory(Hardware *hardware,
   JsonArray comms = obj["$comms"];
   for (JsonObject commObj : comms) {
     for (auto kv : commObj) {
-      std::string className = kv.key().c_str();
+      const char *className = kv.key().c_str();
       JsonObject arguments = kv.value();
       auto result = callFactory(arguments, className);
       if (getError(result) != FactoryErrors::None) return errorToResult(result);
@@ -196,12 +941,16 @@ SHI::FactoryResult Factory::defaultCommunicatorFactory(Communicator *comm,
 }
 
 SHI::FactoryResult Factory::defaultSensorGroupFactory(const JsonObject &obj) {
-  std::string name = obj["name"];
-  auto group = new SensorGroup(name.c_str());
+  return defaultSensorGroupFactory(
+      new SensorGroup(SHI::SensorGroupConfiguration(obj)), obj);
+}
+
+SHI::FactoryResult Factory::defaultSensorGroupFactory(SensorGroup *group,
+                                                      const JsonObject &obj) {
   JsonArray sensors = obj["$sensors"];
   for (JsonObject sensorObj : sensors) {
     for (auto kv : sensorObj) {
-      std::string className = kv.key().c_str();
+      const char *className = kv.key().c_str();
       JsonObject arguments = kv.value();
       auto result = callFactory(arguments, className);
       if (getError(result) != FactoryErrors::None) {
@@ -216,28 +965,104 @@ SHI::FactoryResult Factory::defaultSensorGroupFactory(const JsonObject &obj) {
 
 SHI::FactoryResult Factory::defaultSensorFactory(Sensor *sensor,
                                                  const JsonObject &obj) {
+  if (obj.containsKey("$interval"))
+    sensor->setSamplingInterval(obj["$interval"]);
+  if (obj.containsKey("$lazySetup")) sensor->setLazySetup(obj["$lazySetup"]);
+  return objToResult(sensor);
+}
+
+void Factory::encodeExtras(const Sensor *, const JsonObject &obj,
+                           ConfigEncoder &encoder) {
+  encoder.write(obj.containsKey("$interval"));
+  encoder.write(obj["$interval"] | 0);
+  encoder.write(obj.containsKey("$lazySetup"));
+  encoder.write(obj["$lazySetup"] | false);
+}
+
+namespace {
+
+/// Everything has to be read, otherwise the snapshot is not what the
+/// factory expects
+bool decodedAll(const ConfigDecoder &decoder) {
+  return !decoder.failed() && decoder.atEnd();
+}
+
+}  // namespace
+
+SHI::FactoryResult Factory::decodeExtras(Hardware *hardware,
+                                         ConfigDecoder &decoder) {
+  if (!decodedAll(decoder)) {
+    delete hardware;
+    return errorToResult(FactoryErrors::InvalidSnapshot);
+  }
+  // Like defaultHardwareFactory(), the sensors might need it already
+  hw = hardware;
+  return objToResult(hardware);
+}
+
+SHI::FactoryResult Factory::decodeExtras(SensorGroup *group,
+                                         ConfigDecoder &decoder) {
+  if (!decodedAll(decoder)) {
+    delete group;
+    return errorToResult(FactoryErrors::InvalidSnapshot);
+  }
+  return objToResult(group);
+}
+
+SHI::FactoryResult Factory::decodeExtras(Sensor *sensor,
+                                         ConfigDecoder &decoder) {
+  bool hasInterval = decoder.read<bool>();
+  int interval = decoder.read<int>();
+  bool hasLazySetup = decoder.read<bool>();
+  bool lazySetup = decoder.read<bool>();
+  if (!decodedAll(decoder)) {
+    delete sensor;
+    return errorToResult(FactoryErrors::InvalidSnapshot);
+  }
+  if (hasInterval) sensor->setSamplingInterval(interval);
+  if (hasLazySetup) sensor->setLazySetup(lazySetup);
   return objToResult(sensor);
 }
 
+SHI::FactoryResult Factory::decodeExtras(Communicator *comm,
+                                         ConfigDecoder &decoder) {
+  if (!decodedAll(decoder)) {
+    delete comm;
+    return errorToResult(FactoryErrors::InvalidSnapshot);
+  }
+  return objToResult(comm);
+}
+
 std::string Configuration::toJson() const {
-  DynamicJsonDocument doc(getExpectedCapacity());
-  auto root = doc.as<JsonObject>();
-  fillData(root);
-  char output[2000];
-  serializeJson(doc, output, sizeof(output));
-  return std::string(output);
-}
-
-std::string ConfigurationVisitor::toJson() const {
-  char output[2000];
-  auto node = currentNode->buildTree();
-  serializeJsonPretty(node, output, sizeof(output));
-  return std::string(output);
-}
-
-void Configuration::printJson(std::ostream printer) const {
-  DynamicJsonDocument doc(getExpectedCapacity());
-  auto root = doc.as<JsonObject>();
-  fillData(root);
-  serializeJson(doc, printer);
+  std::ostringstream out;
+  printJson(out);
+  return out.str();
+}
+
+void Configuration::printJson(std::ostream &printer) const {
+  JsonWriter writer(&printer);
+  writer.beginObject();
+  writeJson(writer);
+  writer.endObject();
+}
+
+void Configuration::writeJson(JsonWriter &writer) const {
+  // ArduinoJson drops members silently when the document is full. With less
+  // than STRING_CAPACITY left over a member might not have fit, so fill a
+  // document of twice the size instead.
+  size_t capacity = getExpectedCapacity() + STRING_CAPACITY;
+  while (true) {
+    DynamicJsonDocument doc(capacity);
+    auto root = doc.to<JsonObject>();
+    fillData(root);
+    if (doc.capacity() - doc.memoryUsage() < STRING_CAPACITY) {
+      capacity *= 2;
+      continue;
+    }
+    for (auto kv : root) {
+      writer.key(kv.key().c_str());
+      writer.variant(kv.value());
+    }
+    return;
+  }
 }
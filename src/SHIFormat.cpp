@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include "SHIFormat.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <cmath>
+#include <string>
+
+namespace {
+
+const char DIGIT_PAIRS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+const char UPPER_DIGITS[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+const char LOWER_DIGITS[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+const uint64_t POWERS_OF_TEN[] = {1,      10,      100,      1000,      10000,
+                                  100000, 1000000, 10000000, 100000000,
+                                  1000000000};
+
+/// Writes the digits from the back of a scratch buffer and moves them to
+/// the front of out
+size_t moveDigits(const char *scratch, size_t pos, size_t end, char *out) {
+  size_t length = end - pos;
+  memcpy(out, scratch + pos, length);
+  return length;
+}
+
+size_t formatPowerOfTwo(uint64_t value, int shift, const char *digits,
+                        char *out) {
+  char scratch[SHI::Format::MAX_INTEGER_LENGTH];
+  size_t pos = sizeof(scratch);
+  uint64_t mask = (1u << shift) - 1;
+  do {
+    scratch[--pos] = digits[value & mask];
+    value >>= shift;
+  } while (value != 0);
+  return moveDigits(scratch, pos, sizeof(scratch), out);
+}
+
+/// Writes exactly width digits, with leading zeros
+void formatPadded(uint64_t value, int width, char *out) {
+  while (width >= 2) {
+    const char *pair = DIGIT_PAIRS + (value % 100) * 2;
+    value /= 100;
+    width -= 2;
+    out[width] = pair[0];
+    out[width + 1] = pair[1];
+  }
+  if (width == 1) out[0] = '0' + value % 10;
+}
+
+}  // namespace
+
+size_t SHI::Format::formatUnsigned(uint64_t value, char *out) {
+  char scratch[MAX_INTEGER_LENGTH];
+  size_t pos = sizeof(scratch);
+  // Two digits per division, the division by a constant is a multiplication
+  while (value >= 100) {
+    const char *pair = DIGIT_PAIRS + (value % 100) * 2;
+    value /= 100;
+    scratch[--pos] = pair[1];
+    scratch[--pos] = pair[0];
+  }
+  if (value >= 10) {
+    const char *pair = DIGIT_PAIRS + value * 2;
+    scratch[--pos] = pair[1];
+    scratch[--pos] = pair[0];
+  } else {
+    scratch[--pos] = '0' + value;
+  }
+  return moveDigits(scratch, pos, sizeof(scratch), out);
+}
+
+size_t SHI::Format::formatSigned(int64_t value, char *out) {
+  if (value >= 0) return formatUnsigned(value, out);
+  *out = '-';
+  // Negate in unsigned to handle the smallest value
+  return 1 + formatUnsigned(0 - static_cast<uint64_t>(value), out + 1);
+}
+
+size_t SHI::Format::formatHex(uint64_t value, char *out, bool upperCase) {
+  return formatPowerOfTwo(value, 4, upperCase ? UPPER_DIGITS : LOWER_DIGITS,
+                          out);
+}
+
+size_t SHI::Format::formatBinary(uint64_t value, char *out) {
+  return formatPowerOfTwo(value, 1, UPPER_DIGITS, out);
+}
+
+size_t SHI::Format::formatBase(uint64_t value, int base, char *out) {
+  switch (base) {
+    case 2:
+      return formatPowerOfTwo(value, 1, UPPER_DIGITS, out);
+    case 4:
+      return formatPowerOfTwo(value, 2, UPPER_DIGITS, out);
+    case 8:
+      return formatPowerOfTwo(value, 3, UPPER_DIGITS, out);
+    case 16:
+      return formatPowerOfTwo(value, 4, UPPER_DIGITS, out);
+    case 32:
+      return formatPowerOfTwo(value, 5, UPPER_DIGITS, out);
+    default:
+      break;
+  }
+  if (base < 2 || base > 36 || base == 10) return formatUnsigned(value, out);
+  char scratch[MAX_INTEGER_LENGTH];
+  size_t pos = sizeof(scratch);
+  do {
+    scratch[--pos] = UPPER_DIGITS[value % base];
+    value /= base;
+  } while (value != 0);
+  return moveDigits(scratch, pos, sizeof(scratch), out);
+}
+
+size_t SHI::Format::formatFixed(double value, int precision, char *out) {
+  if (precision < 0 || precision > MAX_FIXED_PRECISION) return 0;
+  size_t length = 0;
+  if (std::signbit(value)) out[length++] = '-';
+  if (std::isnan(value)) {
+    memcpy(out + length, "nan", 3);
+    return length + 3;
+  }
+  double absolute = std::fabs(value);
+  if (std::isinf(value)) {
+    memcpy(out + length, "inf", 3);
+    return length + 3;
+  }
+  if (absolute >= 1e19) return 0;
+  // Both parts are exact, only the scaling of the fraction rounds
+  double integral = std::floor(absolute);
+  double fraction = absolute - integral;
+  uint64_t whole = static_cast<uint64_t>(integral);
+  uint64_t scale = POWERS_OF_TEN[precision];
+  double scaled = fraction * scale;
+  // The exact rounding error of the multiplication decides the ties
+  double error = std::fma(fraction, static_cast<double>(scale), -scaled);
+  uint64_t digits = static_cast<uint64_t>(scaled);
+  double remainder = scaled - digits;
+  // Round half to even like printf does
+  bool odd = (precision > 0 ? digits : whole) & 1;
+  if (remainder > 0.5 ||
+      (remainder == 0.5 && (error > 0 || (error == 0 && odd)))) {
+    digits++;
+  }
+  if (digits == scale) {
+    digits = 0;
+    whole++;
+  }
+  length += formatUnsigned(whole, out + length);
+  if (precision > 0) {
+    out[length++] = '.';
+    formatPadded(digits, precision, out + length);
+    length += precision;
+  }
+  return length;
+}
+
+int SHI::Format::parseFixedPrecision(const char *format) {
+  if (format == nullptr || format[0] != '%') return -1;
+  size_t pos = 1;
+  if (format[pos] == '0') pos++;
+  if (format[pos] != '.') return -1;
+  pos++;
+  int precision = 0;
+  size_t digits = 0;
+  while (format[pos] >= '0' && format[pos] <= '9' && digits < 2) {
+    precision = precision * 10 + (format[pos++] - '0');
+    digits++;
+  }
+  if (digits == 0 || format[pos] != 'f' || format[pos + 1] != 0) return -1;
+  return precision;
+}
+
+std::string SHI::Format::toString(int64_t value) {
+  char buffer[MAX_INTEGER_LENGTH];
+  return std::string(buffer, formatSigned(value, buffer));
+}
+
+std::string SHI::Format::toString(double value, const char *format) {
+  char buffer[MAX_FIXED_LENGTH];
+  int precision = parseFixedPrecision(format);
+  size_t length = precision >= 0 ? formatFixed(value, precision, buffer) : 0;
+  if (length > 0) return std::string(buffer, length);
+  char fallback[64];
+  int written = snprintf(fallback, sizeof(fallback), format, value);
+  if (written < 0) return std::string();
+  if (static_cast<size_t>(written) < sizeof(fallback)) return fallback;
+  std::string result(written + 1, '\0');
+  snprintf(&result[0], result.size(), format, value);
+  result.resize(written);
+  return result;
+}
@@ -7,19 +7,45 @@
 
 #include <string.h>
 
+#include <algorithm>
+
+#include "SHIBus.h"
 #include "SHICommunicator.h"
 #include "SHISensor.h"
 
+using SHI::ArenaAllocator;
+using SHI::ArenaVector;
+using SHI::BufferedPrint;
 using SHI::Communicator;
 using SHI::Hardware;
+using SHI::MeasurementBuffer;
 using SHI::MeasurementDataState;
+using SHI::Scheduler;
 using SHI::Sensor;
+using SHI::SensorGroup;
 using SHI::SHIObject;
 using SHI::Visitor;
 
 namespace {
+
+/// How often the watchdog is fed while sensors are set up in parallel
+const int SETUP_WATCHDOG_INTERVAL = 100;
+
+/// Stands for the bus of all sensors that don't name theirs
+const char UNKNOWN_BUS = 0;
+
+/// Sensors with the same key must not run concurrently, nullptr means the
+/// sensor is independent of all others
+const void *getBusKey(Sensor *sensor) {
+  auto bus = sensor->getBus();
+  if (bus != nullptr) return bus;
+  return sensor->isIndependent() ? nullptr : &UNKNOWN_BUS;
+}
+
 class StatusVisitor : public Visitor {
  public:
+  explicit StatusVisitor(SHI::Arena *arena)
+      : notOk(ArenaAllocator<Problem>(arena)) {}
   bool hasFatalError = false;
   void enterVisit(Sensor *sensor) { publishStatus(sensor); }
   void enterVisit(Hardware *hardware) { publishStatus(hardware); }
@@ -28,28 +54,42 @@ class StatusVisitor : public Visitor {
     auto status = obj->getStatus();
     if (status.getDataState() != MeasurementDataState::NO_DATA) {
       SHI::hw->publishStatus(status, obj);
-      auto statusMsg = status.stringRepresentation;
-      if (statusMsg != SHI::STATUS_OK) {
-        auto isFatal = status.getDataState() == MeasurementDataState::ERROR;
-        if (isFatal) {
-          hasFatalError = true;
-          SHI::hw->logError("StatusVisitor", __func__,
-                            std::string("Object ") + obj->getName() +
-                                " reported error " + statusMsg);
-        } else {
-          SHI::hw->logWarn("StatusVisitor", __func__,
-                           std::string("Object ") + obj->getName() +
-                               " reported warning " + statusMsg);
-        }
+      if (status.stringRepresentation != SHI::STATUS_OK)
+        notOk.push_back({obj, status});
+    }
+  }
+  void logProblems() {
+    for (auto &&problem : notOk) {
+      auto &statusMsg = problem.status.stringRepresentation;
+      auto isFatal =
+          problem.status.getDataState() == MeasurementDataState::ERROR;
+      if (isFatal) {
+        hasFatalError = true;
+        SHI::hw->logError("StatusVisitor", __func__,
+                          std::string("Object ") + problem.obj->getName() +
+                              " reported error " + statusMsg);
+      } else {
+        SHI::hw->logWarn("StatusVisitor", __func__,
+                         std::string("Object ") + problem.obj->getName() +
+                             " reported warning " + statusMsg);
       }
     }
   }
+
+ private:
+  /// The status as it was published
+  struct Problem {
+    SHIObject *obj;
+    SHI::Measurement status;
+  };
+  ArenaVector<Problem> notOk;
 };
 }  // namespace
 
 Hardware::Hardware(const std::string &name) : SHIObject(name) {
   defaultGroup = std::make_shared<SensorGroup>("default");
   sensors.push_back(defaultGroup);
+  readings = std::make_shared<MeasurementBuffer>();
 }
 
 void Hardware::logInfo(const std::string &name, const char *func,
@@ -74,10 +114,12 @@ void Hardware::addSensorGroup(std::shared_ptr<SensorGroup> sensorGroup) {
     sensorGroup->setParent(this);
     sensors.push_back(sensorGroup);
   }
+  scheduler.invalidate();
 }
 
 void Hardware::addSensor(std::shared_ptr<Sensor> sensor) {
   sensors[0]->addSensor(sensor);
+  scheduler.invalidate();
 }
 
 void Hardware::addCommunicator(std::shared_ptr<Communicator> communicator) {
@@ -85,24 +127,154 @@ void Hardware::addCommunicator(std::shared_ptr<Communicator> communicator) {
   communicators.push_back(communicator);
 }
 
+bool Hardware::removeSensor(const Sensor *sensor) {
+  for (auto &&sensorGroup : sensors) {
+    for (auto &&candidate : *sensorGroup->getSensors()) {
+      if (candidate.get() != sensor) continue;
+      forgetSensor(candidate.get());
+      sensorGroup->removeSensor(sensor);
+      scheduler.invalidate();
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Hardware::removeSensorGroup(const SensorGroup *sensorGroup) {
+  if (sensorGroup == defaultGroup.get()) return false;
+  for (auto it = sensors.begin(); it != sensors.end(); ++it) {
+    if (it->get() != sensorGroup) continue;
+    for (auto &&sensor : *(*it)->getSensors()) forgetSensor(sensor.get());
+    sensors.erase(it);
+    scheduler.invalidate();
+    return true;
+  }
+  return false;
+}
+
+void Hardware::addBufferedPrint(BufferedPrint *print) {
+  bufferedPrints.push_back(print);
+}
+
+bool Hardware::removeBufferedPrint(const BufferedPrint *print) {
+  for (auto it = bufferedPrints.begin(); it != bufferedPrints.end(); ++it) {
+    if (*it == print) {
+      bufferedPrints.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Hardware::removeCommunicator(const Communicator *communicator) {
+  for (auto it = communicators.begin(); it != communicators.end(); ++it) {
+    if (it->get() == communicator) {
+      communicators.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
 void Hardware::setupSensors() {
   defaultGroup->setParent(this);
+  setupStart = getEpochInMs();
+  setupTimeline.clear();
+  std::vector<Sensor *> pending;
   for (auto &&sensorGroup : sensors) {
     for (auto &&sensor : *sensorGroup->getSensors()) {
-      auto sensorName = sensor->getQualifiedName();
-      SHI_LOGINFO("Setting up: " + sensorName);
-      if (!sensor->setupSensor()) {
-        SHI_LOGINFO(
-            "Something went wrong when setting up sensor:" + sensorName + " " +
-            sensor->getStatus().stringRepresentation);
-        while (1) {
-          errLeds();
-        }
+      if (sensor->isLazySetup()) {
+        SHI_LOGINFO("Setting up on first read: " +
+                    sensor->getQualifiedName());
+      } else {
+        pending.push_back(sensor.get());
+      }
+    }
+  }
+  std::vector<SetupRecord> records(pending.size());
+  if (pool == nullptr) {
+    for (size_t i = 0; i < pending.size(); i++) {
+      SHI_LOGINFO("Setting up: " + pending[i]->getQualifiedName());
+      setupSensor(pending[i], &records[i]);
+      if (!records[i].success) break;
+      feedWatchdog();
+    }
+  } else {
+    // One task per bus, sensors sharing a bus are set up one after the other
+    std::vector<bool> queued(pending.size(), false);
+    for (size_t i = 0; i < pending.size(); i++) {
+      if (queued[i]) continue;
+      auto bus = getBusKey(pending[i]);
+      std::vector<size_t> task;
+      for (size_t j = i; j < pending.size(); j++) {
+        if (j != i && (bus == nullptr || getBusKey(pending[j]) != bus))
+          continue;
+        task.push_back(j);
+        queued[j] = true;
       }
+      pool->submit([this, task, &pending, &records] {
+        for (auto &&j : task) {
+          setupSensor(pending[j], &records[j]);
+          if (!records[j].success) break;
+        }
+      });
+    }
+    while (!pool->waitFor(SETUP_WATCHDOG_INTERVAL)) {
       feedWatchdog();
-      SHI_LOGINFO("Setup done of: " + sensorName);
     }
   }
+  setupDuration = getEpochInMs() - setupStart;
+  bool failed = false;
+  for (size_t i = 0; i < pending.size(); i++) {
+    auto &record = records[i];
+    // Not attempted after a sensor on the same bus failed
+    if (record.sensor.empty()) continue;
+    setupTimeline.push_back(record);
+    if (!record.success) {
+      SHI_LOGINFO("Something went wrong when setting up sensor:" +
+                  record.sensor + " " +
+                  pending[i]->getStatus().stringRepresentation);
+      failed = true;
+    } else {
+      SHI_LOGINFO("Setup done of: " + record.sensor + " at " +
+                  std::to_string(record.start) + " ms in " +
+                  std::to_string(record.duration) + " ms");
+    }
+  }
+  while (failed) {
+    errLeds();
+  }
+  std::stable_sort(setupTimeline.begin(), setupTimeline.end(),
+                   [](const SetupRecord &a, const SetupRecord &b) {
+                     return a.start + a.duration < b.start + b.duration;
+                   });
+  SHI_LOGINFO("Set up " + std::to_string(setupTimeline.size()) +
+              " sensors in " + std::to_string(setupDuration) + " ms");
+}
+
+void Hardware::setupSensor(Sensor *sensor, SetupRecord *record) {
+  auto start = getEpochInMs();
+  record->sensor = sensor->getQualifiedName();
+  record->success = sensor->runSetup();
+  record->start = start - setupStart;
+  record->duration = getEpochInMs() - start;
+  record->lazy = false;
+}
+
+bool Hardware::setupLazily(Sensor *sensor) {
+  SetupRecord record;
+  setupSensor(sensor, &record);
+  record.lazy = true;
+  setupTimeline.push_back(record);
+  if (!record.success) {
+    SHI_LOGERROR("Something went wrong when setting up sensor:" +
+                 record.sensor + " " +
+                 sensor->getStatus().stringRepresentation);
+    return false;
+  }
+  SHI_LOGINFO("Setup done of: " + record.sensor + " in " +
+              std::to_string(record.duration) + " ms");
+  return true;
 }
 
 void Hardware::setupCommunicators() {
@@ -115,41 +287,215 @@ void Hardware::setupCommunicators() {
 
 void Hardware::internalLoop() {
   static int64_t lastStatusTime = 0;
-  for (auto &&sensorGroup : sensors) {
-    for (auto &&sensor : *sensorGroup->getSensors()) {
-      auto sensorName = sensor->getQualifiedName();
-      logInfo(name, __func__, std::string("Reading sensor:") + sensorName);
-      auto reading = sensor->readSensor();
-      for (auto &&mb : reading) {
-        for (auto &&comm : communicators) {
-          comm->newReading(mb);
-        }
-      }
+  auto passStart = getEpochInMs();
+  collectReadySensors(passStart);
+  scheduler.beginPass(sensors, passStart);
+  ArenaVector<Scheduler::Entry *> due{
+      ArenaAllocator<Scheduler::Entry *>(&loopArena)};
+  Scheduler::Entry *next;
+  while ((next = scheduler.nextDue()) != nullptr) {
+    due.push_back(next);
+  }
+  // Start all conversions first, so that they run while the other sensors
+  // are read
+  for (auto &&entry : due) {
+    auto sensor = entry->sensor;
+    if ((sensor->isLazySetup() && !sensor->isSetUp() &&
+         !setupLazily(sensor)) ||
+        isPending(sensor)) {
+      scheduler.skip(entry, passStart);
+      entry = nullptr;
+      continue;
+    }
+    auto start = getEpochInMs();
+    auto readyAt = entry->sensor->triggerSensor();
+    if (readyAt >= 0) {
+      auto pos = pendingReads.begin();
+      while (pos != pendingReads.end() && pos->readyAt <= readyAt) ++pos;
+      pendingReads.insert(pos, {entry->sensor, readyAt});
+      scheduler.complete(entry, start, getEpochInMs());
+      entry = nullptr;
     }
   }
+  readSensors(&due, passStart);
+  collectReadySensors(getEpochInMs());
   bool hasFatalError = false;
   if (getEpochInMs() - lastStatusTime > 60000) {
     logInfo(name, __func__, "Updating status of all");
     lastStatusTime = getEpochInMs();
-    StatusVisitor visitor;
+    StatusVisitor visitor(&loopArena);
     hw->accept(visitor);
+    visitor.logProblems();
     hasFatalError = visitor.hasFatalError;
   }
 
   for (auto &&comm : communicators) {
     comm->loopCommunication();
   }
+  for (auto &&print : bufferedPrints) {
+    print->poll();
+  }
+  loopArena.reset();
   while (hasFatalError) {
     errLeds();
   }
 }
 
+void Hardware::setSamplingThreads(size_t threads) {
+  if (threads == 0) {
+    pool = nullptr;
+  } else {
+    pool = std::make_shared<ThreadPool>(threads);
+  }
+}
+
+void Hardware::readSensors(ArenaVector<Scheduler::Entry *> *due,
+                           int64_t passStart) {
+  if (pool != nullptr) {
+    readSensorsParallel(due);
+    return;
+  }
+  bool overBudget = false;
+  for (auto &&entry : *due) {
+    if (entry == nullptr) continue;
+    if (overBudget) {
+      scheduler.postpone(entry);
+      continue;
+    }
+    auto start = getEpochInMs();
+    readings->clear();
+    entry->sensor->readSensorInto(*readings);
+    dispatchReadings(*readings);
+    auto end = getEpochInMs();
+    scheduler.complete(entry, start, end);
+    if (loopBudget > 0 && end - passStart >= loopBudget) overBudget = true;
+  }
+}
+
+void Hardware::readSensorsParallel(ArenaVector<Scheduler::Entry *> *due) {
+  struct Read {
+    Scheduler::Entry *entry;
+    MeasurementBuffer *buffer;
+    const void *bus;
+    int64_t start;
+    int64_t end;
+    bool queued;
+  };
+  ArenaVector<Read> reads{ArenaAllocator<Read>(&loopArena)};
+  for (auto &&entry : *due) {
+    if (entry == nullptr) continue;
+    if (reads.size() == parallelReadings.size())
+      parallelReadings.push_back(std::make_shared<MeasurementBuffer>());
+    reads.push_back({entry, parallelReadings[reads.size()].get(),
+                     getBusKey(entry->sensor), 0, 0, false});
+  }
+  // One task per bus, so that sensors sharing a bus are read one after the
+  // other, in the order the scheduler handed them out
+  Read *first = reads.data();
+  size_t count = reads.size();
+  for (size_t i = 0; i < count; i++) {
+    if (reads[i].queued) continue;
+    auto bus = reads[i].bus;
+    pool->submit([this, first, count, i, bus] {
+      for (size_t j = i; j < count; j++) {
+        auto &read = first[j];
+        if (j != i && (bus == nullptr || read.bus != bus)) continue;
+        read.start = getEpochInMs();
+        read.buffer->clear();
+        read.entry->sensor->readSensorInto(*read.buffer);
+        read.end = getEpochInMs();
+        if (bus == nullptr) break;
+      }
+    });
+    reads[i].queued = true;
+    if (bus == nullptr) continue;
+    for (size_t j = i + 1; j < count; j++) {
+      if (reads[j].bus == bus) reads[j].queued = true;
+    }
+  }
+  pool->wait();
+  for (auto &&read : reads) {
+    dispatchReadings(*read.buffer);
+    scheduler.complete(read.entry, read.start, read.end);
+  }
+}
+
+void Hardware::collectReadySensors(int64_t now) {
+  size_t ready = 0;
+  while (ready < pendingReads.size() && pendingReads[ready].readyAt <= now) {
+    readings->clear();
+    pendingReads[ready].sensor->collectSensor(*readings);
+    dispatchReadings(*readings);
+    ready++;
+  }
+  pendingReads.erase(pendingReads.begin(), pendingReads.begin() + ready);
+}
+
+bool Hardware::isPending(const Sensor *sensor) const {
+  for (auto &&pending : pendingReads) {
+    if (pending.sensor == sensor) return true;
+  }
+  return false;
+}
+
+void Hardware::forgetSensor(Sensor *sensor) {
+  auto bus = sensor->getBus();
+  if (bus != nullptr) bus->getArbiter()->unregisterDevice(sensor);
+  pendingReads.erase(
+      std::remove_if(pendingReads.begin(), pendingReads.end(),
+                     [sensor](const PendingRead &pending) {
+                       return pending.sensor == sensor;
+                     }),
+      pendingReads.end());
+}
+
+int64_t Hardware::getNextEventTime() const {
+  auto next = scheduler.getNextDeadline();
+  if (!pendingReads.empty() &&
+      (next < 0 || pendingReads.front().readyAt < next))
+    next = pendingReads.front().readyAt;
+  return next;
+}
+
+void Hardware::dispatchReadings(const MeasurementBuffer &buffer) {
+  // Legacy and columnar bundles are handed on in the order they were added
+  auto &legacyBundles = buffer.getLegacyBundles();
+  size_t legacy = 0;
+  for (size_t i = 0; i <= buffer.size(); i++) {
+    for (; legacy < legacyBundles.size() &&
+           buffer.getLegacyPosition(legacy) == i;
+         legacy++) {
+      for (auto &&comm : communicators) {
+        comm->newReading(legacyBundles[legacy]);
+      }
+    }
+    if (i == buffer.size()) break;
+    for (auto &&comm : communicators) {
+      comm->newCompactReading(buffer[i]);
+    }
+  }
+}
+
 void Hardware::publishStatus(const Measurement &status, SHIObject *src) {
   for (auto &&comm : communicators) {
     comm->newStatus(status, src);
   }
 }
 
+std::vector<std::pair<std::string, std::string>> Hardware::getStatistics() {
+  auto result = loopArena.getStatistics();
+  result.push_back({"setupTime", std::to_string(setupDuration)});
+  for (auto &&stat : scheduler.getStatistics()) {
+    result.push_back(stat);
+  }
+  if (pool != nullptr) {
+    for (auto &&stat : pool->getStatistics()) {
+      result.push_back(stat);
+    }
+  }
+  return result;
+}
+
 void Hardware::accept(Visitor &visitor) {
   visitor.enterVisit(this);
   status->accept(visitor);
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include "SHII2CQueue.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+using SHI::I2CBuffer;
+using SHI::I2CBus;
+using SHI::I2CError;
+using SHI::I2CMutableBuffer;
+using SHI::I2CTransactionQueue;
+
+void I2CTransactionQueue::add(uint16_t address,
+                              std::initializer_list<I2CBuffer> writes,
+                              std::initializer_list<I2CMutableBuffer> reads,
+                              Callback callback) {
+  Operation operation = {address, staging.size(), 0, readSegments.size(),
+                         0,       0,              0, std::move(callback)};
+  for (auto &&segment : writes) {
+    staging.insert(staging.end(), segment.data, segment.data + segment.size);
+    operation.writeSize += segment.size;
+  }
+  for (auto &&segment : reads) {
+    readSegments.push_back(segment);
+    operation.readSegmentCount++;
+    operation.readSize += segment.size;
+  }
+  operations.push_back(std::move(operation));
+}
+
+void I2CTransactionQueue::write(uint16_t address,
+                                std::initializer_list<I2CBuffer> segments,
+                                Callback callback) {
+  add(address, segments, {}, std::move(callback));
+}
+
+void I2CTransactionQueue::write(uint16_t address, const uint8_t *data,
+                                size_t size, Callback callback) {
+  add(address, {{data, size}}, {}, std::move(callback));
+}
+
+void I2CTransactionQueue::read(uint16_t address,
+                               std::initializer_list<I2CMutableBuffer> segments,
+                               Callback callback) {
+  add(address, {}, segments, std::move(callback));
+}
+
+void I2CTransactionQueue::read(uint16_t address, uint8_t *buffer, size_t size,
+                               Callback callback) {
+  add(address, {}, {{buffer, size}}, std::move(callback));
+}
+
+void I2CTransactionQueue::writeRead(uint16_t address, const uint8_t *data,
+                                    size_t writeSize, uint8_t *buffer,
+                                    size_t readSize, Callback callback) {
+  add(address, {{data, writeSize}}, {{buffer, readSize}}, std::move(callback));
+}
+
+void I2CTransactionQueue::readRegister(uint16_t address, uint8_t reg,
+                                       uint8_t *buffer, size_t size,
+                                       Callback callback) {
+  add(address, {{&reg, 1}}, {{buffer, size}}, std::move(callback));
+}
+
+I2CError I2CTransactionQueue::run(I2CBus *bus, Operation *operation) {
+  operation->received = 0;
+  // The bus takes 16 bit lengths
+  if (operation->writeSize > MAX_TRANSFER_SIZE ||
+      operation->readSize > MAX_TRANSFER_SIZE)
+    return I2CError::I2C_ERROR_MEMORY;
+  bool hasRead = operation->readSize > 0;
+  if (operation->writeSize > 0) {
+    auto result = bus->writeTransmission(
+        operation->address, staging.data() + operation->writeOffset,
+        operation->writeSize, !hasRead);
+    if (result != I2CError::I2C_ERROR_OK) return result;
+  }
+  if (!hasRead) return I2CError::I2C_ERROR_OK;
+  uint32_t readCount = operation->readSize;
+  auto first = readSegments[operation->readOffset];
+  if (operation->readSegmentCount == 1) {
+    auto result = bus->readTransmission(operation->address, first.data,
+                                        operation->readSize, true, &readCount);
+    operation->received = readCount;
+    return result;
+  }
+  if (scatter.size() < operation->readSize)
+    scatter.resize(operation->readSize);
+  auto result = bus->readTransmission(operation->address, scatter.data(),
+                                      operation->readSize, true, &readCount);
+  operation->received = readCount;
+  size_t offset = 0;
+  for (size_t i = 0; i < operation->readSegmentCount && offset < readCount;
+       i++) {
+    auto &segment = readSegments[operation->readOffset + i];
+    auto size = std::min(segment.size, readCount - offset);
+    memcpy(segment.data, scatter.data() + offset, size);
+    offset += size;
+  }
+  return result;
+}
+
+I2CError I2CTransactionQueue::execute(I2CBus *bus, const SHIObject *device) {
+  auto firstError = I2CError::I2C_ERROR_OK;
+  BusTransaction transaction(bus, device);
+  for (auto &&operation : operations) {
+    auto result = run(bus, &operation);
+    if (operation.callback) operation.callback(result);
+    if (firstError == I2CError::I2C_ERROR_OK) firstError = result;
+  }
+  return firstError;
+}
+
+void I2CTransactionQueue::clear() {
+  operations.clear();
+  staging.clear();
+  readSegments.clear();
+}
+
+void I2CBus::submit(I2CTransactionQueue *queue, const SHIObject *device,
+                    std::function<void(I2CError)> done) {
+  std::lock_guard<std::mutex> lock(submittedMutex);
+  submitted.push_back({queue, device, std::move(done)});
+}
+
+size_t I2CBus::processSubmitted() {
+  {
+    std::lock_guard<std::mutex> lock(submittedMutex);
+    processing.swap(submitted);
+  }
+  auto count = processing.size();
+  if (count == 0) return 0;
+  // The queues take the bus again, which only counts up for this thread.
+  // The bus is handed over, so that every device is charged for its time.
+  BusTransaction transaction(this, processing.front().device);
+  for (auto &&submission : processing) {
+    getArbiter()->handOver(submission.device);
+    auto result = submission.queue->execute(this, submission.device);
+    if (submission.done) submission.done(result);
+  }
+  processing.clear();
+  return count;
+}
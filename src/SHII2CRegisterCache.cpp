@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include "SHII2CRegisterCache.h"
+
+#include <string.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+using SHI::I2CError;
+using SHI::I2CRegisterCache;
+
+void I2CRegisterCache::declareNonVolatile(uint8_t reg, uint16_t count) {
+  for (uint16_t i = reg; i < reg + count && i < nonVolatile.size(); i++) {
+    nonVolatile.set(i);
+  }
+}
+
+void I2CRegisterCache::declareVolatile(uint8_t reg, uint16_t count) {
+  for (uint16_t i = reg; i < reg + count && i < nonVolatile.size(); i++) {
+    nonVolatile.reset(i);
+    valid.reset(i);
+  }
+}
+
+void I2CRegisterCache::invalidate(uint8_t reg, uint16_t count) {
+  for (uint16_t i = reg; i < reg + count && i < valid.size(); i++) {
+    valid.reset(i);
+  }
+}
+
+bool I2CRegisterCache::isCached(uint8_t reg, uint8_t size) const {
+  for (uint16_t i = reg; i < reg + size; i++) {
+    if (i >= valid.size() || !valid.test(i)) return false;
+  }
+  return true;
+}
+
+void I2CRegisterCache::store(uint8_t reg, const uint8_t *data, uint8_t size) {
+  for (uint16_t i = 0; i < size && reg + i < valid.size(); i++) {
+    if (!nonVolatile.test(reg + i)) continue;
+    values[reg + i] = data[i];
+    valid.set(reg + i);
+  }
+}
+
+I2CError I2CRegisterCache::failed(I2CError error) {
+  errors++;
+  invalidate();
+  return error;
+}
+
+I2CError I2CRegisterCache::read(uint8_t reg, uint8_t *buffer, uint8_t size) {
+  bool cacheable = nonVolatile.test(reg);
+  if (cacheable && isCached(reg, size)) {
+    hits++;
+    memcpy(buffer, values + reg, size);
+    return I2CError::I2C_ERROR_OK;
+  }
+  if (cacheable)
+    misses++;
+  else
+    volatileReads++;
+  BusTransaction transaction(bus, device);
+  auto result = bus->writeTransmission(address, &reg, 1, false);
+  if (result != I2CError::I2C_ERROR_OK) return failed(result);
+  // Buses that don't report the count are trusted to read everything
+  uint32_t count = size;
+  result = bus->readTransmission(address, buffer, size, true, &count);
+  if (result != I2CError::I2C_ERROR_OK) return failed(result);
+  if (count != size) return failed(I2CError::I2C_ERROR_BUS);
+  store(reg, buffer, size);
+  return result;
+}
+
+I2CError I2CRegisterCache::write(uint8_t reg, const uint8_t *data,
+                                 uint8_t size) {
+  uint8_t frame[1 + 255];
+  frame[0] = reg;
+  memcpy(frame + 1, data, size);
+  writes++;
+  BusTransaction transaction(bus, device);
+  auto result = bus->writeTransmission(address, frame, 1 + size);
+  if (result != I2CError::I2C_ERROR_OK) return failed(result);
+  store(reg, data, size);
+  return result;
+}
+
+I2CError I2CRegisterCache::update(uint8_t reg, uint8_t mask, uint8_t value) {
+  uint8_t current;
+  auto result = read(reg, &current, 1);
+  if (result != I2CError::I2C_ERROR_OK) return result;
+  uint8_t updated = (current & ~mask) | (value & mask);
+  if (updated == current && nonVolatile.test(reg)) return result;
+  return write(reg, &updated, 1);
+}
+
+std::vector<std::pair<std::string, std::string>>
+I2CRegisterCache::getStatistics() const {
+  uint64_t lookups = hits + misses;
+  uint64_t hitRate = lookups == 0 ? 0 : hits * uint64_t{100} / lookups;
+  return {{"registerCacheHits", std::to_string(hits)},
+          {"registerCacheMisses", std::to_string(misses)},
+          {"registerCacheHitRate", std::to_string(hitRate) + "%"},
+          {"registerVolatileReads", std::to_string(volatileReads)},
+          {"registerWrites", std::to_string(writes)},
+          {"registerErrors", std::to_string(errors)}};
+}
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include "SHIJsonWriter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmath>
+#include <string>
+
+#include "SHIFormat.h"
+
+using SHI::JsonWriter;
+
+namespace {
+
+const char HEX_DIGITS[] = "0123456789abcdef";
+
+/// The escape sequence for c, or nullptr if it can be written as is
+const char *shortEscape(char c) {
+  switch (c) {
+    case '"':
+      return "\\\"";
+    case '\\':
+      return "\\\\";
+    case '\b':
+      return "\\b";
+    case '\f':
+      return "\\f";
+    case '\n':
+      return "\\n";
+    case '\r':
+      return "\\r";
+    case '\t':
+      return "\\t";
+    default:
+      return nullptr;
+  }
+}
+
+}  // namespace
+
+void JsonWriter::beginObject() {
+  beginValue();
+  out->put('{');
+  hasMembers.push_back(false);
+}
+
+void JsonWriter::endObject() { endContainer('}'); }
+
+void JsonWriter::beginArray() {
+  beginValue();
+  out->put('[');
+  hasMembers.push_back(false);
+}
+
+void JsonWriter::endArray() { endContainer(']'); }
+
+void JsonWriter::key(const char *name) {
+  beginValue();
+  writeString(name);
+  if (pretty)
+    out->write(": ", 2);
+  else
+    out->put(':');
+  afterKey = true;
+}
+
+void JsonWriter::value(const char *text) {
+  if (text == nullptr) {
+    null();
+    return;
+  }
+  beginValue();
+  writeString(text);
+}
+
+void JsonWriter::value(bool flag) {
+  beginValue();
+  if (flag)
+    out->write("true", 4);
+  else
+    out->write("false", 5);
+}
+
+void JsonWriter::value(double number) {
+  if (!std::isfinite(number)) {
+    null();
+    return;
+  }
+  beginValue();
+  // Sensor values usually read back with a few decimals, the fewest that do
+  // are used. Very small, very large or very precise numbers need printf.
+  char buffer[Format::MAX_FIXED_LENGTH + 1];
+  for (int precision = 0; precision <= Format::MAX_FIXED_PRECISION;
+       precision++) {
+    size_t length = Format::formatFixed(number, precision, buffer);
+    if (length == 0) break;
+    buffer[length] = 0;
+    if (strtod(buffer, nullptr) == number) {
+      out->write(buffer, length);
+      return;
+    }
+  }
+  int length = snprintf(buffer, sizeof(buffer), "%.15g", number);
+  if (strtod(buffer, nullptr) != number)
+    length = snprintf(buffer, sizeof(buffer), "%.17g", number);
+  out->write(buffer, length);
+}
+
+void JsonWriter::null() {
+  beginValue();
+  out->write("null", 4);
+}
+
+void JsonWriter::variant(JsonVariantConst value) {
+  if (value.is<JsonObject>()) {
+    beginObject();
+    for (auto kv : value.as<JsonObjectConst>()) {
+      key(kv.key().c_str());
+      variant(kv.value());
+    }
+    endObject();
+  } else if (value.is<JsonArray>()) {
+    beginArray();
+    for (auto element : value.as<JsonArrayConst>()) variant(element);
+    endArray();
+  } else if (value.is<bool>()) {
+    this->value(value.as<bool>());
+  } else if (value.is<JsonUInt>()) {
+    writeUnsigned(value.as<JsonUInt>());
+  } else if (value.is<JsonInteger>()) {
+    writeSigned(value.as<JsonInteger>());
+  } else if (value.is<JsonFloat>()) {
+    this->value(static_cast<double>(value.as<JsonFloat>()));
+  } else if (value.is<const char *>()) {
+    this->value(value.as<const char *>());
+  } else {
+    null();
+  }
+}
+
+void JsonWriter::beginValue() {
+  if (afterKey) {
+    afterKey = false;
+    return;
+  }
+  if (hasMembers.empty()) return;
+  if (hasMembers.back()) out->put(',');
+  hasMembers.back() = true;
+  newLine();
+}
+
+void JsonWriter::writeSigned(int64_t number) {
+  beginValue();
+  char buffer[SHI::Format::MAX_INTEGER_LENGTH];
+  out->write(buffer, SHI::Format::formatSigned(number, buffer));
+}
+
+void JsonWriter::writeUnsigned(uint64_t number) {
+  beginValue();
+  char buffer[SHI::Format::MAX_INTEGER_LENGTH];
+  out->write(buffer, SHI::Format::formatUnsigned(number, buffer));
+}
+
+void JsonWriter::writeString(const char *text) {
+  out->put('"');
+  const char *run = text;
+  for (const char *c = text; *c != '\0'; c++) {
+    auto escape = shortEscape(*c);
+    bool control = static_cast<unsigned char>(*c) < 0x20;
+    if (escape == nullptr && !control) continue;
+    out->write(run, c - run);
+    run = c + 1;
+    if (escape != nullptr) {
+      out->write(escape, 2);
+    } else {
+      char unicode[] = {'\\', 'u', '0', '0', HEX_DIGITS[(*c >> 4) & 0xF],
+                        HEX_DIGITS[*c & 0xF]};
+      out->write(unicode, sizeof(unicode));
+    }
+  }
+  out->write(run, strlen(run));
+  out->put('"');
+}
+
+void JsonWriter::endContainer(char bracket) {
+  if (hasMembers.empty()) return;
+  bool hadMembers = hasMembers.back();
+  hasMembers.pop_back();
+  if (hadMembers) newLine();
+  out->put(bracket);
+}
+
+void JsonWriter::newLine() {
+  if (!pretty) return;
+  out->put('\n');
+  for (size_t i = 0; i < hasMembers.size(); i++) out->write("  ", 2);
+}
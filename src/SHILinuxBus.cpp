@@ -0,0 +1,585 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#if defined(__linux__)
+
+#include "SHILinuxBus.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+#include <linux/spi/spidev.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "SHIHardware.h"
+
+using SHI::I2CError;
+using SHI::LinuxI2CBus;
+using SHI::LinuxI2CBusConfiguration;
+using SHI::LinuxSerialBus;
+using SHI::LinuxSerialBusConfiguration;
+using SHI::LinuxSPIBus;
+using SHI::LinuxSPIBusConfiguration;
+using SHI::SPITransfer;
+using SHI::SPITransferHandle;
+
+namespace {
+// The default buffer size of the spidev driver
+const uint32_t SPIDEV_MAX_TRANSFER = 4096;
+// The size of the tty layer's transmit buffer
+const int SERIAL_TX_BUFFER = 4096;
+
+speed_t toSpeed(int baudRate) {
+  switch (baudRate) {
+    case 1200:
+      return B1200;
+    case 2400:
+      return B2400;
+    case 4800:
+      return B4800;
+    case 9600:
+      return B9600;
+    case 19200:
+      return B19200;
+    case 38400:
+      return B38400;
+    case 57600:
+      return B57600;
+    case 115200:
+      return B115200;
+    case 230400:
+      return B230400;
+    case 460800:
+      return B460800;
+    case 921600:
+      return B921600;
+    default:
+      return B0;
+  }
+}
+
+tcflag_t toCharacterSize(int dataBits) {
+  switch (dataBits) {
+    case 5:
+      return CS5;
+    case 6:
+      return CS6;
+    case 7:
+      return CS7;
+    default:
+      return CS8;
+  }
+}
+
+I2CError toI2CError(int error) {
+  switch (error) {
+    case ENXIO:
+    case EREMOTEIO:
+      return I2CError::I2C_ERROR_ACK;
+    case ETIMEDOUT:
+      return I2CError::I2C_ERROR_TIMEOUT;
+    case EBUSY:
+    case EAGAIN:
+      return I2CError::I2C_ERROR_BUSY;
+    case ENOMEM:
+      return I2CError::I2C_ERROR_MEMORY;
+    default:
+      return I2CError::I2C_ERROR_BUS;
+  }
+}
+
+}  // namespace
+
+LinuxSerialBus::~LinuxSerialBus() { stop(); }
+
+void LinuxSerialBus::begin(Configuration *newConfig) {
+  if (newConfig != nullptr)
+    config.store(*static_cast<LinuxSerialBusConfiguration *>(newConfig));
+  if (fd >= 0) stop();
+  rxHead = rxTail = 0;
+  fd = open(config->device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    statusMessage = "Failed to open " + config->device;
+    SHI_LOGERROR(statusMessage + ": " + strerror(errno));
+    return;
+  }
+  struct termios options;
+  speed_t speed = toSpeed(config->baudRate);
+  if (speed == B0) {
+    statusMessage = "Unsupported baud rate " + std::to_string(config->baudRate);
+    SHI_LOGERROR(statusMessage);
+    stop();
+    return;
+  }
+  if (tcgetattr(fd, &options) < 0) {
+    statusMessage = "Failed to read settings of " + config->device;
+    SHI_LOGERROR(statusMessage + ": " + strerror(errno));
+    stop();
+    return;
+  }
+  cfmakeraw(&options);
+  cfsetispeed(&options, speed);
+  cfsetospeed(&options, speed);
+  options.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB);
+  options.c_cflag |= CLOCAL | CREAD | toCharacterSize(config->dataBits);
+  if (config->parity == "E") options.c_cflag |= PARENB;
+  if (config->parity == "O") options.c_cflag |= PARENB | PARODD;
+  if (config->stopBits == 2) options.c_cflag |= CSTOPB;
+  // Reads return immediately, waiting is done with epoll
+  options.c_cc[VMIN] = 0;
+  options.c_cc[VTIME] = 0;
+  if (tcsetattr(fd, TCSANOW, &options) < 0) {
+    statusMessage = "Failed to configure " + config->device;
+    SHI_LOGERROR(statusMessage + ": " + strerror(errno));
+    stop();
+    return;
+  }
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  if (epollFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+    statusMessage = std::string("Failed to set up epoll: ") + strerror(errno);
+    SHI_LOGERROR(statusMessage);
+    stop();
+    return;
+  }
+  statusMessage = STATUS_OK;
+}
+
+void LinuxSerialBus::stop() {
+  if (epollFd >= 0) {
+    close(epollFd);
+    epollFd = -1;
+  }
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+bool LinuxSerialBus::reconfigure(Configuration *newConfig) {
+  config.store(castConfig<LinuxSerialBusConfiguration>(newConfig));
+  if (fd >= 0) begin(nullptr);
+  return true;
+}
+
+bool LinuxSerialBus::waitFor(uint32_t events, int timeoutMs) {
+  if (epollFd < 0) return false;
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.fd = fd;
+  if (events != EPOLLIN) epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+  int ready;
+  do {
+    ready = epoll_wait(epollFd, &event, 1, timeoutMs);
+  } while (ready < 0 && errno == EINTR);
+  if (events != EPOLLIN) {
+    event.events = EPOLLIN;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+  }
+  return ready > 0;
+}
+
+bool LinuxSerialBus::waitForData(int timeoutMs) {
+  if (rxTail > rxHead || fill() > 0) return true;
+  return waitFor(EPOLLIN, timeoutMs) && fill() > 0;
+}
+
+size_t LinuxSerialBus::fill() {
+  if (fd < 0) return 0;
+  if (rxHead == rxTail) rxHead = rxTail = 0;
+  if (rxTail == rxBuffer.size() && rxHead > 0) {
+    memmove(rxBuffer.data(), rxBuffer.data() + rxHead, rxTail - rxHead);
+    rxTail -= rxHead;
+    rxHead = 0;
+  }
+  size_t received = 0;
+  while (rxTail < rxBuffer.size()) {
+    ssize_t result =
+        ::read(fd, rxBuffer.data() + rxTail, rxBuffer.size() - rxTail);
+    if (result < 0 && errno == EINTR) continue;
+    if (result <= 0) break;
+    rxTail += result;
+    received += result;
+  }
+  return received;
+}
+
+int LinuxSerialBus::available(void) {
+  fill();
+  return rxTail - rxHead;
+}
+
+int LinuxSerialBus::availableForWrite(void) {
+  if (fd < 0) return 0;
+  int queued = 0;
+  if (ioctl(fd, TIOCOUTQ, &queued) < 0) return 0;
+  int space = SERIAL_TX_BUFFER - queued;
+  return space > 0 ? space : 0;
+}
+
+int LinuxSerialBus::peek(void) {
+  if (rxHead == rxTail && fill() == 0) return -1;
+  return rxBuffer[rxHead];
+}
+
+int LinuxSerialBus::read(void) {
+  if (rxHead == rxTail && fill() == 0) return -1;
+  return rxBuffer[rxHead++];
+}
+
+size_t LinuxSerialBus::read(uint8_t *buffer, size_t size) {
+  size_t buffered = rxTail - rxHead;
+  if (buffered > size) buffered = size;
+  memcpy(buffer, rxBuffer.data() + rxHead, buffered);
+  rxHead += buffered;
+  size_t total = buffered;
+  // Read the rest straight into the caller's buffer
+  while (total < size && fd >= 0) {
+    ssize_t result = ::read(fd, buffer + total, size - total);
+    if (result < 0 && errno == EINTR) continue;
+    if (result <= 0) break;
+    total += result;
+  }
+  return total;
+}
+
+void LinuxSerialBus::flush(bool txOnly) {
+  if (fd < 0) return;
+  tcdrain(fd);
+  if (!txOnly) {
+    tcflush(fd, TCIFLUSH);
+    rxHead = rxTail = 0;
+  }
+}
+
+size_t LinuxSerialBus::write(uint8_t data) { return write(&data, 1); }
+
+size_t LinuxSerialBus::write(const uint8_t *buffer, size_t size) {
+  size_t total = 0;
+  while (total < size && fd >= 0) {
+    ssize_t result = ::write(fd, buffer + total, size - total);
+    if (result > 0) {
+      total += result;
+    } else if (result < 0 && errno == EINTR) {
+      continue;
+    } else if (result < 0 && errno == EAGAIN) {
+      if (!waitFor(EPOLLOUT, config->writeTimeout)) break;
+    } else {
+      break;
+    }
+  }
+  if (total < size) setWriteError();
+  return total;
+}
+
+LinuxI2CBus::~LinuxI2CBus() { stop(); }
+
+void LinuxI2CBus::begin(Configuration *newConfig) {
+  if (newConfig != nullptr)
+    config.store(*static_cast<LinuxI2CBusConfiguration *>(newConfig));
+  if (fd >= 0) stop();
+  fd = open(config->device.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    statusMessage = "Failed to open " + config->device;
+    SHI_LOGERROR(statusMessage + ": " + strerror(errno));
+    error = I2CError::I2C_ERROR_NO_BEGIN;
+    return;
+  }
+  unsigned long functions = 0;  // NOLINT
+  if (ioctl(fd, I2C_FUNCS, &functions) < 0 || !(functions & I2C_FUNC_I2C)) {
+    statusMessage = config->device + " does not support plain I2C transfers";
+    SHI_LOGERROR(statusMessage);
+    stop();
+    error = I2CError::I2C_ERROR_NO_BEGIN;
+    return;
+  }
+  error = I2CError::I2C_ERROR_OK;
+  statusMessage = STATUS_OK;
+}
+
+void LinuxI2CBus::stop() {
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+  hasPendingWrite = false;
+}
+
+bool LinuxI2CBus::reconfigure(Configuration *newConfig) {
+  config.store(castConfig<LinuxI2CBusConfiguration>(newConfig));
+  if (fd >= 0) begin(nullptr);
+  return true;
+}
+
+I2CError LinuxI2CBus::transfer(uint16_t address, uint8_t *readBuffer,
+                               uint16_t readSize) {
+  if (fd < 0) return error = I2CError::I2C_ERROR_NO_BEGIN;
+  struct i2c_msg messages[2];
+  int count = 0;
+  if (hasPendingWrite) {
+    messages[count].addr = pendingAddress;
+    messages[count].flags = pendingAddress > 0x7F ? I2C_M_TEN : 0;
+    messages[count].len = pendingWrite.size();
+    messages[count].buf = pendingWrite.data();
+    count++;
+  }
+  if (readBuffer != nullptr) {
+    messages[count].addr = address;
+    messages[count].flags = I2C_M_RD | (address > 0x7F ? I2C_M_TEN : 0);
+    messages[count].len = readSize;
+    messages[count].buf = readBuffer;
+    count++;
+  }
+  hasPendingWrite = false;
+  if (count == 0) return error = I2CError::I2C_ERROR_OK;
+  struct i2c_rdwr_ioctl_data data = {messages, static_cast<__u32>(count)};
+  if (ioctl(fd, I2C_RDWR, &data) < 0) return error = toI2CError(errno);
+  return error = I2CError::I2C_ERROR_OK;
+}
+
+I2CError LinuxI2CBus::writeTransmission(uint16_t address, uint8_t *buff,
+                                        uint16_t size, bool sendStop) {
+  // A pending write of another operation is sent on its own first
+  if (hasPendingWrite) {
+    auto result = transfer(pendingAddress, nullptr, 0);
+    if (result != I2CError::I2C_ERROR_OK) return result;
+  }
+  pendingWrite.assign(buff, buff + size);
+  pendingAddress = address;
+  hasPendingWrite = true;
+  if (!sendStop) return error = I2CError::I2C_ERROR_OK;
+  return transfer(address, nullptr, 0);
+}
+
+I2CError LinuxI2CBus::readTransmission(uint16_t address, uint8_t *buff,
+                                       uint16_t size, bool sendStop,
+                                       uint32_t *readCount) {
+  // The I2C_RDWR call ends with a stop, a repeated start after a read would
+  // need the read to be deferred until the next message
+  auto result = transfer(address, buff, size);
+  if (readCount != nullptr)
+    *readCount = result == I2CError::I2C_ERROR_OK ? size : 0;
+  return result;
+}
+
+LinuxSPIBus::~LinuxSPIBus() { stop(); }
+
+void LinuxSPIBus::begin(Configuration *newConfig) {
+  if (newConfig != nullptr)
+    config.store(*static_cast<LinuxSPIBusConfiguration *>(newConfig));
+  if (fd >= 0) stop();
+  fd = open(config->device.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    statusMessage = "Failed to open " + config->device;
+    SHI_LOGERROR(statusMessage + ": " + strerror(errno));
+    return;
+  }
+  uint8_t mode = config->mode;
+  uint8_t bits = config->bitsPerWord;
+  uint32_t speed = config->speed;
+  if (ioctl(fd, SPI_IOC_WR_MODE, &mode) < 0 ||
+      ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
+      ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) < 0) {
+    statusMessage = "Failed to configure " + config->device;
+    SHI_LOGERROR(statusMessage + ": " + strerror(errno));
+    stop();
+    return;
+  }
+  statusMessage = STATUS_OK;
+}
+
+void LinuxSPIBus::stop() {
+  stopWorker();
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+bool LinuxSPIBus::reconfigure(Configuration *newConfig) {
+  config.store(castConfig<LinuxSPIBusConfiguration>(newConfig));
+  if (fd >= 0) begin(nullptr);
+  return true;
+}
+
+bool LinuxSPIBus::transferRaw(const uint8_t *tx, uint8_t *rx, uint32_t size,
+                              uint32_t speed, std::string *error) {
+  if (fd < 0) {
+    *error = "Not open";
+    return false;
+  }
+  // The worker thread transfers too, so it reads its own snapshot
+  auto current = config.load();
+  while (size > 0) {
+    uint32_t chunk = size < SPIDEV_MAX_TRANSFER ? size : SPIDEV_MAX_TRANSFER;
+    struct spi_ioc_transfer message;
+    memset(&message, 0, sizeof(message));
+    message.tx_buf = reinterpret_cast<uintptr_t>(tx);
+    message.rx_buf = reinterpret_cast<uintptr_t>(rx);
+    message.len = chunk;
+    message.speed_hz = speed;
+    message.bits_per_word = current->bitsPerWord;
+    if (ioctl(fd, SPI_IOC_MESSAGE(1), &message) < 0) {
+      *error = std::string("Transfer failed: ") + strerror(errno);
+      return false;
+    }
+    if (tx != nullptr) tx += chunk;
+    if (rx != nullptr) rx += chunk;
+    size -= chunk;
+  }
+  return true;
+}
+
+void LinuxSPIBus::beginTransaction(Configuration *settings) {
+  if (settings != nullptr)
+    transactionSpeed =
+        static_cast<LinuxSPIBusConfiguration *>(settings)->speed;
+}
+
+void LinuxSPIBus::endTransaction(void) { transactionSpeed = 0; }
+
+void LinuxSPIBus::transfer(uint8_t *data, uint32_t size) {
+  transferRaw(data, data, size);
+}
+
+uint8_t LinuxSPIBus::transfer(uint8_t data) {
+  uint8_t result = 0;
+  transferRaw(&data, &result, 1);
+  return result;
+}
+
+uint16_t LinuxSPIBus::transfer16(uint16_t data) {
+  uint8_t buffer[2] = {static_cast<uint8_t>(data >> 8),
+                       static_cast<uint8_t>(data)};
+  transferRaw(buffer, buffer, sizeof(buffer));
+  return buffer[0] << 8 | buffer[1];
+}
+
+uint32_t LinuxSPIBus::transfer32(uint32_t data) {
+  uint8_t buffer[4] = {
+      static_cast<uint8_t>(data >> 24), static_cast<uint8_t>(data >> 16),
+      static_cast<uint8_t>(data >> 8), static_cast<uint8_t>(data)};
+  transferRaw(buffer, buffer, sizeof(buffer));
+  return static_cast<uint32_t>(buffer[0]) << 24 |
+         static_cast<uint32_t>(buffer[1]) << 16 |
+         static_cast<uint32_t>(buffer[2]) << 8 | buffer[3];
+}
+
+void LinuxSPIBus::transferBytes(const uint8_t *data, uint8_t *out,
+                                uint32_t size) {
+  transferRaw(data, out, size);
+}
+
+void LinuxSPIBus::transferBits(uint32_t data, uint32_t *out, uint8_t bits) {
+  // spidev works on whole words, round up to full bytes
+  uint8_t bytes = (bits + 7) / 8;
+  if (bytes > 4) bytes = 4;
+  uint8_t buffer[4];
+  for (uint8_t i = 0; i < bytes; i++) {
+    buffer[i] = data >> (8 * (bytes - 1 - i));
+  }
+  transferRaw(buffer, buffer, bytes);
+  uint32_t result = 0;
+  for (uint8_t i = 0; i < bytes; i++) {
+    result = result << 8 | buffer[i];
+  }
+  if (out != nullptr) *out = result;
+}
+
+void LinuxSPIBus::write(uint8_t data) { transferRaw(&data, nullptr, 1); }
+
+void LinuxSPIBus::write16(uint16_t data) { transfer16(data); }
+
+void LinuxSPIBus::write32(uint32_t data) { transfer32(data); }
+
+void LinuxSPIBus::writeBytes(const uint8_t *data, uint32_t size) {
+  transferRaw(data, nullptr, size);
+}
+
+void LinuxSPIBus::writePattern(const uint8_t *data, uint8_t size,
+                               uint32_t repeat) {
+  if (size == 0) return;
+  // Repeat the pattern into a chunk so that it is sent with few syscalls
+  uint8_t chunk[256];
+  uint32_t perChunk = sizeof(chunk) / size;
+  for (uint32_t i = 0; i < perChunk; i++) {
+    memcpy(chunk + i * size, data, size);
+  }
+  while (repeat > 0) {
+    uint32_t count = repeat < perChunk ? repeat : perChunk;
+    transferRaw(chunk, nullptr, count * size);
+    repeat -= count;
+  }
+}
+
+SPITransferHandle LinuxSPIBus::submitTransfer(const SPITransfer &transfer,
+                                              std::function<void()> done) {
+  Job job;
+  job.transfer = transfer;
+  job.done = std::move(done);
+  auto future = job.finished.get_future().share();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!worker.joinable()) {
+      stopping = false;
+      worker = std::thread(&LinuxSPIBus::runJobs, this);
+    }
+    jobs.push_back(std::move(job));
+  }
+  jobAdded.notify_one();
+  return SPITransferHandle(future);
+}
+
+void LinuxSPIBus::runJobs() {
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      jobAdded.wait(lock, [this] { return stopping || !jobs.empty(); });
+      if (jobs.empty()) return;
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+    auto &transfer = job.transfer;
+    // The settings of the job instead of beginTransaction(), which would
+    // change the speed of a synchronous transaction
+    uint32_t speed = 0;
+    if (transfer.settings != nullptr)
+      speed = static_cast<LinuxSPIBusConfiguration *>(transfer.settings)->speed;
+    std::string error;
+    bool ok;
+    {
+      BusTransaction transaction(this, nullptr);
+      ok = transferRaw(transfer.tx, transfer.rx, transfer.size, speed, &error);
+    }
+    if (job.done) job.done();
+    job.finished.set_value(ok);
+  }
+}
+
+void LinuxSPIBus::stopWorker() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!worker.joinable()) return;
+    stopping = true;
+  }
+  jobAdded.notify_all();
+  worker.join();
+}
+
+#endif  // __linux__
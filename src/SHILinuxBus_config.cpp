@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+// WARNING, this is an automatically generated file!
+// Don't change anything in here.
+// Last update 2026-10-19
+
+#include <iostream>
+#include <string>
+
+#include "SHILinuxBus.h"
+// Configuration implementation for class SHI::LinuxSPIBusConfiguration
+
+namespace {}  // namespace
+
+SHI::LinuxSPIBusConfiguration::LinuxSPIBusConfiguration(const JsonObject &obj)
+    : device(obj["device"] | "/dev/spidev0.0"),
+      speed(obj["speed"] | 1000000),
+      mode(obj["mode"] | 0),
+      bitsPerWord(obj["bitsPerWord"] | 8) {}
+
+SHI::LinuxSPIBusConfiguration::LinuxSPIBusConfiguration(ConfigDecoder &decoder)
+    : device(decoder.read<std::string>()),
+      speed(decoder.read<int>()),
+      mode(decoder.read<int>()),
+      bitsPerWord(decoder.read<int>()) {}
+
+void SHI::LinuxSPIBusConfiguration::fillData(JsonObject &doc) const {
+  doc["device"] = device;
+  doc["speed"] = speed;
+  doc["mode"] = mode;
+  doc["bitsPerWord"] = bitsPerWord;
+}
+
+void SHI::LinuxSPIBusConfiguration::writeJson(JsonWriter &writer) const {
+  writer.key("device");
+  writer.value(device);
+  writer.key("speed");
+  writer.value(speed);
+  writer.key("mode");
+  writer.value(mode);
+  writer.key("bitsPerWord");
+  writer.value(bitsPerWord);
+}
+
+void SHI::LinuxSPIBusConfiguration::encode(ConfigEncoder &encoder) const {
+  encoder.write(device);
+  encoder.write(speed);
+  encoder.write(mode);
+  encoder.write(bitsPerWord);
+}
+
+int SHI::LinuxSPIBusConfiguration::getExpectedCapacity() const {
+  return JSON_OBJECT_SIZE(4) + JSON_STRING_SIZE(device.size() + 1);
+}
+
+#include "SHILinuxBus.h"
+// Configuration implementation for class SHI::LinuxSerialBusConfiguration
+
+namespace {}  // namespace
+
+SHI::LinuxSerialBusConfiguration::LinuxSerialBusConfiguration(
+    const JsonObject &obj)
+    : device(obj["device"] | "/dev/ttyUSB0"),
+      baudRate(obj["baudRate"] | 115200),
+      dataBits(obj["dataBits"] | 8),
+      parity(obj["parity"] | "N"),
+      stopBits(obj["stopBits"] | 1),
+      writeTimeout(obj["writeTimeout"] | 1000) {}
+
+SHI::LinuxSerialBusConfiguration::LinuxSerialBusConfiguration(
+    ConfigDecoder &decoder)
+    : device(decoder.read<std::string>()),
+      baudRate(decoder.read<int>()),
+      dataBits(decoder.read<int>()),
+      parity(decoder.read<std::string>()),
+      stopBits(decoder.read<int>()),
+      writeTimeout(decoder.read<int>()) {}
+
+void SHI::LinuxSerialBusConfiguration::fillData(JsonObject &doc) const {
+  doc["device"] = device;
+  doc["baudRate"] = baudRate;
+  doc["dataBits"] = dataBits;
+  doc["parity"] = parity;
+  doc["stopBits"] = stopBits;
+  doc["writeTimeout"] = writeTimeout;
+}
+
+void SHI::LinuxSerialBusConfiguration::writeJson(JsonWriter &writer) const {
+  writer.key("device");
+  writer.value(device);
+  writer.key("baudRate");
+  writer.value(baudRate);
+  writer.key("dataBits");
+  writer.value(dataBits);
+  writer.key("parity");
+  writer.value(parity);
+  writer.key("stopBits");
+  writer.value(stopBits);
+  writer.key("writeTimeout");
+  writer.value(writeTimeout);
+}
+
+void SHI::LinuxSerialBusConfiguration::encode(ConfigEncoder &encoder) const {
+  encoder.write(device);
+  encoder.write(baudRate);
+  encoder.write(dataBits);
+  encoder.write(parity);
+  encoder.write(stopBits);
+  encoder.write(writeTimeout);
+}
+
+int SHI::LinuxSerialBusConfiguration::getExpectedCapacity() const {
+  return JSON_OBJECT_SIZE(6) + JSON_STRING_SIZE(device.size() + 1) +
+         JSON_STRING_SIZE(parity.size() + 1);
+}
+
+#include "SHILinuxBus.h"
+// Configuration implementation for class SHI::LinuxI2CBusConfiguration
+
+namespace {}  // namespace
+
+SHI::LinuxI2CBusConfiguration::LinuxI2CBusConfiguration(const JsonObject &obj)
+    : device(obj["device"] | "/dev/i2c-1") {}
+
+SHI::LinuxI2CBusConfiguration::LinuxI2CBusConfiguration(ConfigDecoder &decoder)
+    : device(decoder.read<std::string>()) {}
+
+void SHI::LinuxI2CBusConfiguration::fillData(JsonObject &doc) const {
+  doc["device"] = device;
+}
+
+void SHI::LinuxI2CBusConfiguration::writeJson(JsonWriter &writer) const {
+  writer.key("device");
+  writer.value(device);
+}
+
+void SHI::LinuxI2CBusConfiguration::encode(ConfigEncoder &encoder) const {
+  encoder.write(device);
+}
+
+int SHI::LinuxI2CBusConfiguration::getExpectedCapacity() const {
+  return JSON_OBJECT_SIZE(1) + JSON_STRING_SIZE(device.size() + 1);
+}
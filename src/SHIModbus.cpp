@@ -0,0 +1,356 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include "SHIModbus.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using SHI::ModbusDataType;
+using SHI::ModbusRTUMaster;
+using SHI::ModbusSensor;
+
+namespace {
+
+// The largest number of registers a single read request may ask for
+const uint16_t MAX_REGISTERS = 125;
+// Slave address 0 is the broadcast address and never answers
+const uint8_t BROADCAST = 0;
+
+/// Rounds towards zero and saturates, the cast alone is undefined for
+/// values out of range
+int32_t toInt32(float value) {
+  if (value >= 2147483648.0f) return INT32_MAX;
+  if (value <= -2147483648.0f) return INT32_MIN;
+  return static_cast<int32_t>(value);
+}
+
+struct CRCTable {
+  uint16_t entries[256];
+  CRCTable() {
+    for (int i = 0; i < 256; i++) {
+      uint16_t crc = i;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+      }
+      entries[i] = crc;
+    }
+  }
+};
+
+const CRCTable &crcTable() {
+  static const CRCTable table;
+  return table;
+}
+
+}  // namespace
+
+uint16_t SHI::modbusCRC(const uint8_t *data, size_t size, uint16_t crc) {
+  auto &table = crcTable().entries;
+  for (size_t i = 0; i < size; i++) {
+    crc = (crc >> 8) ^ table[(crc ^ data[i]) & 0xFF];
+  }
+  return crc;
+}
+
+ModbusRTUMaster::ResponseParser::ResponseParser(RingBuffer *ring)
+    : FrameParser(ring, &BROADCAST, 1) {}
+
+void ModbusRTUMaster::ResponseParser::expect(uint8_t slave,
+                                             ModbusFunction newFunction) {
+  setSync(&slave, 1);
+  function = static_cast<uint8_t>(newFunction);
+}
+
+size_t ModbusRTUMaster::ResponseParser::frameLength(const FrameView &header) {
+  // Address, function, byte count, data and two bytes of CRC
+  if (header[1] == function) return 5 + header[2];
+  // Exception responses carry an exception code instead of the byte count
+  if (header[1] == (function | 0x80)) return 5;
+  return 0;
+}
+
+bool ModbusRTUMaster::ResponseParser::isValid(const FrameView &frame) {
+  size_t size = frame.size();
+  uint16_t crc = 0xFFFF;
+  if (frame.firstSize >= size - 2) {
+    crc = modbusCRC(frame.first, size - 2, crc);
+  } else {
+    crc = modbusCRC(frame.first, frame.firstSize, crc);
+    crc = modbusCRC(frame.second, size - 2 - frame.firstSize, crc);
+  }
+  return frame[size - 2] == (crc & 0xFF) && frame[size - 1] == (crc >> 8);
+}
+
+ModbusRTUMaster::ModbusRTUMaster(SerialBus *bus, uint32_t baudRate)
+    : bus(bus),
+      // 11 bits per character: start, 8 data, parity or stop and stop
+      characterTime(11000000 / (baudRate > 0 ? baudRate : 9600)) {
+  // The specification fixes the delay to 1.75 ms above 19200 baud
+  interFrameDelay = baudRate > 19200 ? std::chrono::microseconds(1750)
+                                     : characterTime * 7 / 2;
+}
+
+uint16_t ModbusRTUMaster::registerCount(ModbusDataType type) {
+  return type == ModbusDataType::INT16 || type == ModbusDataType::UINT16 ? 1
+                                                                         : 2;
+}
+
+size_t ModbusRTUMaster::addPoint(const ModbusPoint &point) {
+  points.push_back(point);
+  values.push_back({0, 0, MeasurementDataState::NO_DATA});
+  dirty = true;
+  return points.size() - 1;
+}
+
+void ModbusRTUMaster::rebuild() {
+  sortedPoints.resize(points.size());
+  for (size_t i = 0; i < points.size(); i++) sortedPoints[i] = i;
+  std::sort(sortedPoints.begin(), sortedPoints.end(),
+            [this](size_t left, size_t right) {
+              auto &a = points[left];
+              auto &b = points[right];
+              if (a.slave != b.slave) return a.slave < b.slave;
+              if (a.function != b.function) return a.function < b.function;
+              return a.address < b.address;
+            });
+  batches.clear();
+  for (size_t i = 0; i < sortedPoints.size(); i++) {
+    auto &point = points[sortedPoints[i]];
+    uint32_t end = point.address + registerCount(point.type);
+    if (!batches.empty()) {
+      auto &batch = batches.back();
+      uint32_t batchEnd = batch.start + batch.count;
+      if (batch.slave == point.slave && batch.function == point.function &&
+          point.address <= batchEnd + maxGap &&
+          end - batch.start <= MAX_REGISTERS) {
+        if (end > batchEnd) batch.count = end - batch.start;
+        batch.pointCount++;
+        continue;
+      }
+    }
+    batches.push_back({point.slave, point.function, point.address,
+                       static_cast<uint16_t>(end - point.address), i, 1});
+  }
+  dirty = false;
+}
+
+void ModbusRTUMaster::startCycle() {
+  if (state != State::IDLE) return;
+  if (dirty) rebuild();
+  if (batches.empty()) {
+    completedCycles++;
+    return;
+  }
+  currentBatch = 0;
+  state = State::WAIT_IDLE;
+}
+
+void ModbusRTUMaster::send(const Batch &batch) {
+  uint8_t request[8] = {batch.slave,
+                        static_cast<uint8_t>(batch.function),
+                        static_cast<uint8_t>(batch.start >> 8),
+                        static_cast<uint8_t>(batch.start),
+                        static_cast<uint8_t>(batch.count >> 8),
+                        static_cast<uint8_t>(batch.count)};
+  uint16_t crc = modbusCRC(request, 6);
+  request[6] = crc & 0xFF;
+  request[7] = crc >> 8;
+  // Anything left over belongs to an earlier, failed exchange
+  while (bus->available() > 0) bus->read();
+  ring.clear();
+  parser.expect(batch.slave, batch.function);
+  bus->write(request, sizeof(request));
+  requests++;
+}
+
+void ModbusRTUMaster::decode(const Batch &batch, const FrameView &frame) {
+  if (frame[1] & 0x80) {
+    exceptions++;
+    fail(batch);
+    return;
+  }
+  // The register data starts after address, function and byte count
+  const size_t dataOffset = 3;
+  size_t byteCount = frame[2];
+  for (size_t i = 0; i < batch.pointCount; i++) {
+    size_t id = sortedPoints[batch.firstPoint + i];
+    auto &point = points[id];
+    auto &value = values[id];
+    size_t offset = (point.address - batch.start) * 2;
+    size_t size = registerCount(point.type) * 2;
+    if (offset + size > byteCount) {
+      value.state = MeasurementDataState::ERROR;
+      continue;
+    }
+    uint8_t raw[4];
+    frame.copy(dataOffset + offset, raw, size);
+    uint32_t word = raw[0] << 8 | raw[1];
+    if (size == 4) {
+      uint32_t low = raw[2] << 8 | raw[3];
+      word = point.swapWords ? low << 16 | word : word << 16 | low;
+    }
+    switch (point.type) {
+      case ModbusDataType::INT16:
+        value.raw = static_cast<int16_t>(word);
+        value.value = value.raw * point.scale;
+        break;
+      case ModbusDataType::UINT16:
+      case ModbusDataType::UINT32:
+        value.raw = static_cast<int32_t>(word);
+        value.value = word * point.scale;
+        break;
+      case ModbusDataType::INT32:
+        value.raw = static_cast<int32_t>(word);
+        value.value = value.raw * point.scale;
+        break;
+      case ModbusDataType::FLOAT32: {
+        float decoded;
+        memcpy(&decoded, &word, sizeof(decoded));
+        if (!std::isfinite(decoded)) {
+          value.state = MeasurementDataState::ERROR;
+          continue;
+        }
+        value.raw = toInt32(decoded);
+        value.value = decoded * point.scale;
+        break;
+      }
+    }
+    value.state = MeasurementDataState::VALID;
+  }
+}
+
+void ModbusRTUMaster::fail(const Batch &batch) {
+  for (size_t i = 0; i < batch.pointCount; i++) {
+    values[sortedPoints[batch.firstPoint + i]].state =
+        MeasurementDataState::ERROR;
+  }
+}
+
+void ModbusRTUMaster::nextBatch(Clock::time_point now) {
+  lastActivity = now;
+  if (++currentBatch < batches.size()) {
+    state = State::WAIT_IDLE;
+  } else {
+    state = State::IDLE;
+    completedCycles++;
+  }
+}
+
+bool ModbusRTUMaster::process() {
+  while (state != State::IDLE) {
+    auto now = Clock::now();
+    auto &batch = batches[currentBatch];
+    if (state == State::WAIT_IDLE) {
+      if (now - lastActivity < interFrameDelay) return true;
+      send(batch);
+      sentAt = lastActivity = Clock::now();
+      state = State::WAIT_RESPONSE;
+      continue;
+    }
+    if (ring.fill(bus) > 0) lastActivity = now;
+    FrameView frame;
+    if (parser.next(&frame)) {
+      decode(batch, frame);
+      parser.release();
+      nextBatch(now);
+      continue;
+    }
+    if (now - sentAt < std::chrono::milliseconds(responseTimeoutMs))
+      return true;
+    timeouts++;
+    fail(batch);
+    nextBatch(now);
+  }
+  return false;
+}
+
+void ModbusRTUMaster::finishCycle() {
+  while (process()) {
+    std::this_thread::sleep_for(characterTime);
+  }
+}
+
+int64_t ModbusRTUMaster::estimateCycleTime() {
+  if (dirty) rebuild();
+  std::chrono::microseconds total(0);
+  for (auto &&batch : batches) {
+    // Request, response and the pauses before each of them
+    total += characterTime * (8 + 5 + 2 * batch.count) + interFrameDelay * 2;
+  }
+  return std::chrono::duration_cast<std::chrono::milliseconds>(total).count() +
+         1;
+}
+
+std::vector<std::pair<std::string, std::string>>
+ModbusRTUMaster::getStatistics() const {
+  return {{"modbusPoints", std::to_string(points.size())},
+          {"modbusRequestsPerCycle", std::to_string(batches.size())},
+          {"modbusRequests", std::to_string(requests)},
+          {"modbusTimeouts", std::to_string(timeouts)},
+          {"modbusExceptions", std::to_string(exceptions)},
+          {"modbusInvalidFrames", std::to_string(parser.getInvalidFrames())}};
+}
+
+void ModbusSensor::addPoint(const ModbusPoint &point,
+                            std::shared_ptr<MeasurementMetaData> meta) {
+  pointIds.push_back(master->addPoint(point));
+  addMetaData(meta);
+}
+
+void ModbusSensor::addReadings(MeasurementBuffer &buffer) {
+  auto &bundle = buffer.nextBundle(this);
+  bundle.reserve(pointIds.size());
+  for (size_t i = 0; i < pointIds.size(); i++) {
+    auto id = pointIds[i];
+    auto meta = metaData[i].get();
+    switch (master->getState(id)) {
+      case MeasurementDataState::VALID:
+        if (meta->type == SensorDataType::INT)
+          bundle.add(meta, static_cast<int>(master->getIntValue(id)));
+        else
+          bundle.add(meta, master->getFloatValue(id));
+        break;
+      case MeasurementDataState::NO_DATA:
+        bundle.addNoData(meta);
+        break;
+      case MeasurementDataState::ERROR:
+        bundle.addError(meta);
+        break;
+    }
+  }
+}
+
+void ModbusSensor::startCycleIfStale() {
+  // A cycle that another sensor started or finished since the last read
+  // covers the points of this sensor as well
+  if (!master->isBusy() && master->getCycle() == readCycle)
+    master->startCycle();
+}
+
+void ModbusSensor::readSensorInto(MeasurementBuffer &buffer) {
+  startCycleIfStale();
+  master->finishCycle();
+  readCycle = master->getCycle();
+  addReadings(buffer);
+}
+
+int64_t ModbusSensor::triggerSensor() {
+  startCycleIfStale();
+  if (!master->process()) return hw->getEpochInMs();
+  return hw->getEpochInMs() + master->estimateCycleTime();
+}
+
+void ModbusSensor::collectSensor(MeasurementBuffer &buffer) {
+  master->finishCycle();
+  readCycle = master->getCycle();
+  addReadings(buffer);
+}
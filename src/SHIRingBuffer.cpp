@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include "SHIRingBuffer.h"
+
+#include <string.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+using SHI::FrameParser;
+using SHI::FrameView;
+using SHI::RingBuffer;
+
+namespace {
+
+size_t roundUpToPowerOfTwo(size_t value) {
+  size_t result = 1;
+  while (result < value) result <<= 1;
+  return result;
+}
+
+}  // namespace
+
+void FrameView::copy(size_t offset, uint8_t *out, size_t count) const {
+  if (offset < firstSize) {
+    size_t fromFirst = firstSize - offset < count ? firstSize - offset : count;
+    memcpy(out, first + offset, fromFirst);
+    out += fromFirst;
+    count -= fromFirst;
+    offset = 0;
+  } else {
+    offset -= firstSize;
+  }
+  memcpy(out, second + offset, count);
+}
+
+RingBuffer::RingBuffer(size_t capacity)
+    : storage(roundUpToPowerOfTwo(capacity)), mask(storage.size() - 1) {}
+
+size_t RingBuffer::write(const uint8_t *data, size_t count) {
+  size_t written = 0;
+  while (written < count) {
+    size_t contiguous;
+    uint8_t *target = writePointer(&contiguous);
+    if (contiguous == 0) break;
+    size_t chunk = count - written < contiguous ? count - written : contiguous;
+    memcpy(target, data + written, chunk);
+    commit(chunk);
+    written += chunk;
+  }
+  return written;
+}
+
+uint8_t *RingBuffer::writePointer(size_t *contiguous) {
+  size_t offset = tail & mask;
+  size_t toEnd = storage.size() - offset;
+  size_t free = space();
+  *contiguous = free < toEnd ? free : toEnd;
+  return storage.data() + offset;
+}
+
+size_t RingBuffer::fill(SerialBus *bus) {
+  size_t total = 0;
+  // The free space is at most two pieces
+  for (int i = 0; i < 2; i++) {
+    int available = bus->available();
+    if (available <= 0) break;
+    size_t contiguous;
+    uint8_t *target = writePointer(&contiguous);
+    if (contiguous == 0) break;
+    size_t wanted = static_cast<size_t>(available) < contiguous
+                        ? static_cast<size_t>(available)
+                        : contiguous;
+    size_t received = bus->read(target, wanted);
+    commit(received);
+    total += received;
+    if (received < wanted) break;
+  }
+  return total;
+}
+
+FrameView RingBuffer::view(size_t offset, size_t count) const {
+  size_t start = (head + offset) & mask;
+  size_t toEnd = storage.size() - start;
+  FrameView result;
+  result.first = storage.data() + start;
+  result.firstSize = count < toEnd ? count : toEnd;
+  result.second = storage.data();
+  result.secondSize = count - result.firstSize;
+  return result;
+}
+
+size_t RingBuffer::find(uint8_t value, size_t from) const {
+  if (from >= size()) return npos;
+  // memchr over the two pieces, it is vectorized by the C library
+  FrameView data = view(from, size() - from);
+  auto found = memchr(data.first, value, data.firstSize);
+  if (found != nullptr)
+    return from + (static_cast<const uint8_t *>(found) - data.first);
+  found = memchr(data.second, value, data.secondSize);
+  if (found != nullptr) {
+    return from + data.firstSize +
+           (static_cast<const uint8_t *>(found) - data.second);
+  }
+  return npos;
+}
+
+void RingBuffer::consume(size_t count) {
+  head += count < size() ? count : size();
+  if (head == tail) head = tail = 0;
+}
+
+void FrameParser::skip(size_t count) {
+  ring->consume(count);
+  skippedBytes += count;
+}
+
+bool FrameParser::next(FrameView *frame) {
+  release();
+  while (true) {
+    size_t start = ring->find(sync[0]);
+    if (start == RingBuffer::npos) {
+      skip(ring->size());
+      return false;
+    }
+    if (start > 0) skip(start);
+    size_t available = ring->size();
+    if (available < headerSize()) return false;
+    bool synced = true;
+    for (size_t i = 1; i < sync.size() && synced; i++) {
+      synced = ring->at(i) == sync[i];
+    }
+    if (!synced) {
+      skip(1);
+      continue;
+    }
+    size_t length = frameLength(ring->view(0, headerSize()));
+    if (length < headerSize() || length > ring->capacity()) {
+      invalidFrames++;
+      skip(1);
+      continue;
+    }
+    if (available < length) return false;
+    *frame = ring->view(0, length);
+    if (!isValid(*frame)) {
+      invalidFrames++;
+      skip(1);
+      continue;
+    }
+    frames++;
+    pending = length;
+    return true;
+  }
+}
+
+void FrameParser::release() {
+  ring->consume(pending);
+  pending = 0;
+}
+
+std::vector<std::pair<std::string, std::string>> FrameParser::getStatistics()
+    const {
+  return {{"frames", std::to_string(frames)},
+          {"invalidFrames", std::to_string(invalidFrames)},
+          {"skippedBytes", std::to_string(skippedBytes)}};
+}
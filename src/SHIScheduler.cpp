@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include "SHIScheduler.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "SHISensor.h"
+
+using SHI::Scheduler;
+using SHI::Sensor;
+using SHI::SensorGroup;
+
+namespace {
+std::string averageJitter(const Scheduler::Entry &entry) {
+  if (entry.runs == 0) return "0";
+  return std::to_string(entry.totalJitter / entry.runs);
+}
+}  // namespace
+
+void Scheduler::beginPass(
+    const std::vector<std::shared_ptr<SensorGroup>> &groups, int64_t now) {
+  if (dirty || !matches(groups)) rebuild(groups, now);
+  passStart = now;
+  // The clock could have been set back (i.e. by NTP), don't let that stall
+  // the sensors until the clock has caught up again
+  bool changed = false;
+  for (auto &&entry : entries) {
+    auto interval = getInterval(entry);
+    if (entry.deadline > now + interval) {
+      entry.deadline = now + interval;
+      changed = true;
+    }
+  }
+  if (changed) makeHeap();
+}
+
+void Scheduler::rebuild(const std::vector<std::shared_ptr<SensorGroup>> &groups,
+                        int64_t now) {
+  std::map<const Sensor *, Entry> previous;
+  for (auto &&entry : entries) {
+    previous[entry.sensor] = entry;
+  }
+  entries.clear();
+  for (auto &&group : groups) {
+    for (auto &&sensor : *group->getSensors()) {
+      auto found = previous.find(sensor.get());
+      if (found != previous.end()) {
+        auto entry = found->second;
+        entry.group = group.get();
+        entries.push_back(entry);
+      } else {
+        entries.push_back({sensor.get(), group.get(), now, sequence++, 0, 0, 0,
+                           0, 0, 0});
+      }
+    }
+  }
+  dirty = false;
+  makeHeap();
+}
+
+bool Scheduler::matches(
+    const std::vector<std::shared_ptr<SensorGroup>> &groups) const {
+  // SensorGroup::addSensor() and removeSensor() don't invalidate, so compare
+  // by identity. The entries are in the order of the groups and sensors.
+  size_t index = 0;
+  for (auto &&group : groups) {
+    for (auto &&sensor : *group->getSensors()) {
+      if (index == entries.size()) return false;
+      auto &entry = entries[index++];
+      if (entry.sensor != sensor.get() || entry.group != group.get())
+        return false;
+    }
+  }
+  return index == entries.size();
+}
+
+bool Scheduler::isBefore(size_t a, size_t b) const {
+  auto &ea = entries[a];
+  auto &eb = entries[b];
+  if (ea.deadline != eb.deadline) return ea.deadline < eb.deadline;
+  return ea.sequence < eb.sequence;
+}
+
+void Scheduler::makeHeap() {
+  heap.clear();
+  for (size_t i = 0; i < entries.size(); i++) {
+    heap.push_back(i);
+  }
+  std::make_heap(heap.begin(), heap.end(),
+                 [this](size_t a, size_t b) { return isBefore(b, a); });
+}
+
+void Scheduler::pushHeap(size_t index) {
+  heap.push_back(index);
+  std::push_heap(heap.begin(), heap.end(),
+                 [this](size_t a, size_t b) { return isBefore(b, a); });
+}
+
+Scheduler::Entry *Scheduler::nextDue() {
+  if (heap.empty()) return nullptr;
+  auto &top = entries[heap.front()];
+  if (top.deadline > passStart) return nullptr;
+  std::pop_heap(heap.begin(), heap.end(),
+                [this](size_t a, size_t b) { return isBefore(b, a); });
+  heap.pop_back();
+  return &top;
+}
+
+void Scheduler::complete(Entry *entry, int64_t start, int64_t end) {
+  auto interval = getInterval(*entry);
+  if (interval > 0) {
+    auto jitter = start - entry->deadline;
+    entry->totalJitter += jitter;
+    if (jitter > entry->maxJitter) entry->maxJitter = jitter;
+  }
+  entry->runs++;
+  entry->lastDuration = end - start;
+  if (entry->lastDuration > entry->maxDuration)
+    entry->maxDuration = entry->lastDuration;
+  if (interval > 0 && entry->deadline + interval <= start) entry->overruns++;
+  reschedule(entry, interval, start);
+}
+
+void Scheduler::skip(Entry *entry, int64_t now) {
+  entry->overruns++;
+  reschedule(entry, getInterval(*entry), now);
+}
+
+void Scheduler::postpone(Entry *entry) { pushHeap(entry - entries.data()); }
+
+void Scheduler::reschedule(Entry *entry, int interval, int64_t start) {
+  auto next = entry->deadline + interval;
+  // Skip the slots that were missed instead of trying to catch up
+  if (next <= start) next = start + interval;
+  // Every sensor is read at most once per pass
+  if (next <= passStart) next = passStart + 1;
+  entry->deadline = next;
+  entry->sequence = sequence++;
+  pushHeap(entry - entries.data());
+}
+
+int64_t Scheduler::getNextDeadline() const {
+  if (heap.empty()) return -1;
+  return entries[heap.front()].deadline;
+}
+
+const Scheduler::Entry *Scheduler::find(const Sensor *sensor) const {
+  for (auto &&entry : entries) {
+    if (entry.sensor == sensor) return &entry;
+  }
+  return nullptr;
+}
+
+int Scheduler::getInterval(const Entry &entry) {
+  auto interval = entry.sensor->getSamplingInterval();
+  if (interval >= 0) return interval;
+  return entry.group->config->interval;
+}
+
+std::vector<std::pair<std::string, std::string>> Scheduler::getStatistics()
+    const {
+  uint32_t runs = 0;
+  uint32_t overruns = 0;
+  int64_t totalJitter = 0;
+  int64_t maxJitter = 0;
+  for (auto &&entry : entries) {
+    runs += entry.runs;
+    overruns += entry.overruns;
+    totalJitter += entry.totalJitter;
+    if (entry.maxJitter > maxJitter) maxJitter = entry.maxJitter;
+  }
+  return {{"schedulerRuns", std::to_string(runs)},
+          {"schedulerOverruns", std::to_string(overruns)},
+          {"schedulerAvgJitter",
+           std::to_string(runs == 0 ? 0 : totalJitter / runs)},
+          {"schedulerMaxJitter", std::to_string(maxJitter)}};
+}
+
+std::vector<std::pair<std::string, std::string>> Scheduler::getStatistics(
+    const Sensor *sensor) const {
+  auto entry = find(sensor);
+  if (entry == nullptr) return {};
+  return {{"interval", std::to_string(getInterval(*entry))},
+          {"runs", std::to_string(entry->runs)},
+          {"overruns", std::to_string(entry->overruns)},
+          {"avgJitter", averageJitter(*entry)},
+          {"maxJitter", std::to_string(entry->maxJitter)},
+          {"lastDuration", std::to_string(entry->lastDuration)},
+          {"maxDuration", std::to_string(entry->maxDuration)}};
+}
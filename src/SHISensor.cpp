@@ -6,9 +6,20 @@
 #include "SHISensor.h"
 
 #include <stdio.h>
+#include <string.h>
 
+#include <algorithm>
+#include <mutex>
+
+using SHI::ColumnarMeasurementBundle;
+using SHI::CompactMeasurement;
 using SHI::Measurement;
+using SHI::MeasurementBuffer;
+using SHI::MeasurementBundle;
+using SHI::MeasurementDataState;
 using SHI::MeasurementMetaData;
+using SHI::MeasurementValue;
+using SHI::SensorDataType;
 using SHI::Sensor;
 using SHI::SensorGroup;
 
@@ -19,6 +30,90 @@ const std::string STATUS_OK = "OK";        // NOLINT
 
 }  // namespace SHI
 
+namespace {
+
+/// A slot of the id registry. The generation is part of the id and changes
+/// when the slot is freed, so ids of destroyed meta data never resolve to
+/// the meta data that re-uses the slot.
+struct RegistrySlot {
+  MeasurementMetaData* metaData;
+  uint16_t generation;
+};
+
+struct MetaDataRegistry {
+  std::mutex mutex;
+  std::vector<RegistrySlot> slots;
+  std::vector<uint16_t> freeSlots;
+};
+
+// Meta data is created by sensors that are set up or read in parallel
+MetaDataRegistry& metaDataRegistry() {
+  static MetaDataRegistry registry;
+  return registry;
+}
+
+const uint32_t MAX_SLOTS = 0xFFFF;
+
+/// The string pool index of records without a string
+const int32_t NO_STRING = -1;
+
+const int DEFAULT_FLOAT_PRECISION =
+    SHI::Format::parseFixedPrecision(SHI::DEFAULT_FLOAT_REPRESENTATION);
+
+/// Whether representation is what Measurement formats value to by default
+bool isDefaultRepresentation(float value, const std::string& representation) {
+  char buffer[SHI::Format::MAX_FIXED_LENGTH];
+  size_t length =
+      SHI::Format::formatFixed(value, DEFAULT_FLOAT_PRECISION, buffer);
+  if (length == 0)
+    return representation ==
+           SHI::Format::toString(value, SHI::DEFAULT_FLOAT_REPRESENTATION);
+  return length == representation.size() &&
+         memcmp(buffer, representation.data(), length) == 0;
+}
+
+}  // namespace
+
+MeasurementMetaData::MeasurementMetaData(const std::string& name,
+                                         const std::string& unit,
+                                         SensorDataType type)
+    : SHIObject(name, false), unit(unit), type(type) {
+  auto& registry = metaDataRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  uint16_t slot;
+  if (!registry.freeSlots.empty()) {
+    slot = registry.freeSlots.back();
+    registry.freeSlots.pop_back();
+  } else if (registry.slots.size() < MAX_SLOTS) {
+    slot = registry.slots.size();
+    registry.slots.push_back({nullptr, 0});
+  } else {
+    return;
+  }
+  registry.slots[slot].metaData = this;
+  id = (static_cast<uint32_t>(registry.slots[slot].generation) << 16) | slot;
+}
+
+MeasurementMetaData::~MeasurementMetaData() {
+  if (id == INVALID_ID) return;
+  auto& registry = metaDataRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  auto& slot = registry.slots[id & 0xFFFF];
+  slot.metaData = nullptr;
+  slot.generation++;
+  registry.freeSlots.push_back(id & 0xFFFF);
+}
+
+MeasurementMetaData* MeasurementMetaData::getById(uint32_t id) {
+  auto& registry = metaDataRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  uint32_t slot = id & 0xFFFF;
+  if (slot >= registry.slots.size() ||
+      registry.slots[slot].generation != (id >> 16))
+    return nullptr;
+  return registry.slots[slot].metaData;
+}
+
 void SensorGroup::accept(Visitor& visitor) {
   visitor.enterVisit(this);
   for (auto&& sensor : sensors) {
@@ -43,6 +138,16 @@ void SensorGroup::addSensor(std::shared_ptr<Sensor> sensor) {
   sensors.push_back(sensor);
 }
 
+bool SensorGroup::removeSensor(const Sensor* sensor) {
+  for (auto it = sensors.begin(); it != sensors.end(); ++it) {
+    if (it->get() == sensor) {
+      sensors.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
 std::string Measurement::toTransmitString() const {
   switch (metaData->type) {
     case SensorDataType::STRING:
@@ -85,6 +190,28 @@ float Measurement::getFloatValue() const {
   }
 }
 
+std::vector<MeasurementBundle> Sensor::readIntoBundles() {
+  MeasurementBuffer buffer;
+  readSensorInto(buffer);
+  auto& legacyBundles = buffer.getLegacyBundles();
+  std::vector<MeasurementBundle> result;
+  result.reserve(legacyBundles.size() + buffer.size());
+  size_t legacy = 0;
+  for (size_t i = 0; i <= buffer.size(); i++) {
+    for (; legacy < legacyBundles.size() &&
+           buffer.getLegacyPosition(legacy) == i;
+         legacy++) {
+      result.push_back(legacyBundles[legacy]);
+    }
+    if (i < buffer.size()) result.push_back(buffer[i].toBundle());
+  }
+  return result;
+}
+
+void Sensor::readSensorInto(MeasurementBuffer& buffer) {
+  buffer.addBundles(readSensor());
+}
+
 void Sensor::addMetaData(std::shared_ptr<MeasurementMetaData> meta) {
   meta->setParent(this);
   metaData.push_back(meta);
@@ -109,3 +236,226 @@ Measurement MeasurementMetaData::measuredNoData() {
 Measurement MeasurementMetaData::measuredError() {
   return Measurement(this, true);
 }
+
+void ColumnarMeasurementBundle::reset(SHIObject* newSrc,
+                                      uint64_t newTimeStamp) {
+  src = newSrc;
+  timeStamp = newTimeStamp;
+  ids.clear();
+  values.clear();
+  types.clear();
+  states.clear();
+  representations.clear();
+  usedStrings = 0;
+}
+
+void ColumnarMeasurementBundle::reserve(size_t size) {
+  ids.reserve(size);
+  values.reserve(size);
+  types.reserve(size);
+  states.reserve(size);
+}
+
+void ColumnarMeasurementBundle::addRecord(const MeasurementMetaData* metaData,
+                                          SensorDataType type,
+                                          MeasurementDataState state,
+                                          MeasurementValue value) {
+  ids.push_back(metaData != nullptr ? metaData->getId()
+                                    : MeasurementMetaData::INVALID_ID);
+  values.push_back(value);
+  types.push_back(type);
+  states.push_back(state);
+}
+
+int32_t ColumnarMeasurementBundle::addString(const std::string& value) {
+  // Assign into existing strings so that their capacity is re-used
+  if (usedStrings < strings.size()) {
+    strings[usedStrings] = value;
+  } else {
+    strings.push_back(value);
+  }
+  return usedStrings++;
+}
+
+void ColumnarMeasurementBundle::add(const MeasurementMetaData* metaData,
+                                    float value) {
+  MeasurementValue v;
+  v.floatValue = value;
+  addRecord(metaData, SensorDataType::FLOAT, MeasurementDataState::VALID, v);
+}
+
+void ColumnarMeasurementBundle::add(const MeasurementMetaData* metaData,
+                                    int value) {
+  MeasurementValue v;
+  v.intValue = value;
+  addRecord(metaData, SensorDataType::INT, MeasurementDataState::VALID, v);
+}
+
+void ColumnarMeasurementBundle::add(const MeasurementMetaData* metaData,
+                                    const std::string& value, bool error) {
+  MeasurementValue v;
+  v.intValue = addString(value);
+  auto type = metaData != nullptr ? metaData->type : SensorDataType::STRING;
+  addRecord(metaData, type,
+            error ? MeasurementDataState::ERROR : MeasurementDataState::VALID,
+            v);
+}
+
+void ColumnarMeasurementBundle::addNoData(const MeasurementMetaData* metaData) {
+  MeasurementValue v;
+  v.intValue = NO_STRING;
+  addRecord(metaData, metaData->type, MeasurementDataState::NO_DATA, v);
+}
+
+void ColumnarMeasurementBundle::addError(const MeasurementMetaData* metaData) {
+  MeasurementValue v;
+  v.intValue = NO_STRING;
+  addRecord(metaData, metaData->type, MeasurementDataState::ERROR, v);
+}
+
+void ColumnarMeasurementBundle::add(const Measurement& measurement) {
+  auto metaData = measurement.getMetaData();
+  auto state = measurement.getDataState();
+  MeasurementValue v;
+  v.intValue = 0;
+  if (metaData == nullptr) {
+    // Without a type only the text of the measurement is known
+    v.intValue = state != MeasurementDataState::NO_DATA
+                     ? addString(measurement.stringRepresentation)
+                     : NO_STRING;
+    addRecord(metaData, SensorDataType::STRING, state, v);
+    return;
+  }
+  switch (metaData->type) {
+    case SensorDataType::FLOAT:
+      if (state == MeasurementDataState::VALID) {
+        v.floatValue = measurement.getFloatValue();
+        // Keep a representation that was formatted with another precision
+        if (!isDefaultRepresentation(v.floatValue,
+                                     measurement.stringRepresentation))
+          representations.push_back(
+              {static_cast<uint32_t>(size()),
+               addString(measurement.stringRepresentation)});
+      }
+      break;
+    case SensorDataType::INT:
+      if (state == MeasurementDataState::VALID)
+        v.intValue = measurement.getIntValue();
+      break;
+    case SensorDataType::STRING:
+    case SensorDataType::STATUS:
+      v.intValue = state != MeasurementDataState::NO_DATA
+                       ? addString(measurement.stringRepresentation)
+                       : NO_STRING;
+      break;
+  }
+  addRecord(metaData, metaData->type, state, v);
+}
+
+void ColumnarMeasurementBundle::add(const CompactMeasurement& measurement) {
+  ids.push_back(measurement.metaDataId);
+  values.push_back(measurement.value);
+  types.push_back(measurement.type);
+  states.push_back(measurement.state);
+}
+
+CompactMeasurement ColumnarMeasurementBundle::at(size_t index) const {
+  CompactMeasurement result;
+  result.metaDataId = ids[index];
+  result.state = states[index];
+  result.type = types[index];
+  result.value = values[index];
+  return result;
+}
+
+const std::string& ColumnarMeasurementBundle::getString(size_t index) const {
+  static const std::string empty;
+  if (values[index].intValue == NO_STRING) return empty;
+  return strings[values[index].intValue];
+}
+
+Measurement ColumnarMeasurementBundle::toMeasurement(size_t index) const {
+  auto metaData = MeasurementMetaData::getById(ids[index]);
+  switch (states[index]) {
+    case MeasurementDataState::NO_DATA:
+      return Measurement(metaData, false);
+    case MeasurementDataState::ERROR:
+      if ((types[index] != SensorDataType::STRING &&
+           types[index] != SensorDataType::STATUS) ||
+          values[index].intValue == NO_STRING)
+        return Measurement(metaData, true);
+      return Measurement(getString(index), metaData, true);
+    case MeasurementDataState::VALID:
+    default:
+      break;
+  }
+  switch (types[index]) {
+    case SensorDataType::FLOAT: {
+      // Records are only appended, so representations is sorted
+      auto representation = std::lower_bound(
+          representations.begin(), representations.end(), index,
+          [](const std::pair<uint32_t, int32_t>& entry, size_t record) {
+            return entry.first < record;
+          });
+      if (representation != representations.end() &&
+          representation->first == index)
+        return Measurement(values[index].floatValue,
+                           strings[representation->second], metaData);
+      return Measurement(values[index].floatValue, metaData);
+    }
+    case SensorDataType::INT:
+      return Measurement(static_cast<int>(values[index].intValue), metaData);
+    case SensorDataType::STRING:
+    case SensorDataType::STATUS:
+    default:
+      return Measurement(getString(index), metaData);
+  }
+}
+
+MeasurementBundle ColumnarMeasurementBundle::toBundle() const {
+  MeasurementBundle bundle;
+  toBundle(&bundle);
+  return bundle;
+}
+
+void ColumnarMeasurementBundle::toBundle(MeasurementBundle* bundle) const {
+  bundle->data.clear();
+  bundle->data.reserve(size());
+  for (size_t i = 0; i < size(); i++) {
+    bundle->data.push_back(toMeasurement(i));
+  }
+  bundle->src = src;
+  bundle->timeStamp = timeStamp;
+}
+
+ColumnarMeasurementBundle& MeasurementBuffer::nextBundle(SHIObject* src) {
+  if (usedBundles == bundles.size()) {
+    bundles.push_back(std::unique_ptr<ColumnarMeasurementBundle>(
+        new ColumnarMeasurementBundle(src)));
+  }
+  auto& bundle = *bundles[usedBundles++];
+  bundle.reset(src, SHI::hw->getEpochInMs());
+  return bundle;
+}
+
+void MeasurementBuffer::addBundle(MeasurementBundle&& bundle) {
+  legacyBundles.push_back(std::move(bundle));
+  legacyPositions.push_back(usedBundles);
+}
+
+void MeasurementBuffer::addBundles(std::vector<MeasurementBundle>&& bundles) {
+  if (legacyBundles.empty()) {
+    legacyBundles = std::move(bundles);
+  } else {
+    for (auto&& bundle : bundles) {
+      legacyBundles.push_back(std::move(bundle));
+    }
+  }
+  legacyPositions.resize(legacyBundles.size(), usedBundles);
+}
+
+void MeasurementBuffer::clear() {
+  usedBundles = 0;
+  legacyBundles.clear();
+  legacyPositions.clear();
+}
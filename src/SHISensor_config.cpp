@@ -6,7 +6,7 @@
 
 // WARNING, this is an automatically generated file!
 // Don't change anything in here.
-// Last update 2020-05-01
+// Last update 2026-10-19
 
 #include <iostream>
 #include <string>
@@ -17,12 +17,28 @@
 namespace {}  // namespace
 
 SHI::SensorGroupConfiguration::SensorGroupConfiguration(const JsonObject &obj)
-    : name(obj["name"] | "default") {}
+    : name(obj["name"] | "default"), interval(obj["interval"] | 0) {}
+
+SHI::SensorGroupConfiguration::SensorGroupConfiguration(ConfigDecoder &decoder)
+    : name(decoder.read<std::string>()), interval(decoder.read<int>()) {}
 
 void SHI::SensorGroupConfiguration::fillData(JsonObject &doc) const {
   doc["name"] = name;
+  doc["interval"] = interval;
+}
+
+void SHI::SensorGroupConfiguration::writeJson(JsonWriter &writer) const {
+  writer.key("name");
+  writer.value(name);
+  writer.key("interval");
+  writer.value(interval);
+}
+
+void SHI::SensorGroupConfiguration::encode(ConfigEncoder &encoder) const {
+  encoder.write(name);
+  encoder.write(interval);
 }
 
 int SHI::SensorGroupConfiguration::getExpectedCapacity() const {
-  return JSON_OBJECT_SIZE(1);
+  return JSON_OBJECT_SIZE(2) + JSON_STRING_SIZE(name.size() + 1);
 }
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include "SHIThreadPool.h"
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+using SHI::ThreadPool;
+
+ThreadPool::ThreadPool(size_t threadCount) {
+  if (threadCount == 0) threadCount = 1;
+  for (size_t i = 0; i < threadCount; i++) {
+    workers.push_back(std::unique_ptr<Worker>(new Worker()));
+  }
+  for (size_t i = 0; i < threadCount; i++) {
+    threads.push_back(std::thread(&ThreadPool::run, this, i));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wakeup.notify_all();
+  for (auto &&thread : threads) {
+    thread.join();
+  }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  size_t index;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    unfinished++;
+    index = nextWorker;
+    nextWorker = (nextWorker + 1) % workers.size();
+  }
+  {
+    std::lock_guard<std::mutex> lock(workers[index]->mutex);
+    workers[index]->tasks.push_back(std::move(task));
+  }
+  {
+    // Taking the lock ensures that no thread misses the wakeup between
+    // checking queued and going to sleep
+    std::lock_guard<std::mutex> lock(mutex);
+    queued++;
+  }
+  wakeup.notify_one();
+}
+
+bool ThreadPool::takeTask(size_t index, std::function<void()> *task) {
+  {
+    auto &own = *workers[index];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      *task = std::move(own.tasks.front());
+      own.tasks.pop_front();
+      queued--;
+      return true;
+    }
+  }
+  for (size_t i = 1; i < workers.size(); i++) {
+    auto &victim = *workers[(index + i) % workers.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      *task = std::move(victim.tasks.back());
+      victim.tasks.pop_back();
+      queued--;
+      steals++;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::run(size_t index) {
+  std::function<void()> task;
+  while (true) {
+    if (takeTask(index, &task)) {
+      task();
+      task = nullptr;
+      executed++;
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--unfinished == 0) finished.notify_all();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    wakeup.wait(lock, [this] { return stopping || queued > 0; });
+    if (stopping && queued == 0) return;
+  }
+}
+
+void ThreadPool::wait() {
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [this] { return unfinished == 0; });
+}
+
+bool ThreadPool::waitFor(int timeoutMs) {
+  std::unique_lock<std::mutex> lock(mutex);
+  return finished.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                           [this] { return unfinished == 0; });
+}
+
+std::vector<std::pair<std::string, std::string>> ThreadPool::getStatistics()
+    const {
+  return {{"poolThreads", std::to_string(threads.size())},
+          {"poolTasks", std::to_string(executed.load())},
+          {"poolSteals", std::to_string(steals.load())}};
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include <stdio.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "SHIFactory.h"
+#include "SHIHardware.h"
+#include "SHISensor.h"
+
+// Measures Factory::construct() for a configuration with thousands of
+// sensors, each of its own registered class
+
+// The platform provides this otherwise
+SHI::Hardware *SHI::hw = nullptr;
+
+namespace {
+
+const int SENSOR_CLASSES = 5000;
+const int RUNS = 5;
+
+class BenchmarkHardware : public SHI::Hardware {
+ public:
+  BenchmarkHardware() : SHI::Hardware("BenchmarkHardware") {}
+  void resetWithReason(const std::string &reason, bool restart) override {}
+  void errLeds(void) override {}
+  void setupWatchdog() override {}
+  void feedWatchdog() override {}
+  void disableWatchdog() override {}
+  std::string getNodeName() override { return "benchmark"; }
+  std::string getResetReason() override { return ""; }
+  void resetConfig() override {}
+  void printConfig() override {}
+  void setup(const std::string &defaultName) override {}
+  void loop() override {}
+  int64_t getEpochInMs() override { return 0; }
+  const SHI::Configuration *getConfig() const override { return nullptr; }
+  bool reconfigure(SHI::Configuration *newConfig) override { return false; }
+  void log(const std::string &message) override {}
+};
+
+class BenchmarkSensor : public SHI::Sensor {
+ public:
+  BenchmarkSensor() : SHI::Sensor("BenchmarkSensor") {}
+  std::vector<SHI::MeasurementBundle> readSensor() override { return {}; }
+  bool setupSensor() override { return true; }
+  bool stopSensor() override { return true; }
+  const SHI::Configuration *getConfig() const override { return nullptr; }
+  bool reconfigure(SHI::Configuration *newConfig) override { return false; }
+};
+
+SHI::FactoryResult createSensor(const JsonObject &obj) {
+  return SHI::Factory::get()->objToResult(new BenchmarkSensor());
+}
+
+int64_t elapsedUs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+}  // namespace
+
+int main() {
+  auto factory = SHI::Factory::get();
+  factory->registerFactory("hw", [factory](const JsonObject &obj) {
+    return factory->defaultHardwareFactory(new BenchmarkHardware(), obj);
+  });
+  std::string json = "{\"hw\":{\"$sensors\":[";
+  for (int i = 0; i < SENSOR_CLASSES; i++) {
+    auto name = "Sensor" + std::to_string(i);
+    factory->registerFactory(name, &createSensor);
+    if (i > 0) json += ",";
+    json += "{\"" + name + "\":{}}";
+  }
+  json += "]}}";
+
+  auto start = std::chrono::steady_clock::now();
+  factory->freeze();
+  printf("freeze: %lld us\n", static_cast<long long>(elapsedUs(start)));
+  for (int run = 0; run < RUNS; run++) {
+    start = std::chrono::steady_clock::now();
+    auto result = factory->construct(json);
+    auto duration = elapsedUs(start);
+    auto error = SHI::Factory::getError(result);
+    if (error != SHI::FactoryErrors::None) {
+      printf("construct failed: %s\n", SHI::Factory::errorToString(error));
+      return 1;
+    }
+    printf("construct %d sensors: %lld us\n", SENSOR_CLASSES,
+           static_cast<long long>(duration));
+    delete std::get<0>(result);
+  }
+  return 0;
+}
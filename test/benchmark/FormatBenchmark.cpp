@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <sstream>
+
+#include "SHIFormat.h"
+#include "SHIHardware.h"
+#include "SHIJsonWriter.h"
+
+// Compares the printf-free number formatting with snprintf
+
+// The platform provides this otherwise
+SHI::Hardware *SHI::hw = nullptr;
+
+namespace {
+
+const int ITERATIONS = 1000000;
+
+int64_t measureMs(const std::function<void(int)> &body) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ITERATIONS; i++) body(i);
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+void report(const char *name, int64_t ms, int64_t baselineMs) {
+  printf("%-28s %6lld ms (snprintf %lld ms)\n", name,
+         static_cast<long long>(ms), static_cast<long long>(baselineMs));
+}
+
+}  // namespace
+
+int main() {
+  size_t total = 0;
+  char buffer[64];
+  auto fixed = measureMs([&](int i) {
+    total += SHI::Format::formatFixed(i * 0.37, 2, buffer);
+  });
+  auto fixedPrintf = measureMs([&](int i) {
+    total += snprintf(buffer, sizeof(buffer), "%0.2f", i * 0.37);
+  });
+  report("Format::formatFixed", fixed, fixedPrintf);
+
+  std::ostringstream out;
+  auto json = measureMs([&](int i) {
+    SHI::JsonWriter writer(&out);
+    writer.value(i * 0.25 + 0.5);
+    if (out.tellp() > 4096) out.str("");
+  });
+  // What JsonWriter::value(double) did before
+  auto jsonPrintf = measureMs([&](int i) {
+    double number = i * 0.25 + 0.5;
+    int length = snprintf(buffer, sizeof(buffer), "%.15g", number);
+    if (strtod(buffer, nullptr) != number)
+      length = snprintf(buffer, sizeof(buffer), "%.17g", number);
+    out.write(buffer, length);
+    if (out.tellp() > 4096) out.str("");
+  });
+  report("JsonWriter::value(double)", json, jsonPrintf);
+  return total == 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "SHIBus.h"
+#include "SHIBusArbiter.h"
+#include "SHIHardware.h"
+#include "SHII2CQueue.h"
+#include "TestHardware.h"
+
+// Exercises the bus arbiter from several threads, its statistics once
+// devices are removed and the I2C queues submitted from other threads.
+
+// The platform provides this otherwise
+SHI::Hardware *SHI::hw = nullptr;
+int SHITest::failures = 0;
+
+using SHITest::check;
+
+namespace {
+
+const int THREADS = 4;
+const int ROUNDS = 1000;
+
+std::string statistic(SHI::Bus *bus, const std::string &key) {
+  for (auto &&entry : bus->getStatistics()) {
+    if (entry.first == key) return entry.second;
+  }
+  return "";
+}
+
+class BusSensor : public SHITest::CountingSensor {
+ public:
+  BusSensor(const std::string &name, SHI::Bus *bus)
+      : CountingSensor(name), bus(bus) {}
+  SHI::Bus *getBus() override { return bus; }
+
+ private:
+  SHI::Bus *bus;
+};
+
+/// Registers that read back what was written, the first byte of a write
+/// selects the register
+class MemoryI2CBus : public SHI::I2CBus {
+ public:
+  MemoryI2CBus() : SHI::I2CBus("MemoryI2CBus") {}
+  void begin(SHI::Configuration *config) override {}
+  void stop() override {}
+  void loop() override { processSubmitted(); }
+  std::vector<std::pair<int, std::string>> getUsedPins() override {
+    return {};
+  }
+  void accept(SHI::Visitor &visitor) override {}
+  const SHI::Configuration *getConfig() const override { return nullptr; }
+  bool reconfigure(SHI::Configuration *newConfig) override { return false; }
+  uint8_t lastError() override { return 0; }
+  char *getErrorText(uint8_t err) override { return nullptr; }
+  SHI::I2CError writeTransmission(uint16_t address, uint8_t *buff,
+                                  uint16_t size, bool sendStop) override {
+    selected = buff[0];
+    for (int i = 1; i < size; i++) registers[selected + i - 1] = buff[i];
+    return SHI::I2CError::I2C_ERROR_OK;
+  }
+  SHI::I2CError readTransmission(uint16_t address, uint8_t *buff,
+                                 uint16_t size, bool sendStop,
+                                 uint32_t *readCount) override {
+    for (int i = 0; i < size; i++) buff[i] = registers[selected + i];
+    if (readCount != nullptr) *readCount = size;
+    return SHI::I2CError::I2C_ERROR_OK;
+  }
+  void beginTransmission(uint16_t address) override {}
+  uint8_t endTransmission(bool sendStop) override { return 0; }
+  uint8_t requestFrom(uint16_t address, uint8_t size, bool sendStop) override {
+    return size;
+  }
+  size_t write(uint8_t) override { return 1; }
+  size_t write(const uint8_t *, size_t size) override { return size; }
+  int available(void) override { return 0; }
+  int read(void) override { return -1; }
+  int peek(void) override { return -1; }
+  void flush(void) override {}
+  void onReceive(void (*)(int)) override {}
+  void onRequest(void (*)(void)) override {}
+  bool busy() override { return false; }
+
+  std::map<uint8_t, uint8_t> registers;
+  uint8_t selected = 0;
+};
+
+void testContention() {
+  SHITest::TestBus bus("bus");
+  std::vector<std::unique_ptr<SHITest::CountingSensor>> devices;
+  std::atomic<int> holders{0};
+  int counter = 0;
+  bool overlapped = false;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < THREADS; i++) {
+    devices.emplace_back(
+        new SHITest::CountingSensor("device" + std::to_string(i)));
+    auto device = devices.back().get();
+    threads.emplace_back([&, i, device] {
+      for (int k = 0; k < ROUNDS; k++) {
+        SHI::BusTransaction transaction(&bus, device, i);
+        // The owner may acquire the bus again
+        SHI::BusTransaction nested(&bus, device);
+        if (++holders != 1) overlapped = true;
+        counter++;
+        holders--;
+      }
+    });
+  }
+  for (auto &&thread : threads) thread.join();
+  check(!overlapped, "one holder at a time");
+  check(counter == THREADS * ROUNDS, "no lost increments");
+  for (auto &&device : devices) {
+    check(statistic(&bus, device->getName() + ".transactions") ==
+              std::to_string(ROUNDS),
+          "nested transactions counted once");
+  }
+}
+
+void testRemovedDevice() {
+  SHITest::TestHardware hardware;
+  SHI::hw = &hardware;
+  SHITest::TestBus bus("bus");
+  auto removed = std::make_shared<BusSensor>("removed", &bus);
+  hardware.addSensor(removed);
+  { SHI::BusTransaction transaction(&bus, removed.get()); }
+  check(statistic(&bus, "removed.transactions") == "1",
+        "transaction counted");
+  check(hardware.removeSensor(removed.get()), "sensor removed");
+  removed.reset();
+  check(statistic(&bus, "removed.transactions").empty(),
+        "statistics of a removed sensor are dropped");
+  {
+    // A device that is destroyed without being removed keeps its name
+    auto other = std::make_shared<BusSensor>("other", &bus);
+    SHI::BusTransaction transaction(&bus, other.get());
+  }
+  check(statistic(&bus, "other.transactions") == "1",
+        "statistics outlive the device");
+  SHI::hw = nullptr;
+}
+
+void testI2CQueue() {
+  MemoryI2CBus bus;
+  SHITest::CountingSensor first("first"), second("second");
+  bus.registers[2] = 42;
+  std::atomic<bool> stop{false};
+  std::atomic<int> completed{0};
+  std::atomic<int> wrong{0};
+  // Another thread submits while the loop thread processes
+  std::thread submitter([&] {
+    for (int k = 0; k < ROUNDS; k++) {
+      SHI::I2CTransactionQueue queue;
+      uint8_t value = 0;
+      std::atomic<bool> done{false};
+      queue.readRegister(0x76, 2, &value, 1);
+      bus.submit(&queue, k % 2 ? &first : &second,
+                 [&](SHI::I2CError error) {
+                   if (error != SHI::I2CError::I2C_ERROR_OK) wrong++;
+                   done = true;
+                 });
+      while (!done) std::this_thread::yield();
+      if (value != 42) wrong++;
+      completed++;
+    }
+    stop = true;
+  });
+  while (!stop) bus.loop();
+  submitter.join();
+  check(completed == ROUNDS, "every submission completed");
+  check(wrong == 0, "every submission read the register");
+  check(statistic(&bus, "first.transactions") == std::to_string(ROUNDS / 2),
+        "submissions charged to the first device");
+  check(statistic(&bus, "second.transactions") == std::to_string(ROUNDS / 2),
+        "submissions charged to the second device");
+}
+
+}  // namespace
+
+int main() {
+  testContention();
+  testRemovedDevice();
+  testI2CQueue();
+  return SHITest::failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+
+#include "SHIConfigHolder.h"
+#include "SHIFactory.h"
+#include "SHIHardware.h"
+#include "SHILinuxBus.h"
+#include "SHISensor.h"
+#include "TestHardware.h"
+
+// Reads configuration snapshots on one thread while the loop thread
+// reconfigures, a torn read shows up as a device that does not match the
+// speed. Also adds and removes sensors through Factory::reconfigure().
+
+// The platform provides this otherwise
+SHI::Hardware *SHI::hw = nullptr;
+int SHITest::failures = 0;
+
+using SHI::LinuxSPIBusConfiguration;
+using SHITest::check;
+
+namespace {
+
+const int ROUNDS = 2000;
+
+LinuxSPIBusConfiguration variant(int round) {
+  LinuxSPIBusConfiguration config;
+  config.device = round % 2 ? "/dev/odd" : "/dev/even-round";
+  config.speed = round % 2 ? 1 : 2;
+  return config;
+}
+
+bool isConsistent(const LinuxSPIBusConfiguration &config) {
+  return config.device == (config.speed == 1 ? "/dev/odd" : "/dev/even-round");
+}
+
+class ConfiguredSensor : public SHITest::CountingSensor {
+ public:
+  explicit ConfiguredSensor(const LinuxSPIBusConfiguration &config)
+      : CountingSensor("ConfiguredSensor"), config(config) {}
+  const SHI::Configuration *getConfig() const override { return &config; }
+  bool reconfigure(SHI::Configuration *newConfig) override {
+    config = castConfig<LinuxSPIBusConfiguration>(newConfig);
+    return true;
+  }
+
+ private:
+  LinuxSPIBusConfiguration config;
+};
+
+void testHolder() {
+  SHI::ConfigHolder<LinuxSPIBusConfiguration> holder(variant(0));
+  std::atomic<bool> stop{false};
+  int reads = 0, torn = 0;
+  std::thread reader([&] {
+    while (!stop) {
+      auto snapshot = holder.load();
+      if (!isConsistent(*snapshot)) torn++;
+      reads++;
+    }
+  });
+  for (int i = 1; i <= ROUNDS * 10; i++) {
+    holder.store(variant(i));
+    if (!isConsistent(*holder.get())) torn++;
+  }
+  stop = true;
+  reader.join();
+  check(torn == 0, "holder snapshots are consistent");
+  check(holder.getVersion() == ROUNDS * 10, "every store counted");
+}
+
+std::string sensorJson(int round, bool twoSensors) {
+  auto config = variant(round);
+  std::string sensor = R"({"Configured":{"device":")" + config.device +
+                       R"(","speed":)" + std::to_string(config.speed) + "}}";
+  std::string sensors = twoSensors ? sensor + "," + sensor : sensor;
+  return R"({"hw":{"$sensors":[)" + sensors + "]}}";
+}
+
+void testReconfigure() {
+  auto factory = SHI::Factory::get();
+  factory->registerFactory("hw", [factory](const JsonObject &obj) {
+    return factory->defaultHardwareFactory(new SHITest::TestHardware(), obj);
+  });
+  factory->registerConfiguredFactory<LinuxSPIBusConfiguration, SHI::Sensor>(
+      "Configured", [](const LinuxSPIBusConfiguration &config) {
+        return new ConfiguredSensor(config);
+      });
+  auto result = factory->construct(sensorJson(0, false));
+  auto hardware = static_cast<SHITest::TestHardware *>(std::get<0>(result));
+  if (!check(hardware != nullptr, "hardware constructed")) return;
+  hardware->setup("test");
+  // The first sensor stays, so the reader can keep its pointer
+  auto sensor = (*hardware->sensors[0]->getSensors())[0].get();
+
+  std::atomic<bool> stop{false};
+  int reads = 0, torn = 0;
+  std::thread reader([&] {
+    while (!stop) {
+      auto snapshot = sensor->getConfigAs<LinuxSPIBusConfiguration>();
+      if (!isConsistent(*snapshot)) torn++;
+      reads++;
+    }
+  });
+  for (int i = 1; i <= ROUNDS; i++) {
+    SHI::ReconfigurationStats stats;
+    // Every fourth round adds a second sensor and the next one removes it
+    bool twoSensors = i % 4 == 0;
+    auto error = factory->reconfigure(sensorJson(i, twoSensors), &stats);
+    check(error == SHI::FactoryErrors::None, "reconfigured");
+    check(stats.reconfigured >= 1, "the first sensor reconfigured");
+    if (twoSensors) check(stats.added == 1, "second sensor added");
+    if (i % 4 == 1 && i > 1) check(stats.removed == 1, "second removed");
+    hardware->loop();
+  }
+  stop = true;
+  reader.join();
+  check(torn == 0, "published sensor snapshots are consistent");
+  check(isConsistent(*sensor->getConfigAs<LinuxSPIBusConfiguration>()),
+        "final snapshot consistent");
+  check(hardware->errors == 0, "no errLeds()");
+  SHI::hw = nullptr;
+  delete hardware;
+}
+
+}  // namespace
+
+int main() {
+  testHolder();
+  testReconfigure();
+  return SHITest::failures == 0 ? 0 : 1;
+}
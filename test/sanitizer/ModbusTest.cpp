@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "SHIHardware.h"
+#include "SHIModbus.h"
+#include "SHISensor.h"
+#include "TestHardware.h"
+
+// Reads seven points of three simulated slaves through two ModbusSensors
+// sharing one ModbusRTUMaster. Every response is preceded by a garbage
+// byte, one slave answers with an exception and one does not answer.
+
+// The platform provides this otherwise
+SHI::Hardware *SHI::hw = nullptr;
+int SHITest::failures = 0;
+
+using SHI::ModbusDataType;
+using SHI::ModbusFunction;
+using SHITest::check;
+
+namespace {
+
+const uint8_t ABSENT_SLAVE = 9;
+/// Requests starting at this register get an exception response
+const uint16_t ILLEGAL_ADDRESS = 1000;
+
+/// Answers every request right away. A register holds its address * 10 plus
+/// the slave id.
+class SimulatedSlaves : public SHI::SerialBus {
+ public:
+  SimulatedSlaves() : SHI::SerialBus("SimulatedSlaves") {}
+  void begin(SHI::Configuration *config) override {}
+  void stop() override {}
+  void loop() override {}
+  std::vector<std::pair<int, std::string>> getUsedPins() override {
+    return {};
+  }
+  void accept(SHI::Visitor &visitor) override {}
+  const SHI::Configuration *getConfig() const override { return nullptr; }
+  bool reconfigure(SHI::Configuration *newConfig) override { return true; }
+
+  int available() override { return received.size(); }
+  int availableForWrite() override { return 256; }
+  int peek() override { return received.empty() ? -1 : received.front(); }
+  int read() override {
+    if (received.empty()) return -1;
+    int value = received.front();
+    received.pop_front();
+    return value;
+  }
+  size_t read(uint8_t *buffer, size_t size) override {
+    size_t count = 0;
+    while (count < size && !received.empty()) {
+      buffer[count++] = received.front();
+      received.pop_front();
+    }
+    return count;
+  }
+  void flush(bool txOnly) override {}
+  using SHI::Print::write;
+  size_t write(uint8_t data) override { return write(&data, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override {
+    requests++;
+    uint8_t slave = buffer[0];
+    uint8_t function = buffer[1];
+    uint16_t start = buffer[2] << 8 | buffer[3];
+    uint16_t count = buffer[4] << 8 | buffer[5];
+    if (slave == ABSENT_SLAVE) return size;
+    received.push_back(0x11);
+    std::vector<uint8_t> response = {slave, function};
+    if (start >= ILLEGAL_ADDRESS) {
+      response[1] |= 0x80;
+      response.push_back(2);
+    } else {
+      response.push_back(count * 2);
+      for (uint16_t i = 0; i < count; i++) {
+        uint16_t value = (start + i) * 10 + slave;
+        response.push_back(value >> 8);
+        response.push_back(value & 0xFF);
+      }
+    }
+    uint16_t crc = SHI::modbusCRC(response.data(), response.size());
+    response.push_back(crc & 0xFF);
+    response.push_back(crc >> 8);
+    received.insert(received.end(), response.begin(), response.end());
+    return size;
+  }
+
+  std::deque<uint8_t> received;
+  int requests = 0;
+};
+
+std::shared_ptr<SHI::MeasurementMetaData> meta(const std::string &name,
+                                               SHI::SensorDataType type) {
+  return std::make_shared<SHI::MeasurementMetaData>(name, "", type);
+}
+
+std::vector<std::string> values(const SHI::MeasurementBuffer &buffer) {
+  std::vector<std::string> result;
+  for (size_t i = 0; i < buffer.size(); i++) {
+    auto &bundle = buffer[i];
+    for (size_t k = 0; k < bundle.size(); k++) {
+      auto measurement = bundle.toMeasurement(k);
+      result.push_back(measurement.getMetaData()->getName() + "=" +
+                       measurement.stringRepresentation);
+    }
+  }
+  return result;
+}
+
+}  // namespace
+
+int main() {
+  SHITest::TestHardware hardware;
+  SHI::hw = &hardware;
+  SimulatedSlaves slaves;
+  auto master = std::make_shared<SHI::ModbusRTUMaster>(&slaves, 115200);
+  master->setResponseTimeout(20);
+  SHI::ModbusSensor meterA("meterA", master), meterB("meterB", master);
+  auto floatType = SHI::SensorDataType::FLOAT;
+  for (uint16_t reg : {0, 1, 2, 4}) {
+    meterA.addPoint({1, ModbusFunction::READ_HOLDING_REGISTERS, reg,
+                     ModbusDataType::UINT16, 0.1f, false},
+                    meta("r" + std::to_string(reg), floatType));
+  }
+  meterB.addPoint({1, ModbusFunction::READ_HOLDING_REGISTERS, 3,
+                   ModbusDataType::INT32, 1, false},
+                  meta("i32", SHI::SensorDataType::INT));
+  meterB.addPoint({2, ModbusFunction::READ_HOLDING_REGISTERS, ILLEGAL_ADDRESS,
+                   ModbusDataType::INT16, 1, false},
+                  meta("exception", floatType));
+  meterB.addPoint({ABSENT_SLAVE, ModbusFunction::READ_INPUT_REGISTERS, 5,
+                   ModbusDataType::INT16, 1, false},
+                  meta("absent", floatType));
+  check(master->getRequestCount() == 3, "seven points in three requests");
+
+  SHI::MeasurementBuffer buffer;
+  meterA.triggerSensor();
+  meterB.triggerSensor();
+  meterA.collectSensor(buffer);
+  meterB.collectSensor(buffer);
+  std::vector<std::string> expected = {
+      "r0=0.1", "r1=1.1", "r2=2.1", "r4=4.1", "i32=2031657",
+      "exception=<ERROR>", "absent=<ERROR>"};
+  check(values(buffer) == expected, "values decoded, failures marked");
+  check(slaves.requests == 3, "one cycle serves both sensors");
+
+  // Sequential reads share the cycle of the first sensor as well
+  SHI::MeasurementBuffer sequential;
+  int before = slaves.requests;
+  meterA.readSensorInto(sequential);
+  meterB.readSensorInto(sequential);
+  check(slaves.requests - before == 3, "sequential reads share a cycle");
+  check(values(sequential) == expected, "sequential values match");
+  check(meterA.getBus() == &slaves, "sensors report the serial bus");
+  SHI::hw = nullptr;
+  return SHITest::failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SHICommunicator.h"
+#include "SHIHardware.h"
+#include "SHISensor.h"
+#include "TestHardware.h"
+
+// Sets up and reads eight sensors on three buses on the thread pool.
+// Sensors of the same bus must never run at the same time, the readings
+// must arrive in the sequential order and lazy sensors are set up on their
+// first read.
+
+// The platform provides this otherwise
+SHI::Hardware *SHI::hw = nullptr;
+int SHITest::failures = 0;
+
+using SHITest::check;
+
+namespace {
+
+const int SENSORS = 8;
+const int SLOW_MS = 10;
+
+/// Tracks how many sensors use a bus at the same time
+struct BusUsage {
+  std::atomic<int> active{0};
+  std::atomic<int> maxActive{0};
+  void enter() {
+    int now = ++active;
+    int seen = maxActive;
+    while (now > seen && !maxActive.compare_exchange_weak(seen, now)) {
+    }
+  }
+  void leave() { --active; }
+};
+
+BusUsage total;
+
+class SlowSensor : public SHITest::CountingSensor {
+ public:
+  SlowSensor(const std::string &name, SHI::Bus *bus, BusUsage *usage)
+      : CountingSensor(name), bus(bus), usage(usage) {}
+  SHI::Bus *getBus() override { return bus; }
+  bool setupSensor() override {
+    use();
+    setups++;
+    return true;
+  }
+  std::vector<SHI::MeasurementBundle> readSensor() override {
+    use();
+    return CountingSensor::readSensor();
+  }
+
+  std::atomic<int> setups{0};
+
+ private:
+  void use() {
+    usage->enter();
+    total.enter();
+    std::this_thread::sleep_for(std::chrono::milliseconds(SLOW_MS));
+    total.leave();
+    usage->leave();
+  }
+  SHI::Bus *bus;
+  BusUsage *usage;
+};
+
+class RecordingCommunicator : public SHI::Communicator {
+ public:
+  RecordingCommunicator() : SHI::Communicator("RecordingCommunicator") {}
+  void setupCommunication() override {}
+  void loopCommunication() override {}
+  void newReading(const SHI::MeasurementBundle &reading) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    order.push_back(reading.src->getName());
+  }
+  const SHI::Configuration *getConfig() const override { return nullptr; }
+  bool reconfigure(SHI::Configuration *newConfig) override { return false; }
+
+  std::mutex mutex;
+  std::vector<std::string> order;
+};
+
+std::vector<std::string> run(size_t threads) {
+  SHITest::TestHardware hardware;
+  SHI::hw = &hardware;
+  SHITest::TestBus busA("busA"), busB("busB");
+  std::map<SHI::Bus *, BusUsage> usage;
+  std::vector<std::shared_ptr<SlowSensor>> sensors;
+  for (int i = 0; i < SENSORS; i++) {
+    // Four on busA, two on busB and two without a bus
+    SHI::Bus *bus = i < 4 ? &busA : (i < 6 ? &busB : nullptr);
+    auto sensor = std::make_shared<SlowSensor>("sensor" + std::to_string(i),
+                                               bus, &usage[bus]);
+    sensors.push_back(sensor);
+    hardware.addSensor(sensor);
+  }
+  sensors.back()->setLazySetup(true);
+  auto communicator = std::make_shared<RecordingCommunicator>();
+  hardware.addCommunicator(communicator);
+  if (threads > 0) hardware.setSamplingThreads(threads);
+  total.maxActive = 0;
+
+  hardware.setup("test");
+  check(hardware.getSetupTimeline().size() == SENSORS - 1,
+        "all sensors but the lazy one set up during boot");
+  check(sensors.back()->setups == 0, "lazy sensor not set up during boot");
+
+  hardware.loop();
+  for (auto &sensor : sensors) {
+    check(sensor->setups == 1, "every sensor set up exactly once");
+    check(sensor->reads == 1, "every sensor read exactly once");
+  }
+  check(hardware.getSetupTimeline().size() == SENSORS,
+        "lazy setup recorded in the timeline");
+  check(hardware.getSetupTimeline().back().lazy, "last setup was lazy");
+  for (auto &entry : usage) {
+    check(entry.second.maxActive == 1,
+          "sensors of the same bus never overlap");
+  }
+  if (threads > 1) {
+    check(total.maxActive > 1, "sensors of different buses overlap");
+  }
+  check(hardware.errors == 0, "no errLeds()");
+  SHI::hw = nullptr;
+  return communicator->order;
+}
+
+}  // namespace
+
+int main() {
+  auto sequential = run(0);
+  auto parallel = run(4);
+  check(sequential.size() == SENSORS, "every reading dispatched");
+  check(parallel == sequential, "parallel readings in sequential order");
+  return SHITest::failures == 0 ? 0 : 1;
+}
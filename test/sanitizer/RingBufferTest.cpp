@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "SHIHardware.h"
+#include "SHIRingBuffer.h"
+#include "TestHardware.h"
+
+// Feeds 1000 SDS011 style frames with garbage in between through a small
+// ring buffer in random chunks, so that frames wrap around its end. Run it
+// under AddressSanitizer to catch reads outside of the ring.
+
+// The platform provides this otherwise
+SHI::Hardware *SHI::hw = nullptr;
+int SHITest::failures = 0;
+
+using SHITest::check;
+
+namespace {
+
+const int FRAMES = 1000;
+const size_t FRAME_SIZE = 10;
+const uint8_t SYNC[] = {0xAA, 0xC0};
+const uint8_t TAIL = 0xAB;
+
+uint8_t checksum(const uint8_t *data) {
+  uint8_t sum = 0;
+  for (int i = 2; i < 8; i++) sum += data[i];
+  return sum;
+}
+
+class SDSParser : public SHI::FixedLengthFrameParser {
+ public:
+  explicit SDSParser(SHI::RingBuffer *ring)
+      : FixedLengthFrameParser(ring, SYNC, sizeof(SYNC), FRAME_SIZE) {}
+  bool isValid(const SHI::FrameView &frame) override {
+    uint8_t sum = 0;
+    for (int i = 2; i < 8; i++) sum += frame[i];
+    return frame[8] == sum && frame[9] == TAIL;
+  }
+};
+
+}  // namespace
+
+int main() {
+  std::mt19937 random(3);
+  std::vector<uint8_t> stream;
+  std::vector<std::vector<uint8_t>> sent;
+  for (int i = 0; i < FRAMES; i++) {
+    if (random() % 3 == 0) {
+      // Garbage, often starting like a frame
+      int garbage = random() % 5;
+      for (int k = 0; k < garbage; k++) {
+        stream.push_back(random() % 2 ? SYNC[0] : random());
+      }
+    }
+    std::vector<uint8_t> frame(FRAME_SIZE);
+    frame[0] = SYNC[0];
+    frame[1] = SYNC[1];
+    for (int k = 2; k < 8; k++) frame[k] = random();
+    frame[8] = checksum(frame.data());
+    frame[9] = TAIL;
+    stream.insert(stream.end(), frame.begin(), frame.end());
+    sent.push_back(frame);
+  }
+
+  SHI::RingBuffer ring(30);
+  check(ring.capacity() == 32, "capacity rounded to a power of two");
+  SDSParser parser(&ring);
+  size_t position = 0;
+  size_t received = 0;
+  bool matches = true;
+  SHI::FrameView frame;
+  while (position < stream.size()) {
+    size_t chunk =
+        std::min<size_t>(random() % 13 + 1, stream.size() - position);
+    position += ring.write(&stream[position], chunk);
+    while (parser.next(&frame)) {
+      if (received < sent.size()) {
+        for (size_t k = 0; k < FRAME_SIZE; k++) {
+          if (frame[k] != sent[received][k]) matches = false;
+        }
+      }
+      received++;
+      parser.release();
+    }
+  }
+  check(received == FRAMES, "every frame recovered");
+  check(matches, "frames recovered in order and unchanged");
+  check(parser.getInvalidFrames() == 0, "no valid frame rejected");
+  return SHITest::failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "SHIBus.h"
+#include "SHIHardware.h"
+#include "SHILinuxBus.h"
+#include "TestHardware.h"
+
+// Submits transfers to the worker of LinuxSPIBus from one thread while the
+// loop thread runs synchronous transactions with other settings. The device
+// does not exist, so every transfer has to report its failure. The spidev
+// backend only exists on Linux.
+
+// The platform provides this otherwise
+SHI::Hardware *SHI::hw = nullptr;
+int SHITest::failures = 0;
+
+using SHITest::check;
+
+#if defined(__linux__)
+
+namespace {
+
+const int ROUNDS = 200;
+
+}  // namespace
+
+int main() {
+  SHITest::TestHardware hardware;
+  SHI::hw = &hardware;
+  SHI::LinuxSPIBusConfiguration config;
+  config.device = "/dev/spidev-does-not-exist";
+  SHI::LinuxSPIBus bus(config);
+  bus.begin(nullptr);
+
+  SHI::LinuxSPIBusConfiguration fast(config), slow(config);
+  fast.speed = 8000000;
+  slow.speed = 100000;
+  std::atomic<int> done{0};
+  int succeeded = 0;
+  std::thread submitter([&] {
+    uint8_t tx[4] = {1, 2, 3, 4};
+    uint8_t rx[4];
+    for (int i = 0; i < ROUNDS; i++) {
+      auto handle = bus.submitTransfer({tx, rx, sizeof(tx), &fast},
+                                       [&done] { done++; });
+      if (handle.succeeded()) succeeded++;
+    }
+  });
+  for (int i = 0; i < ROUNDS; i++) {
+    uint8_t data[4] = {5, 6, 7, 8};
+    bus.beginTransaction(&slow);
+    bus.transfer(data, sizeof(data));
+    bus.endTransaction();
+  }
+  submitter.join();
+  check(succeeded == 0, "transfers to a missing device fail");
+  check(done == ROUNDS, "every transfer completed");
+  check(bus.getStatus().stringRepresentation.find("Not open") !=
+            std::string::npos,
+        "synchronous failure reported in the status");
+
+  SHI::SPIDoubleBuffer buffers(16);
+  for (int i = 0; i < ROUNDS; i++) {
+    buffers.getTxBuffer()[0] = i;
+    buffers.submit(&bus, 16, &fast);
+  }
+  buffers.wait();
+  bus.stop();
+  SHI::hw = nullptr;
+  return SHITest::failures == 0 ? 0 : 1;
+}
+
+#else
+
+int main() { return 0; }
+
+#endif  // __linux__
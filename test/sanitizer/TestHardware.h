@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2020 Karsten Becker All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "SHIBus.h"
+#include "SHIHardware.h"
+#include "SHISensor.h"
+
+namespace SHITest {
+
+/// Counts failed checks, main() returns it so that the test fails
+extern int failures;
+
+inline bool check(bool condition, const char *what) {
+  if (!condition) {
+    fprintf(stderr, "FAILED: %s\n", what);
+    failures++;
+  }
+  return condition;
+}
+
+/// Hardware with a real clock and thread safe logging, which parallel
+/// sampling requires
+class TestHardware : public SHI::Hardware {
+ public:
+  TestHardware() : SHI::Hardware("TestHardware") {}
+  void resetWithReason(const std::string &reason, bool restart) override {}
+  void errLeds(void) override { errors++; }
+  void setupWatchdog() override {}
+  void feedWatchdog() override {}
+  void disableWatchdog() override {}
+  std::string getNodeName() override { return "test"; }
+  std::string getResetReason() override { return ""; }
+  void resetConfig() override {}
+  void printConfig() override {}
+  void setup(const std::string &defaultName) override {
+    setupSensors();
+    setupCommunicators();
+  }
+  void loop() override { internalLoop(); }
+  int64_t getEpochInMs() override {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+  const SHI::Configuration *getConfig() const override { return nullptr; }
+  bool reconfigure(SHI::Configuration *newConfig) override { return false; }
+  void log(const std::string &message) override {
+    std::lock_guard<std::mutex> lock(logMutex);
+    logged.push_back(message);
+  }
+  using SHI::Hardware::sensors;
+
+  std::atomic<int> errors{0};
+  std::mutex logMutex;
+  std::vector<std::string> logged;
+};
+
+/// A bus without a device behind it, only its arbiter is used
+class TestBus : public SHI::Bus {
+ public:
+  explicit TestBus(const std::string &name) : SHI::Bus(name) {}
+  void begin(SHI::Configuration *config) override {}
+  void stop() override {}
+  void loop() override {}
+  std::vector<std::pair<int, std::string>> getUsedPins() override {
+    return {};
+  }
+  void accept(SHI::Visitor &visitor) override {}
+  const SHI::Configuration *getConfig() const override { return nullptr; }
+  bool reconfigure(SHI::Configuration *newConfig) override { return false; }
+};
+
+/// Reports the number of reads as its only value
+class CountingSensor : public SHI::Sensor {
+ public:
+  explicit CountingSensor(const std::string &name) : SHI::Sensor(name) {
+    meta = std::make_shared<SHI::MeasurementMetaData>(
+        "count", "", SHI::SensorDataType::INT);
+    addMetaData(meta);
+  }
+  std::vector<SHI::MeasurementBundle> readSensor() override {
+    return {SHI::MeasurementBundle({meta->measuredInt(++reads)}, this)};
+  }
+  bool setupSensor() override { return true; }
+  bool stopSensor() override { return true; }
+  const SHI::Configuration *getConfig() const override { return nullptr; }
+  bool reconfigure(SHI::Configuration *newConfig) override { return false; }
+
+  std::shared_ptr<SHI::MeasurementMetaData> meta;
+  std::atomic<int> reads{0};
+};
+
+}  // namespace SHITest